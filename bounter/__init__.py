@@ -9,6 +9,7 @@
 
 __version__ = '1.1.0'
 
-from .count_min_sketch import CountMinSketch
-from bounter_htc import HT_Basic as HashTable
+from .count_min_sketch import CountMinSketch, CountMinSketchRing, CardinalityEstimator, union_cardinality
+from bounter_htc import HT_Basic as HashTable, HT_Swiss as SwissHashTable, HT_SpaceSaving as SpaceSavingHashTable, \
+    HT_Concurrent as ConcurrentHashTable
 from .bounter import bounter
@@ -11,7 +11,7 @@ from .count_min_sketch import CountMinSketch, CardinalityEstimator
 from bounter_htc import HT_Basic as HashTable
 
 
-def bounter(size_mb=None, need_iteration=True, need_counts=True, log_counting=None):
+def bounter(size_mb=None, need_iteration=True, need_counts=True, log_counting=None, hll_precision=16):
     """Factory method for bounter implementation.
 
     Args:
@@ -21,19 +21,24 @@ def bounter(size_mb=None, need_iteration=True, need_counts=True, log_counting=No
                 With `False`, create a `CountMinSketch` implementation which performs better in limited-memory scenarios,
                 but does not support iteration over elements.
             need_counts (Bool): With `True`, construct the structure normally. With `False`, ignore all remaining
-                parameters and create a minimalistic cardinality counter based on hyperloglog which only takes 64KB memory.
+                parameters except `hll_precision` and create a minimalistic cardinality counter based on hyperloglog
+                which only takes 48KB memory.
             log_counting (int): Counting to use with `CountMinSketch` implementation. Accepted values are
                 `None` (default counting with 32-bit integers), 1024 (16-bit), 8 (8-bit).
                 See `CountMinSketch` documentation for details.
                 Raise ValueError if not `None `and `need_iteration` is `True`.
+            hll_precision (int): Precision of the HyperLogLog cardinality estimator, in range 4-18. It takes
+                2^hll_precision registers of 6 bits, with a standard error of about 1.04 / sqrt(2^hll_precision).
+                0 disables cardinality tracking for a faster counter whose `cardinality()` and `quality()` raise
+                ValueError (a `HashTable` still reports its exact cardinality until it prunes keys).
     """
     if not need_counts:
-        return CardinalityEstimator()
+        return CardinalityEstimator(hll_precision=hll_precision)
     if size_mb is None:
         raise ValueError("Max size in MB must be provided.")
     if need_iteration:
         if log_counting:
             raise ValueError("Log counting is only supported with CMS implementation (need_iteration=False).")
-        return HashTable(size_mb=size_mb)
+        return HashTable(size_mb=size_mb, hll_precision=hll_precision)
     else:
-        return CountMinSketch(size_mb=size_mb, log_counting=log_counting)
+        return CountMinSketch(size_mb=size_mb, log_counting=log_counting, hll_precision=hll_precision)
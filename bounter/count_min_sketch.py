@@ -10,6 +10,30 @@
 import bounter_cmsc as cmsc
 
 
+def _dimensions(size, width, depth, cell_size):
+    """
+    Choose width and depth of a Count-min Sketch table fitting into `size` bytes, respecting explicitly requested values.
+    """
+    if width is None and depth is None:
+        width = 1 << (size // (cell_size * 8 * 2)).bit_length()
+        depth = size // (width * cell_size)
+    elif width is None:
+        avail_width = size // (depth * cell_size)
+        width = 1 << (avail_width.bit_length() - 1)
+        if not width:
+            raise ValueError("Requested depth is too large for maximum memory size.")
+    elif depth is None:
+        if width != 1 << (width.bit_length() - 1):
+            raise ValueError("Requested width must be a power of 2.")
+        depth = size // (width * cell_size)
+        if not depth:
+            raise ValueError("Requested width is too large for maximum memory size.")
+    else:
+        if width != 1 << (width.bit_length() - 1):
+            raise ValueError("Requested width must be a power of 2.")
+    return width, depth
+
+
 class CountMinSketch(object):
     """
     Data structure used to estimate frequencies of elements in massive data sets with fixed memory footprint.
@@ -31,9 +55,10 @@ class CountMinSketch(object):
            - 4B for default counting
            - 2B for log1024 counting
            - 1B for log8 counting
-        HLL size is 64 KB
+        HLL size is 2^hll_precision registers of 6 bits, 48 KB with the default precision 16 (less while few
+        distinct keys have been counted)
     Memory usage example:
-        width 2^25 (33 554 432), depth 8, log1024 (2B) has 2^(25 + 3 + 1) + 64 KB = 512.06 MB
+        width 2^25 (33 554 432), depth 8, log1024 (2B) has 2^(25 + 3 + 1) + 48 KB = 512.05 MB
         Can be pickled to disk with this exact size
     How to choose parameters:
         Preferably, start with a high `size_mb` using default counting. After counting all elements of the
@@ -47,14 +72,16 @@ class CountMinSketch(object):
         counting as the collision bias will already be minimal.
     """
 
-    def __init__(self, size_mb=64, width=None, depth=None, log_counting=None):
+    def __init__(self, size_mb=64, width=None, depth=None, log_counting=None, buffer_size=0, doorkeeper_mb=0,
+                 hll_precision=16):
         """
         Initialize the Count-Min Sketch structure with the given parameters
 
         Args:
             size_mb (int): controls the maximum size of the Count-min Sketch table.
                 If both width and depth is provided, this parameter is ignored.
-                Please note that the structure will use an overhead of approximately 65 KB in addition to the table size.
+                Please note that the structure will use an overhead of up to 49 KB (with the default `hll_precision`)
+                in addition to the table size.
             depth (int): controls the number of rows of the table. Having more rows decreases probability of a big
                 overestimation but also linearly affects performance and table size. Choose a small number such as 6-10.
                 The algorithm will default depth 8 if width is provided. Otherwise, it will choose a depth in range 8-15
@@ -67,6 +94,23 @@ class CountMinSketch(object):
                 - None (default): 4B, no counter error
                 - 1024: 2B, value approximation error ~2% for values larger than 2048
                 - 8: 1B, value approximation error ~30% for values larger than 16
+            buffer_size (int): number of entries of a small pre-aggregation buffer (64 B each) which sums repeated
+                increments of the same key before they are written into the table. Speeds up counting of skewed
+                (e.g. Zipfian) streams; a size of 1024-4096 keeps the buffer within the CPU cache. 0 (default) disables it.
+                A lookup applies only the buffered increments of its key and other queries flush the whole buffer, so
+                results are the same as without it, except that keys colliding in the table may see their conservative
+                updates applied in a different order.
+            doorkeeper_mb (int): size of a Bloom filter ("doorkeeper") placed in front of the table, taken from `size_mb`.
+                The first occurrence of each key only sets its bits in the filter and every later occurrence goes to the
+                table, so the many keys seen only once in long-tailed data do not pollute the table with collisions.
+                Queries add the filter's contribution back. A key falsely reported by the filter has its first
+                occurrence counted in the table as well, so it may be overestimated by 1, and an unseen one may read 1.
+                0 (default) disables the doorkeeper. Sketches with a doorkeeper can not be merged.
+            hll_precision (int): number of index bits of the HyperLogLog behind `cardinality()`, in range 4-18.
+                It uses 2^hll_precision registers of 6 bits, for a standard error of about 1.04 / sqrt(2^hll_precision):
+                0.4% with the default 16, 1.6% with 12 (3 KB).
+                0 disables cardinality tracking, saving its memory and the register update of every increment.
+                `cardinality()` and `quality()` then raise ValueError.
         """
 
         cell_size = CountMinSketch.cell_size(log_counting)
@@ -75,34 +119,19 @@ class CountMinSketch(object):
         if size_mb is None or not isinstance(size_mb, int):
             raise ValueError("size_mb must be an integer representing the maximum size of the structure in MB")
 
-        if width is None and depth is None:
-            self.width = 1 << (size_mb * (2 ** 20) // (cell_size * 8 * 2)).bit_length()
-            self.depth = (size_mb * (2 ** 20)) // (self.width * cell_size)
-        elif width is None:
-            self.depth = depth
-            avail_width = (size_mb * (2 ** 20)) // (depth * cell_size)
-            self.width = 1 << (avail_width.bit_length() - 1)
-            if not self.width:
-                raise ValueError("Requested depth is too large for maximum memory size.")
-        elif depth is None:
-            if width != 1 << (width.bit_length() - 1):
-                raise ValueError("Requested width must be a power of 2.")
-            self.width = width
-            self.depth = (size_mb * (2 ** 20)) // (width * cell_size)
-            if not self.depth:
-                raise ValueError("Requested width is too large for maximum memory size.")
-        else:
-            if width != 1 << (width.bit_length() - 1):
-                raise ValueError("Requested width must be a power of 2.")
-            self.width = width
-            self.depth = depth
+        if doorkeeper_mb < 0 or (doorkeeper_mb >= size_mb and (width is None or depth is None)):
+            raise ValueError("doorkeeper_mb must be a non-negative integer smaller than size_mb")
+
+        self.width, self.depth = _dimensions((size_mb - doorkeeper_mb) * (2 ** 20), width, depth, cell_size)
+        params = dict(width=self.width, depth=self.depth, buffer_size=buffer_size, doorkeeper=doorkeeper_mb * (2 ** 23),
+                      hll_precision=hll_precision)
 
         if log_counting == 8:
-            self.cms = cmsc.CMS_Log8(width=self.width, depth=self.depth)
+            self.cms = cmsc.CMS_Log8(**params)
         elif log_counting == 1024:
-            self.cms = cmsc.CMS_Log1024(width=self.width, depth=self.depth)
+            self.cms = cmsc.CMS_Log1024(**params)
         elif log_counting is None:
-            self.cms = cmsc.CMS_Conservative(width=self.width, depth=self.depth)
+            self.cms = cmsc.CMS_Conservative(**params)
         else:
             raise ValueError("Unsupported parameter log_counting=%s. Use None, 8, or 1024." % log_counting)
 
@@ -121,7 +150,8 @@ class CountMinSketch(object):
     def table_size(width, depth=4, log_counting=None):
         """
         Return size of Count-min Sketch table with provided parameters in bytes.
-        Does *not* include additional constant overhead used by parameter variables and HLL table, totalling less than 65KB.
+        Does *not* include additional constant overhead used by parameter variables and HLL table, totalling less than 49KB
+        with the default `hll_precision`.
         """
         return width * depth * CountMinSketch.cell_size(log_counting)
 
@@ -149,25 +179,66 @@ class CountMinSketch(object):
     def merge(self, other):
         """
         Merge another Count-min sketch structure into this one. The other structure must be initialized
-        with the same width, depth and algorithm, and remains unaffected by this operation.
+        with the same width, depth, algorithm and `hll_precision`, and remains unaffected by this operation.
 
         Please note that merging two halves is always less accurate than counting the whole set with a single counter,
         because the merging algorithm can not leverage the conservative update optimization.
+        Sketches with a doorkeeper can not be merged.
         """
         self.cms.merge(other.cms)
 
+    def clear(self):
+        """
+        Reset the structure to its empty state, keeping its dimensions and memory. Memory pages of a large table are
+        handed back to the operating system instead of being rewritten, so clearing is much cheaper than creating
+        a new structure, and pages are only faulted back in as counting touches them again.
+        """
+        self.cms.clear()
+
     def update(self, iterable):
         if isinstance(iterable, CountMinSketch):
             self.merge(iterable)
         else:
             self.cms.update(iterable)
 
+    def convert(self, log_counting, path=None, threads=None):
+        """
+        Return a copy of this sketch with counters converted to a narrower `log_counting` encoding (1024 or 8), which
+        halves or quarters the size of the table while keeping its width and depth. Values which cannot be represented
+        exactly are randomly rounded to one of the closest representable values, the same way `merge` does.
+
+        Rows are converted in parallel using `threads` threads (all available CPUs by default).
+        When `path` is given, the converted sketch is written into that file instead of memory and opened with `load`.
+        """
+        if log_counting not in (8, 1024):
+            raise ValueError("Unsupported parameter log_counting=%s. Use 8 or 1024." % log_counting)
+        converted = cmsc.convert(self.cms, log_counting, path, threads or 0)
+        if path is not None:
+            return CountMinSketch.load(path)
+        return CountMinSketch._wrap(converted)
+
+    @staticmethod
+    def load(path):
+        """
+        Open a sketch file written by `convert`. The table is mapped into memory copy-on-write, so it is paged in
+        lazily and shared between processes serving the same file. Changes are never written back to the file.
+        """
+        return CountMinSketch._wrap(cmsc.load(path))
+
+    @staticmethod
+    def _wrap(cms):
+        cell_sizes = {cmsc.CMS_Conservative: 4, cmsc.CMS_Log1024: 2, cmsc.CMS_Log8: 1}
+        sketch = CountMinSketch.__new__(CountMinSketch)
+        sketch.__setstate__((cms.width, cms.depth, cell_sizes[type(cms)], cms))
+        return sketch
+
     def size(self):
         """
-        Return current size of the Count-min Sketch table in bytes.
-        Does *not* include additional constant overhead used by parameter variables and HLL table, totalling less than 65KB.
+        Return current size of the Count-min Sketch table and its doorkeeper in bytes.
+        Does *not* include additional constant overhead used by parameter variables and HLL table, totalling less than 49KB
+        with the default `hll_precision`.
         """
-        return self.width * self.depth * self.cell_size_v
+        return self.width * self.depth * self.cell_size_v + self.cms.doorkeeper // 8
 
     def quality(self):
         """
@@ -179,6 +250,24 @@ class CountMinSketch(object):
         """
         return float(self.cardinality()) / self.width
 
+    def stats(self, sample=None):
+        """
+        Return a dictionary describing the load of the table, suitable for monitoring:
+            - row_fill: fraction of non-zero cells in each row
+            - histogram: number of cells by their decoded value, bucket 0 counting zeroes and bucket i values
+              in the range [2^(i-1), 2^i)
+            - saturated: fraction of cells which reached the maximum value of their counter
+            - collision_probability: probability that an unseen key is overestimated, i.e. hits a filled cell in
+              every row
+            - error_bound, error_probability: the Count-min guarantee that an estimate exceeds the true count
+              by more than error_bound with probability at most error_probability
+            - sampled: number of cells examined in each row
+
+        With `sample`, only about that many evenly spread cells of each row are examined, which keeps the call cheap
+        on huge tables at the cost of approximate fractions and histogram counts (not scaled to the full table).
+        """
+        return self.cms.stats(sample or 0)
+
     def __getstate__(self):
         return self.width, self.depth, self.cell_size_v, self.cms
 
@@ -188,8 +277,170 @@ class CountMinSketch(object):
 
 
 class CardinalityEstimator(CountMinSketch):
-    def __init__(self):
-        super(CardinalityEstimator, self).__init__(width=1, depth=1)
+    """
+    Estimator of the number of distinct keys, without counting individual keys. Backed by a native HyperLogLog,
+    so that adding keys costs little more than hashing them.
+    Example::
+        >>> estimator = CardinalityEstimator()
+        >>> estimator.update(['foo', 'bar', 'foo'])
+        >>> print(estimator.cardinality())  # 2
+        >>> print(estimator.total())  # 3
+    `update` also accepts a buffer such as an `array.array` or a numpy array, whose items are added as keys
+    of their raw bytes.
+    """
+
+    def __init__(self, hll_precision=16):
+        """
+        Args:
+            hll_precision (int): number of index bits of the HyperLogLog, in range 4-18, see `CountMinSketch`.
+        """
+        if not hll_precision:
+            raise ValueError("A cardinality estimator needs a positive hll_precision.")
+        # the dimensions of the former table-based implementation, kept for compatibility of size()
+        self.width, self.depth, self.cell_size_v = 1, 1, 4
+        self.hll = cmsc.HyperLogLog(hll_precision)
+        self.increment = self.hll.add
 
     def __getitem__(self, key):
         raise NotImplementedError("Individual item counting is not supported for cardinality estimator!")
+
+    def __contains__(self, item):
+        raise NotImplementedError("Individual item counting is not supported for cardinality estimator!")
+
+    def cardinality(self):
+        return self.hll.cardinality()
+
+    def total(self):
+        return self.hll.total()
+
+    def merge(self, *others):
+        """
+        Merge other cardinality estimators with the same `hll_precision` into this one. Any number of estimators
+        are merged in a single pass over their registers.
+        """
+        self.hll.merge_many([other.hll for other in others])
+
+    def clear(self):
+        self.hll.clear()
+
+    def update(self, iterable):
+        if isinstance(iterable, CardinalityEstimator):
+            self.merge(iterable)
+        else:
+            self.hll.add_many(iterable)
+
+    def size(self):
+        return self.width * self.depth * self.cell_size_v
+
+    def convert(self, log_counting, path=None, threads=None):
+        raise NotImplementedError("A cardinality estimator has no table to convert!")
+
+    def stats(self, sample=None):
+        raise NotImplementedError("A cardinality estimator has no table to describe!")
+
+    def __getstate__(self):
+        return self.hll
+
+    def __setstate__(self, state):
+        if isinstance(state, tuple):
+            # pickled by older versions, whose estimator was a sketch of width 1 holding the HyperLogLog
+            cms = state[3]
+            _, args, cms_state = cms.__reduce__()
+            state = cmsc.HyperLogLog(args[4] if len(args) > 4 else 16)
+            state.__setstate__((cms_state[1], cms.total()))
+        self.width, self.depth, self.cell_size_v = 1, 1, 4
+        self.hll = state
+        self.increment = self.hll.add
+
+
+def union_cardinality(estimators):
+    """
+    Return an estimate for the number of distinct keys counted by any of the cardinality estimators (with the same
+    `hll_precision`), computed in a single pass over their registers without merging them into a new estimator.
+    """
+    return cmsc.union_cardinality([estimator.hll for estimator in estimators])
+
+
+class CountMinSketchRing(object):
+    """
+    Ring of Count-min Sketch tables with one table ("slot") per time bucket, used to estimate frequencies of elements
+    over a sliding window such as the last N hours.
+    Example::
+        >>> ring = CountMinSketchRing(slots=24, size_mb=240)  # 24 slots of 10 MB each
+        >>> ring.increment("foo")
+        >>> ring.rotate()  # start a new time bucket, discarding the oldest one
+        >>> ring.increment("foo", 2)
+        >>> print(ring.get("foo", last=1))  # 2
+        >>> print(ring["foo"])  # 3
+        >>> print(ring.total(last=1))  # 2
+    All slots share the width, depth and hash functions, so each key is only hashed once per operation regardless of the
+    number of slots. Rotation releases the memory pages of the oldest slot instead of rewriting them.
+    """
+
+    def __init__(self, slots, size_mb=64, width=None, depth=None, log_counting=None):
+        """
+        Initialize the ring with the given parameters
+
+        Args:
+            slots (int): number of time buckets kept by the ring.
+            size_mb (int): controls the maximum size of all slots together, split evenly between them.
+                If both width and depth is provided, this parameter is ignored.
+            depth, width, log_counting: parameters of each slot, see `CountMinSketch`.
+        """
+        cell_size = CountMinSketch.cell_size(log_counting)
+        self.cell_size_v = cell_size
+
+        if size_mb is None or not isinstance(size_mb, int):
+            raise ValueError("size_mb must be an integer representing the maximum size of the structure in MB")
+        if not isinstance(slots, int) or slots < 1:
+            raise ValueError("The number of slots must be a positive integer.")
+
+        self.width, self.depth = _dimensions(size_mb * (2 ** 20) // slots, width, depth, cell_size)
+
+        if log_counting == 8:
+            self.ring = cmsc.CMS_Log8_Ring(width=self.width, depth=self.depth, slots=slots)
+        elif log_counting == 1024:
+            self.ring = cmsc.CMS_Log1024_Ring(width=self.width, depth=self.depth, slots=slots)
+        elif log_counting is None:
+            self.ring = cmsc.CMS_Conservative_Ring(width=self.width, depth=self.depth, slots=slots)
+        else:
+            raise ValueError("Unsupported parameter log_counting=%s. Use None, 8, or 1024." % log_counting)
+
+        # optimize calls by directly binding to C implementation
+        self.increment = self.ring.increment
+        self.get = self.ring.get
+        self.rotate = self.ring.rotate
+
+    def __getitem__(self, key):
+        return self.ring.get(key)
+
+    def slots(self):
+        return self.ring.slots()
+
+    def cardinality(self, last=None):
+        """
+        Return an estimate for the number of distinct keys counted in the last `last` slots (all slots by default).
+        """
+        return self.ring.cardinality(last)
+
+    def total(self, last=None):
+        """
+        Return a precise total sum of increments performed in the last `last` slots (all slots by default).
+        """
+        return self.ring.total(last)
+
+    def size(self):
+        """
+        Return current size of all tables of the ring in bytes.
+        Does *not* include additional constant overhead used by parameter variables and HLL tables (up to 48 KB per slot).
+        """
+        return self.width * self.depth * self.cell_size_v * self.slots()
+
+    def __getstate__(self):
+        return self.width, self.depth, self.cell_size_v, self.ring
+
+    def __setstate__(self, state):
+        self.width, self.depth, self.cell_size_v, self.ring = state
+        self.increment = self.ring.increment
+        self.get = self.ring.get
+        self.rotate = self.ring.rotate
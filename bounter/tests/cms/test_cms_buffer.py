@@ -0,0 +1,81 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import unittest
+from collections import Counter
+
+from bounter import CountMinSketch
+
+
+def zipf_stream(n):
+    return [str(i % (1 + (i * 7919) % 97)) for i in range(n)] + ['long key ' * 10] * 5
+
+
+class CountMinSketchBufferTest(unittest.TestCase):
+    def test_same_as_unbuffered(self):
+        stream = zipf_stream(5000)
+        expected = Counter(stream)
+        for log_counting in [None, 1024, 8]:
+            plain = CountMinSketch(1, log_counting=log_counting)
+            buffered = CountMinSketch(1, log_counting=log_counting, buffer_size=16)
+            plain.update(stream)
+            buffered.update(stream)
+
+            self.assertEqual(buffered.total(), plain.total())
+            self.assertEqual(buffered.cardinality(), plain.cardinality())
+            if log_counting is None:
+                for key, count in expected.items():
+                    self.assertEqual(buffered[key], count)
+
+    def test_query_flushes(self):
+        cms = CountMinSketch(1, buffer_size=1024)
+        cms.increment('foo')
+        cms.increment('foo', 2)
+        self.assertEqual(cms['foo'], 3)
+        self.assertEqual(cms.cardinality(), 1)
+        cms.increment('foo')
+        self.assertEqual(cms['foo'], 4)
+
+    def test_lookups_between_increments(self):
+        # a lookup applies only the increments of its own key
+        stream = zipf_stream(5000)
+        plain = CountMinSketch(1)
+        buffered = CountMinSketch(1, buffer_size=64)
+        for i, key in enumerate(stream):
+            plain.increment(key)
+            buffered.increment(key)
+            if i % 7 == 0:
+                self.assertEqual(buffered[stream[i // 2]], plain[stream[i // 2]])
+        self.assertEqual(buffered.total(), plain.total())
+        self.assertEqual(buffered.cardinality(), plain.cardinality())
+        for key in set(stream):
+            self.assertEqual(buffered[key], plain[key])
+
+    def test_merge_flushes(self):
+        cms1 = CountMinSketch(1, buffer_size=64)
+        cms2 = CountMinSketch(1, buffer_size=64)
+        cms1.update(['a', 'b', 'a'])
+        cms2.update(['a', 'c'])
+        cms1.merge(cms2)
+        self.assertEqual(cms1['a'], 3)
+        self.assertEqual(cms1['c'], 1)
+        self.assertEqual(cms1.cardinality(), 3)
+
+    def test_pickle_flushes(self):
+        cms = CountMinSketch(1, buffer_size=64)
+        cms.update(['a', 'b', 'a'])
+        reloaded = pickle.loads(pickle.dumps(cms))
+        self.assertEqual(reloaded['a'], 2)
+        reloaded.increment('a')
+        self.assertEqual(reloaded['a'], 3)
+
+
+if __name__ == '__main__':
+    unittest.main()
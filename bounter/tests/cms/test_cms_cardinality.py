@@ -0,0 +1,84 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import math
+import pickle
+import random
+import unittest
+
+from bounter import HashTable
+from bounter.count_min_sketch import CardinalityEstimator
+
+
+def simulated_registers(cardinality, k=16, seed=0):
+    """
+    Sample HLL registers of 2^k buckets after adding `cardinality` distinct 64-bit hashes,
+    using the distribution of the maximum rank within a bucket.
+    """
+    rnd = random.Random(seed)
+    m = 2 ** k
+    per_bucket = float(cardinality) / m
+    registers = bytearray(m)
+    for i in range(m):
+        u = 1.0 - rnd.random()
+        # with a Poisson number of hashes in the bucket, P(register <= r) = exp(-per_bucket * 2^-r)
+        r = int(math.ceil(math.log(per_bucket / -math.log(u), 2))) if u < 1.0 else 0
+        registers[i] = max(0, min(r, 64 - k + 1))
+    return registers
+
+
+class CardinalityTest(unittest.TestCase):
+    def load_registers(self, registers):
+        estimator = CardinalityEstimator()
+        estimator.hll.__setstate__((registers, 0))
+        return estimator
+
+    def test_small_cardinalities(self):
+        for cardinality in [1, 2, 10, 100, 1000, 10000, 100000]:
+            estimator = CardinalityEstimator()
+            estimator.update(str(i) for i in range(cardinality))
+            self.assertAlmostEqual(estimator.cardinality(), cardinality, delta=max(1, cardinality * 0.01))
+
+    def test_hashtable_cardinality(self):
+        ht = HashTable(buckets=1024)
+        ht.update(str(i) for i in range(100000))
+        self.assertAlmostEqual(ht.cardinality(), 100000, delta=1000)
+
+    def test_mid_range_unbiased(self):
+        # the range between linear counting and the raw estimate is where the classic estimator is the most biased
+        errors = []
+        for seed in range(5):
+            estimator = CardinalityEstimator()
+            estimator.update('%d-%d' % (seed, i) for i in range(200000))
+            errors.append(estimator.cardinality() / 200000.0 - 1)
+        self.assertLess(abs(sum(errors) / len(errors)), 0.005)
+
+    def test_incremental_matches_recount(self):
+        # the estimate is kept up to date by updates, while unpickled registers are counted anew
+        for cardinality in [10, 3000, 5000, 100000]:
+            estimator = CardinalityEstimator()
+            estimator.update(str(i) for i in range(cardinality))
+            self.assertEqual(pickle.loads(pickle.dumps(estimator)).cardinality(), estimator.cardinality())
+            self.assertEqual(self.load_registers(estimator.hll.__reduce__()[2][0]).cardinality(),
+                             estimator.cardinality())
+
+    def test_billions(self):
+        for cardinality in [2 ** 32, 10 ** 10, 10 ** 12]:
+            estimator = self.load_registers(simulated_registers(cardinality))
+            self.assertAlmostEqual(estimator.cardinality(), cardinality, delta=cardinality * 0.02)
+
+    def test_legacy_registers(self):
+        # registers stored by 32-bit hashing are capped at rank 32 - k + 1
+        registers = simulated_registers(10 ** 7)
+        legacy = bytearray(min(r, 17) for r in registers)
+        self.assertAlmostEqual(self.load_registers(legacy).cardinality(), 10 ** 7, delta=10 ** 7 * 0.02)
+
+
+if __name__ == '__main__':
+    unittest.main()
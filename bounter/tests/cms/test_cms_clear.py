@@ -0,0 +1,72 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import os
+import unittest
+
+from bounter import CountMinSketch
+from bounter.count_min_sketch import CardinalityEstimator
+
+filename = 'cms-test.sketch'
+
+
+class CountMinSketchClearTest(unittest.TestCase):
+    def tearDown(self):
+        if os.path.isfile(filename):
+            os.remove(filename)
+
+    def check_cleared(self, cms):
+        self.assertEqual(cms.total(), 0)
+        self.assertEqual(cms.cardinality(), 0)
+        for i in range(100):
+            self.assertEqual(cms[str(i)], 0)
+        cms.update(['foo', 'foo', 'bar'])
+        self.assertEqual(cms['foo'], 2)
+        self.assertEqual(cms['bar'], 1)
+        self.assertEqual(cms.total(), 3)
+        self.assertEqual(cms.cardinality(), 2)
+
+    def test_clear(self):
+        for log_counting in [None, 1024, 8]:
+            cms = CountMinSketch(2, log_counting=log_counting)
+            cms.update(str(i) for i in range(100))
+            cms.clear()
+            self.check_cleared(cms)
+
+    def test_clear_large(self):
+        cms = CountMinSketch(64)
+        cms.update(str(i) for i in range(100))
+        cms.clear()
+        self.check_cleared(cms)
+
+    def test_clear_buffered(self):
+        cms = CountMinSketch(2, buffer_size=16, doorkeeper_mb=1)
+        cms.update(str(i % 10) for i in range(100))
+        cms.clear()
+        self.check_cleared(cms)
+
+    def test_clear_loaded(self):
+        cms = CountMinSketch(2)
+        cms.update(str(i) for i in range(100))
+        cms.convert(1024, path=filename)
+        loaded = CountMinSketch.load(filename)
+        loaded.clear()
+        self.check_cleared(loaded)
+        self.assertEqual(CountMinSketch.load(filename)['1'], 1)
+
+    def test_clear_cardinality_estimator(self):
+        estimator = CardinalityEstimator()
+        estimator.update(str(i) for i in range(100))
+        estimator.clear()
+        self.assertEqual(estimator.cardinality(), 0)
+        self.assertEqual(estimator.total(), 0)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,81 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import os
+import pickle
+import unittest
+
+import bounter_cmsc as cmsc
+from bounter import CountMinSketch
+
+filename = 'cms-test.sketch'
+
+
+class CountMinSketchConvertTest(unittest.TestCase):
+    def setUp(self):
+        self.cms = CountMinSketch(width=2 ** 12, depth=6)
+        for i in range(500):
+            self.cms.increment(str(i), i * 13)
+
+    def tearDown(self):
+        if os.path.isfile(filename):
+            os.remove(filename)
+
+    def check_converted(self, converted, log_counting, error):
+        self.assertEqual(converted.width, self.cms.width)
+        self.assertEqual(converted.depth, self.cms.depth)
+        self.assertEqual(converted.size(), self.cms.size() * CountMinSketch.cell_size(log_counting) // 4)
+        self.assertEqual(converted.total(), self.cms.total())
+        self.assertEqual(converted.cardinality(), self.cms.cardinality())
+        for i in range(500):
+            expected = self.cms[str(i)]
+            self.assertAlmostEqual(converted[str(i)], expected, delta=expected * error)
+
+    def test_convert_log1024(self):
+        converted = self.cms.convert(1024)
+        self.assertEqual(type(converted.cms), cmsc.CMS_Log1024)
+        self.check_converted(converted, 1024, 0.001)
+        # small values are exact
+        self.assertEqual(converted['100'], 1300)
+
+    def test_convert_log8(self):
+        converted = self.cms.convert(8, threads=3)
+        self.assertEqual(type(converted.cms), cmsc.CMS_Log8)
+        self.check_converted(converted, 8, 0.125)
+
+        twice = self.cms.convert(1024).convert(8)
+        self.check_converted(twice, 8, 0.125)
+
+    def test_convert_unsupported(self):
+        with self.assertRaises(ValueError):
+            self.cms.convert(None)
+        with self.assertRaises(ValueError):
+            self.cms.convert(8).convert(1024)
+
+    def test_convert_to_file(self):
+        served = self.cms.convert(1024, path=filename)
+        self.assertEqual(type(served.cms), cmsc.CMS_Log1024)
+        self.check_converted(served, 1024, 0.001)
+
+        # the mapped copy can be updated and pickled like any other sketch
+        served.increment('new', 5)
+        self.assertEqual(served['new'], 5)
+        self.assertEqual(CountMinSketch.load(filename)['new'], 0)
+        reloaded = pickle.loads(pickle.dumps(served))
+        self.assertEqual(reloaded['new'], 5)
+
+    def test_load_invalid(self):
+        with open(filename, 'wb') as outfile:
+            outfile.write(b'not a sketch' * 10)
+        with self.assertRaises(ValueError):
+            CountMinSketch.load(filename)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,89 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import unittest
+from collections import Counter
+
+import bounter_cmsc as cmsc
+from bounter import CountMinSketch
+
+
+class CountMinSketchDoorkeeperTest(unittest.TestCase):
+    def test_exact_counts(self):
+        stream = ['foo'] * 5 + ['bar'] * 2 + ['baz']
+        for log_counting in [None, 1024, 8]:
+            cms = CountMinSketch(2, log_counting=log_counting, doorkeeper_mb=1)
+            cms.update(stream)
+            cms.increment('qux', 3)
+            self.assertEqual(cms['foo'], 5)
+            self.assertEqual(cms['bar'], 2)
+            self.assertEqual(cms['baz'], 1)
+            self.assertEqual(cms['qux'], 3)
+            self.assertEqual(cms['missing'], 0)
+            self.assertEqual(cms.total(), 11)
+            self.assertEqual(cms.cardinality(), 4)
+
+    def test_singletons_stay_out_of_table(self):
+        cms = CountMinSketch(width=1024, depth=4, doorkeeper_mb=1)
+        cms.update(str(i) for i in range(100000))
+        cms.increment('foo', 10)
+        self.assertEqual(cms['foo'], 10)
+        self.assertEqual(cms['1'], 1)
+
+    def test_false_positives_overestimate(self):
+        # a doorkeeper of 64 bits soon reports every key as seen, so first occurrences go to the table as well
+        cms = cmsc.CMS_Conservative(width=2 ** 16, depth=4, doorkeeper=64)
+        cms.update(str(i) for i in range(1000))
+        self.assertEqual(cms.get('missing'), 1)
+        counts = Counter(str(i % 50) for i in range(1000, 1100))
+        for key, count in counts.items():
+            cms.increment('new ' + key, count)
+        for key, count in counts.items():
+            self.assertEqual(cms.get('new ' + key), count + 1)
+
+    def test_size(self):
+        cms = CountMinSketch(4, doorkeeper_mb=1)
+        self.assertEqual(cms.size(), 4 * 2 ** 20)
+        self.assertEqual(cms.cms.doorkeeper, 2 ** 23)
+
+    def test_invalid_size(self):
+        with self.assertRaises(ValueError):
+            CountMinSketch(1, doorkeeper_mb=1)
+        with self.assertRaises(ValueError):
+            CountMinSketch(4, doorkeeper_mb=-1)
+
+    def test_merge_not_supported(self):
+        cms = CountMinSketch(2, doorkeeper_mb=1)
+        other = CountMinSketch(2, doorkeeper_mb=1)
+        with self.assertRaises(ValueError):
+            cms.merge(other)
+
+    def test_pickle(self):
+        stream = ['foo'] * 3 + ['bar', 'baz', 'baz']
+        cms = CountMinSketch(2, doorkeeper_mb=1, buffer_size=16)
+        cms.update(stream)
+        restored = pickle.loads(pickle.dumps(cms))
+        for key, count in Counter(stream).items():
+            self.assertEqual(restored[key], count)
+        restored.increment('bar')
+        self.assertEqual(restored['bar'], 2)
+        self.assertEqual(restored.size(), cms.size())
+
+    def test_convert(self):
+        cms = CountMinSketch(2, doorkeeper_mb=1)
+        cms.update(['foo'] * 3 + ['bar'])
+        converted = cms.convert(1024)
+        self.assertEqual(converted['foo'], 3)
+        self.assertEqual(converted['bar'], 1)
+        self.assertEqual(converted.cms.doorkeeper, cms.cms.doorkeeper)
+
+
+if __name__ == '__main__':
+    unittest.main()
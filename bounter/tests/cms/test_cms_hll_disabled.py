@@ -0,0 +1,75 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import os
+import pickle
+import shutil
+import tempfile
+import unittest
+
+from bounter import bounter, CountMinSketch
+from bounter.count_min_sketch import CardinalityEstimator
+
+
+class CountMinSketchHyperLogLogDisabledTest(unittest.TestCase):
+    def setUp(self):
+        self.cms = CountMinSketch(1, hll_precision=0)
+        self.cms.update(['foo', 'bar', 'foo'])
+
+    def test_counting(self):
+        self.assertEqual(self.cms['foo'], 2)
+        self.assertEqual(self.cms['bar'], 1)
+        self.assertEqual(self.cms.total(), 3)
+
+    def test_cardinality_raises(self):
+        with self.assertRaises(ValueError):
+            self.cms.cardinality()
+        with self.assertRaises(ValueError):
+            self.cms.quality()
+
+    def test_pickle(self):
+        restored = pickle.loads(pickle.dumps(self.cms))
+        self.assertEqual(restored['foo'], 2)
+        with self.assertRaises(ValueError):
+            restored.cardinality()
+
+    def test_merge(self):
+        other = CountMinSketch(1, hll_precision=0)
+        other.update(['foo'])
+        self.cms.merge(other)
+        self.assertEqual(self.cms['foo'], 3)
+        with self.assertRaises(ValueError):
+            self.cms.merge(CountMinSketch(1))
+
+    def test_convert(self):
+        self.assertEqual(self.cms.convert(1024)['foo'], 2)
+        directory = tempfile.mkdtemp()
+        try:
+            loaded = self.cms.convert(8, path=os.path.join(directory, 'sketch.cms'))
+            self.assertEqual(loaded['foo'], 2)
+            with self.assertRaises(ValueError):
+                loaded.cardinality()
+        finally:
+            shutil.rmtree(directory)
+
+    def test_clear(self):
+        self.cms.clear()
+        self.assertEqual(self.cms['foo'], 0)
+
+    def test_factory(self):
+        counter = bounter(1, need_iteration=False, hll_precision=0)
+        counter.update(['foo'])
+        with self.assertRaises(ValueError):
+            counter.cardinality()
+        with self.assertRaises(ValueError):
+            CardinalityEstimator(hll_precision=0)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,164 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import array
+import pickle
+import threading
+import unittest
+
+import bounter_cmsc as cmsc
+from bounter import CountMinSketch
+from bounter.count_min_sketch import CardinalityEstimator
+
+
+class HyperLogLogTest(unittest.TestCase):
+    def setUp(self):
+        self.keys = [str(i) for i in range(20000)]
+
+    def test_add(self):
+        hll = cmsc.HyperLogLog()
+        hll.add('foo')
+        hll.add(b'bar')
+        hll.add(u'foo', 3)
+        self.assertEqual(hll.cardinality(), 2)
+        self.assertEqual(hll.total(), 5)
+        self.assertEqual(hll.precision, 16)
+        with self.assertRaises(TypeError):
+            hll.add(1)
+        with self.assertRaises(ValueError):
+            hll.add('foo', -1)
+
+    def test_same_as_sketch(self):
+        cms = CountMinSketch(1)
+        cms.update(self.keys)
+        hll = cmsc.HyperLogLog()
+        hll.add_many(self.keys)
+        self.assertEqual(hll.cardinality(), cms.cardinality())
+
+    def test_add_many(self):
+        expected = cmsc.HyperLogLog()
+        for key in self.keys:
+            expected.add(key)
+        for keys in [self.keys, iter(self.keys), (key for key in self.keys), [(key, 2) for key in self.keys],
+                     dict((key, 2) for key in self.keys)]:
+            hll = cmsc.HyperLogLog()
+            hll.add_many(keys)
+            self.assertEqual(hll.cardinality(), expected.cardinality())
+        self.assertEqual(hll.total(), 2 * len(self.keys))
+
+    def test_add_many_errors(self):
+        hll = cmsc.HyperLogLog()
+        with self.assertRaises(TypeError):
+            hll.add_many(['foo', 1])
+        with self.assertRaises(ValueError):
+            hll.add_many([('foo', -1)])
+        with self.assertRaises(TypeError):
+            hll.add_many(1)
+        # keys preceding the invalid one are added
+        self.assertEqual(hll.cardinality(), 1)
+
+    def test_add_buffer(self):
+        numbers = array.array('q', range(100000))
+        hll = cmsc.HyperLogLog()
+        hll.add_many(numbers)
+        self.assertAlmostEqual(hll.cardinality(), 100000, delta=1000)
+        self.assertEqual(hll.total(), 100000)
+
+        # each item is a key of its raw bytes
+        expected = cmsc.HyperLogLog()
+        expected.add_many([numbers[i:i + 1].tobytes() for i in range(len(numbers))])
+        self.assertEqual(hll.cardinality(), expected.cardinality())
+
+    def test_merge(self):
+        hll = cmsc.HyperLogLog(12)
+        hll.add_many(self.keys[:15000])
+        other = cmsc.HyperLogLog(12)
+        other.add_many(self.keys[5000:])
+        expected = cmsc.HyperLogLog(12)
+        expected.add_many(self.keys)
+        hll.merge(other)
+        self.assertEqual(hll.cardinality(), expected.cardinality())
+        with self.assertRaises(ValueError):
+            hll.merge(cmsc.HyperLogLog(14))
+        with self.assertRaises(TypeError):
+            hll.merge(CountMinSketch(1).cms)
+
+    def test_pickle(self):
+        for count in [0, 100, 20000]:
+            hll = cmsc.HyperLogLog(14)
+            hll.add_many(self.keys[:count])
+            restored = pickle.loads(pickle.dumps(hll))
+            self.assertEqual(restored.precision, 14)
+            self.assertEqual(restored.cardinality(), hll.cardinality())
+            self.assertEqual(restored.total(), count)
+        self.assertLess(len(pickle.dumps(hll)), 4 * 2 ** 14 * 6 // 8 // 3)
+
+    def test_invalid_precision(self):
+        for precision in [0, 3, 19]:
+            with self.assertRaises(ValueError):
+                cmsc.HyperLogLog(precision)
+
+    def test_clear(self):
+        hll = cmsc.HyperLogLog()
+        hll.add_many(self.keys)
+        hll.clear()
+        self.assertEqual(hll.cardinality(), 0)
+        self.assertEqual(hll.total(), 0)
+
+    def test_threads(self):
+        hll = cmsc.HyperLogLog()
+        other = cmsc.HyperLogLog()
+        other.add_many(self.keys)
+        chunks = [[u'%s %d' % (key, i) for key in self.keys[:5000]] for i in range(4)]
+        threads = [threading.Thread(target=hll.add_many, args=(chunk,)) for chunk in chunks]
+        threads += [threading.Thread(target=hll.add_many, args=(array.array('q', range(i, 40000, 4)),)) for i in range(4)]
+        threads.append(threading.Thread(target=hll.merge, args=(other,)))
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        expected = cmsc.HyperLogLog()
+        for chunk in chunks:
+            expected.add_many(chunk)
+        expected.add_many(array.array('q', range(40000)))
+        expected.merge(other)
+        self.assertEqual(hll.cardinality(), expected.cardinality())
+        self.assertEqual(hll.total(), expected.total())
+
+
+class CardinalityEstimatorTest(unittest.TestCase):
+    def test_legacy_pickle(self):
+        # older versions pickled the estimator as a sketch of width 1
+        cms = cmsc.CMS_Conservative(width=1, depth=1)
+        cms.update(str(i) for i in range(1000))
+        estimator = CardinalityEstimator.__new__(CardinalityEstimator)
+        estimator.__setstate__((1, 1, 4, cms))
+        self.assertEqual(estimator.cardinality(), cms.cardinality())
+        self.assertEqual(estimator.total(), 1000)
+        estimator.update(['foo'])
+        self.assertEqual(estimator.total(), 1001)
+
+    def test_pickle(self):
+        estimator = CardinalityEstimator(hll_precision=10)
+        estimator.update(str(i) for i in range(1000))
+        restored = pickle.loads(pickle.dumps(estimator))
+        self.assertEqual(restored.cardinality(), estimator.cardinality())
+        self.assertEqual(restored.hll.precision, 10)
+
+    def test_no_table(self):
+        estimator = CardinalityEstimator()
+        with self.assertRaises(NotImplementedError):
+            'foo' in estimator
+        with self.assertRaises(NotImplementedError):
+            estimator.convert(8)
+
+
+if __name__ == '__main__':
+    unittest.main()
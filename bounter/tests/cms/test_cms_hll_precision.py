@@ -0,0 +1,106 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import os
+import pickle
+import shutil
+import tempfile
+import unittest
+
+from bounter import bounter, CountMinSketch, HashTable
+from bounter.count_min_sketch import CardinalityEstimator
+
+
+class HyperLogLogPrecisionTest(unittest.TestCase):
+    def test_accuracy(self):
+        keys = [str(i) for i in range(200000)]
+        for precision in [4, 8, 12, 16, 18]:
+            estimator = CardinalityEstimator(hll_precision=precision)
+            estimator.update(keys)
+            error = 1.04 / 2 ** (precision / 2.0)
+            self.assertAlmostEqual(estimator.cardinality() / 200000.0, 1, delta=4 * error)
+
+    def test_small_cardinality(self):
+        for precision in [6, 12, 16]:
+            estimator = CardinalityEstimator(hll_precision=precision)
+            estimator.update(['foo', 'bar', 'foo'])
+            self.assertEqual(estimator.cardinality(), 2)
+
+    def test_invalid_precision(self):
+        for precision in [-1, 3, 19, 64]:
+            with self.assertRaises(ValueError):
+                CountMinSketch(1, hll_precision=precision)
+            with self.assertRaises(ValueError):
+                HashTable(buckets=64, hll_precision=precision)
+
+    def test_factory(self):
+        for counter in [bounter(1, hll_precision=10), bounter(1, need_iteration=False, hll_precision=10),
+                        bounter(need_counts=False, hll_precision=10)]:
+            counter.update(str(i) for i in range(10000))
+            self.assertAlmostEqual(counter.cardinality() / 10000.0, 1, delta=0.15)
+
+    def test_packed_registers(self):
+        for precision in [8, 16]:
+            estimator = CardinalityEstimator(hll_precision=precision)
+            estimator.update(str(i) for i in range(2 ** precision * 10))
+            state = estimator.hll.__reduce__()[2]
+            self.assertEqual(len(state[0]), 4 + 2 ** precision * 6 // 8)
+
+    def test_pickle(self):
+        keys = [str(i) for i in range(5000)]
+        for precision in [6, 12]:
+            for structure in [CountMinSketch(1, hll_precision=precision), HashTable(buckets=1024, hll_precision=precision)]:
+                structure.update(keys)
+                restored = pickle.loads(pickle.dumps(structure))
+                self.assertEqual(restored.cardinality(), structure.cardinality())
+                restored.update(str(i) for i in range(5000, 6000))
+                structure.update(str(i) for i in range(5000, 6000))
+                self.assertEqual(restored.cardinality(), structure.cardinality())
+
+    def test_mismatched_state(self):
+        cms = CountMinSketch(1, hll_precision=12)
+        cms.update(str(i) for i in range(10000))
+        cls, args, state = cms.cms.__reduce__()
+        other = CountMinSketch(1, hll_precision=14)
+        with self.assertRaises(ValueError):
+            other.cms.__setstate__(state)
+        # an unknown version of the format is rejected
+        state[-2] = state[-2][:1] + bytearray([2]) + state[-2][2:]
+        with self.assertRaises(ValueError):
+            cms.cms.__setstate__(state)
+
+    def test_merge(self):
+        cms = CountMinSketch(1, hll_precision=12)
+        cms.update(str(i) for i in range(10000))
+        other = CountMinSketch(1, hll_precision=12)
+        other.update(str(i) for i in range(5000, 20000))
+        expected = CountMinSketch(1, hll_precision=12)
+        expected.update(str(i) for i in range(20000))
+        cms.merge(other)
+        self.assertEqual(cms.cardinality(), expected.cardinality())
+
+        with self.assertRaises(ValueError):
+            cms.merge(CountMinSketch(1, hll_precision=14))
+
+    def test_convert(self):
+        cms = CountMinSketch(1, hll_precision=10)
+        cms.update(str(i) for i in range(10000))
+        self.assertEqual(cms.convert(1024).cardinality(), cms.cardinality())
+
+        directory = tempfile.mkdtemp()
+        try:
+            path = os.path.join(directory, 'sketch.cms')
+            self.assertEqual(cms.convert(8, path=path).cardinality(), cms.cardinality())
+            self.assertEqual(CountMinSketch.load(path).cms.__reduce__()[1][-1], 10)
+        finally:
+            shutil.rmtree(directory)
+
+
+if __name__ == '__main__':
+    unittest.main()
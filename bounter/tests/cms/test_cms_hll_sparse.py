@@ -0,0 +1,83 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import threading
+import unittest
+
+from bounter import CountMinSketch, HashTable
+from bounter.count_min_sketch import CardinalityEstimator
+
+
+def estimator(keys):
+    result = CardinalityEstimator()
+    result.update(keys)
+    return result
+
+
+class SparseHyperLogLogTest(unittest.TestCase):
+    def test_small_pickle(self):
+        self.assertLess(len(pickle.dumps(estimator(str(i) for i in range(100)))), 1000)
+        self.assertLess(len(pickle.dumps(estimator(str(i) for i in range(3000)))), 10000)
+        self.assertGreater(len(pickle.dumps(estimator(str(i) for i in range(20000)))), 49152)
+
+    def test_pickle(self):
+        for cardinality in [0, 1, 100, 1000, 5000, 20000]:
+            original = estimator(str(i) for i in range(cardinality))
+            restored = pickle.loads(pickle.dumps(original))
+            self.assertEqual(restored.cardinality(), original.cardinality())
+            restored.update(str(i) for i in range(cardinality + 10))
+            self.assertEqual(restored.cardinality(), estimator(str(i) for i in range(cardinality + 10)).cardinality())
+
+    def test_merge(self):
+        for first, second in [(100, 1000), (1000, 50000), (50000, 100), (50000, 70000)]:
+            expected = estimator(str(i) for i in range(first + second)).cardinality()
+            merged = estimator(str(i) for i in range(first))
+            merged.merge(estimator(str(i) for i in range(first, first + second)))
+            self.assertEqual(merged.cardinality(), expected)
+
+    def test_invalid_state(self):
+        cms = CountMinSketch(1)
+        cms.update(['foo', 'bar'])
+        cls, args, state = cms.cms.__reduce__()
+        for invalid in [bytearray(b'S'), state[-2][:-1], bytearray(b'X') + state[-2][1:], bytearray(100)]:
+            state[-2] = invalid
+            with self.assertRaises(ValueError):
+                cms.cms.__setstate__(state)
+
+    def test_hashtable(self):
+        ht = HashTable(buckets=1024)
+        ht.update(str(i) for i in range(100))
+        self.assertLess(len(pickle.dumps(ht)), 40000)
+        restored = pickle.loads(pickle.dumps(ht))
+        self.assertEqual(restored.cardinality(), ht.cardinality())
+
+    def test_clear(self):
+        sketch = estimator(str(i) for i in range(50000))
+        sketch.clear()
+        sketch.update(['foo', 'bar'])
+        self.assertEqual(sketch.cardinality(), 2)
+        self.assertLess(len(pickle.dumps(sketch)), 1000)
+
+    def test_threads(self):
+        # the sparse list grows and is densified while other threads count into the sketch
+        cms = CountMinSketch(1)
+        threads = [threading.Thread(target=lambda offset: [cms.increment('key %d %d' % (offset, i)) for i in range(20000)],
+                                    args=(offset,)) for offset in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        expected = CountMinSketch(1)
+        expected.update('key %d %d' % (offset, i) for offset in range(4) for i in range(20000))
+        self.assertEqual(cms.cardinality(), expected.cardinality())
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,116 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import threading
+import unittest
+
+import bounter_cmsc as cmsc
+from bounter import CardinalityEstimator, union_cardinality
+
+
+def estimator(start, stop, precision=16):
+    result = cmsc.HyperLogLog(precision)
+    result.add_many(str(i) for i in range(start, stop))
+    return result
+
+
+class HyperLogLogUnionTest(unittest.TestCase):
+    def setUp(self):
+        # a mix of sparse and dense estimators, overlapping each other
+        self.parts = [estimator(i * 3000, i * 3000 + size) for i, size in enumerate([10, 5000, 200, 30000, 1, 0])]
+
+    def test_merge_many(self):
+        merged = estimator(0, 0)
+        merged.merge_many(self.parts)
+        self.assertEqual(pickle.dumps(merged), pickle.dumps(self.expected_merge()))
+        self.assertEqual(merged.total(), sum(part.total() for part in self.parts))
+
+    def expected_merge(self, parts=None):
+        merged = estimator(0, 0)
+        for part in self.parts if parts is None else parts:
+            merged.merge(part)
+        return merged
+
+    def test_merge_many_into_dense(self):
+        merged = estimator(100000, 110000)
+        expected = estimator(100000, 110000)
+        for part in self.parts:
+            expected.merge(part)
+        merged.merge_many(self.parts)
+        self.assertEqual(merged.cardinality(), expected.cardinality())
+
+    def test_merge_sparse(self):
+        parts = [estimator(i * 100, i * 100 + 100) for i in range(10)]
+        merged = estimator(0, 0)
+        merged.merge_many(parts)
+        self.assertEqual(merged.cardinality(), estimator(0, 1000).cardinality())
+        self.assertLess(len(pickle.dumps(merged)), 10000)
+
+    def test_union_cardinality(self):
+        self.assertEqual(cmsc.union_cardinality(self.parts), self.expected_merge().cardinality())
+        for i in range(len(self.parts)):
+            self.assertEqual(cmsc.union_cardinality(self.parts[:i + 1]), self.expected_merge(self.parts[:i + 1]).cardinality())
+        self.assertEqual(cmsc.union_cardinality([]), 0)
+        self.assertEqual(cmsc.union_cardinality([self.parts[1]]), self.parts[1].cardinality())
+
+    def test_union_unaffected(self):
+        before = [pickle.dumps(part) for part in self.parts]
+        cmsc.union_cardinality(self.parts)
+        estimator(0, 0).merge_many(self.parts)
+        self.assertEqual([pickle.dumps(part) for part in self.parts], before)
+
+    def test_many_inputs(self):
+        parts = [estimator(i * 500, i * 500 + 1000, 12) for i in range(200)]
+        self.assertAlmostEqual(cmsc.union_cardinality(parts), 100500, delta=100500 * 0.05)
+        merged = estimator(0, 0, 12)
+        merged.merge_many(parts)
+        self.assertEqual(merged.cardinality(), cmsc.union_cardinality(parts))
+
+    def test_invalid(self):
+        with self.assertRaises(ValueError):
+            cmsc.union_cardinality([estimator(0, 10, 12), estimator(0, 10, 14)])
+        with self.assertRaises(ValueError):
+            estimator(0, 10, 12).merge_many([estimator(0, 10, 14)])
+        with self.assertRaises(TypeError):
+            cmsc.union_cardinality([estimator(0, 10), 'foo'])
+        with self.assertRaises(TypeError):
+            cmsc.union_cardinality(1)
+
+    def test_estimators(self):
+        estimators = []
+        for i in range(3):
+            part = CardinalityEstimator()
+            part.update(str(j) for j in range(i * 1000, i * 1000 + 2000))
+            estimators.append(part)
+        merged = CardinalityEstimator()
+        merged.merge(*estimators)
+        self.assertEqual(union_cardinality(estimators), merged.cardinality())
+        self.assertAlmostEqual(merged.cardinality(), 4000, delta=40)
+        self.assertEqual(merged.total(), 6000)
+
+    def test_threads(self):
+        # a sparse input grows and is densified while other threads read it
+        growing = estimator(0, 0)
+        merged = estimator(0, 0)
+        threads = [threading.Thread(target=growing.add_many, args=([str(i) for i in range(j, 40000, 2)],))
+                   for j in range(2)]
+        threads += [threading.Thread(target=merged.merge_many, args=(self.parts + [growing],)) for _ in range(4)]
+        threads += [threading.Thread(target=cmsc.union_cardinality, args=(self.parts + [growing],)) for _ in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        merged.merge(growing)
+        # merge_many adds the totals of its inputs, so only the registers are compared
+        self.assertEqual(merged.cardinality(), self.expected_merge(self.parts + [estimator(0, 40000)]).cardinality())
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,96 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import unittest
+
+from bounter import CountMinSketchRing
+
+
+class CountMinSketchRingTest(unittest.TestCase):
+    def test_init(self):
+        ring = CountMinSketchRing(slots=4, size_mb=8)
+        self.assertEqual(ring.slots(), 4)
+        self.assertLessEqual(ring.size(), 8 * 2 ** 20)
+        self.assertGreater(ring.size(), 4 * 2 ** 20)
+
+        ring = CountMinSketchRing(slots=3, width=2 ** 10, depth=4, log_counting=8)
+        self.assertEqual(ring.size(), 3 * 4 * 2 ** 10)
+
+    def test_invalid_init(self):
+        with self.assertRaises(ValueError):
+            CountMinSketchRing(slots=0)
+        with self.assertRaises(ValueError):
+            CountMinSketchRing(slots=2, log_counting=5)
+
+    def test_window(self):
+        for log_counting in [None, 1024, 8]:
+            ring = CountMinSketchRing(slots=3, size_mb=8, log_counting=log_counting)
+            ring.increment('foo')
+            ring.rotate()
+            ring.increment('foo', 2)
+            ring.increment('bar')
+            ring.rotate()
+            ring.increment('foo', 3)
+
+            self.assertEqual(ring.get('foo', last=1), 3)
+            self.assertEqual(ring.get('foo', last=2), 5)
+            self.assertEqual(ring['foo'], 6)
+            self.assertEqual(ring.get('bar', last=1), 0)
+            self.assertEqual(ring.get('bar'), 1)
+            self.assertEqual(ring.total(last=1), 3)
+            self.assertEqual(ring.total(), 7)
+            self.assertEqual(ring.cardinality(last=1), 1)
+            self.assertEqual(ring.cardinality(), 2)
+
+            # the oldest slot is discarded
+            ring.rotate()
+            self.assertEqual(ring['foo'], 5)
+            self.assertEqual(ring.get('foo', last=1), 0)
+            self.assertEqual(ring.total(), 6)
+
+    def test_rotate_large_slot(self):
+        ring = CountMinSketchRing(slots=2, size_mb=16)
+        for i in range(1000):
+            ring.increment(str(i), i + 1)
+        ring.rotate()
+        ring.rotate()
+        self.assertEqual(ring.total(), 0)
+        self.assertEqual(ring.cardinality(), 0)
+        for i in range(1000):
+            self.assertEqual(ring[str(i)], 0)
+
+    def test_invalid_last(self):
+        ring = CountMinSketchRing(slots=3, size_mb=1)
+        for last in [0, 4, -1]:
+            with self.assertRaises(ValueError):
+                ring.get('foo', last=last)
+            with self.assertRaises(ValueError):
+                ring.total(last)
+
+    def test_pickle(self):
+        ring = CountMinSketchRing(slots=3, size_mb=1, log_counting=1024)
+        ring.increment('foo', 5)
+        ring.rotate()
+        ring.increment('foo', 7)
+        ring.increment('bar')
+
+        reloaded = pickle.loads(pickle.dumps(ring))
+        self.assertEqual(reloaded.get('foo', last=1), 7)
+        self.assertEqual(reloaded['foo'], 12)
+        self.assertEqual(reloaded.total(), 13)
+        self.assertEqual(reloaded.cardinality(), 2)
+
+        reloaded.rotate()
+        reloaded.rotate()
+        self.assertEqual(reloaded['foo'], 7)
+
+
+if __name__ == '__main__':
+    unittest.main()
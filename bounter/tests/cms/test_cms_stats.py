@@ -0,0 +1,67 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import math
+import unittest
+
+from bounter import CountMinSketch
+
+
+class CountMinSketchStatsTest(unittest.TestCase):
+    def test_empty(self):
+        cms = CountMinSketch(width=1024, depth=4)
+        stats = cms.stats()
+        self.assertEqual(stats['row_fill'], [0.0] * 4)
+        self.assertEqual(stats['histogram'], [4096])
+        self.assertEqual(stats['saturated'], 0)
+        self.assertEqual(stats['collision_probability'], 0)
+        self.assertEqual(stats['error_bound'], 0)
+        self.assertEqual(stats['sampled'], 1024)
+
+    def test_histogram(self):
+        cms = CountMinSketch(width=1024, depth=1)
+        cms.increment('foo')
+        cms.increment('bar', 5)
+        cms.increment('baz', 1000)
+        stats = cms.stats()
+        self.assertEqual(stats['row_fill'], [3 / 1024.0])
+        self.assertEqual(stats['histogram'], [1021, 1, 0, 1] + [0] * 6 + [1])
+        self.assertAlmostEqual(stats['error_bound'], math.e * 1006 / 1024)
+        self.assertAlmostEqual(stats['error_probability'], math.exp(-1))
+
+    def test_decoded_histogram(self):
+        cms = CountMinSketch(width=1024, depth=2, log_counting=1024)
+        cms.increment('foo', 1000)
+        self.assertEqual(sum(cms.stats()['histogram'][10:]), 2)
+
+    def test_saturated(self):
+        cms = CountMinSketch(width=1024, depth=2, log_counting=8)
+        cls, args, state = cms.cms.__reduce__()
+        state[0][7] = 255
+        state[1][3] = 255
+        state[1][5] = 1
+        cms.cms.__setstate__(state)
+        stats = cms.stats()
+        self.assertEqual(stats['saturated'], 2 / 2048.0)
+        self.assertEqual(stats['row_fill'], [1 / 1024.0, 2 / 1024.0])
+
+    def test_sample(self):
+        cms = CountMinSketch(width=2 ** 16, depth=4)
+        cms.update(str(i) for i in range(2 ** 15))
+        full = cms.stats()
+        sampled = cms.stats(sample=1000)
+        self.assertEqual(sampled['sampled'], 1024)
+        self.assertEqual(sum(sampled['histogram']), 4 * 1024)
+        for row_fill, expected in zip(sampled['row_fill'], full['row_fill']):
+            self.assertAlmostEqual(row_fill, expected, delta=0.1)
+        self.assertEqual(cms.stats(sample=10 ** 9)['sampled'], 2 ** 16)
+
+
+if __name__ == '__main__':
+    unittest.main()
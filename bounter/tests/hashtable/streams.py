@@ -0,0 +1,36 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+"""
+Reproducible streams of keys shared by the hash table tests.
+"""
+
+import random
+
+
+def uniform_stream(distinct, length, seed=0, heavy=0):
+    """
+    Returns `length` keys drawn uniformly from `distinct` short (inline) and `distinct` longer keys. With `heavy`,
+    a fifth of the keys are drawn from that many frequent keys instead.
+    """
+    rnd = random.Random(seed)
+    words = [u'w%d' % i for i in range(distinct)] + [u'a longer key number %d' % i for i in range(distinct)]
+    heavy_words = [u'heavy %d' % i for i in range(heavy)]
+    return [rnd.choice(heavy_words) if heavy and rnd.random() < 0.2 else rnd.choice(words) for _ in range(length)]
+
+
+def skewed_stream(length, seed=0, alpha=0.8, skew=0.5, distinct=5000, short=u'k%d', noise=u'a longer key number %d'):
+    """
+    Returns `length` keys, a `skew` share of them short keys of Pareto distributed numbers with the given `alpha` (drawn
+    uniformly from `distinct` numbers when `alpha` is None), the others noise keys drawn uniformly from `distinct`
+    numbers, or numbered by their position when `distinct` is None.
+    """
+    rnd = random.Random(seed)
+    return [(short % (rnd.randrange(distinct) if alpha is None else int(rnd.paretovariate(alpha))))
+            if rnd.random() < skew else (noise % (i if distinct is None else rnd.randrange(distinct)))
+            for i in range(length)]
@@ -0,0 +1,112 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import struct
+import unittest
+
+from bounter import HashTable, SwissHashTable, SpaceSavingHashTable, ConcurrentHashTable
+
+
+class HashTableBinaryKeysTest(unittest.TestCase):
+    """
+    Keys are stored with their length, so they may contain any bytes, null bytes included.
+    """
+
+    keys = [b'\x00', b'\x00\x00', b'a\x00', b'a', b'a\x00b', b'ab', b'', b'12345678', b'1234567\x00',
+            b'\x00' * 20, b'a longer key\x00with a null byte', b'a longer key', struct.pack('<4Q', 1, 2, 3, 4)]
+
+    def fill(self, ht):
+        for i, key in enumerate(self.keys):
+            ht.increment(key, i + 1)
+
+    def expected(self):
+        return dict((key, i + 1) for i, key in enumerate(self.keys))
+
+    def test_distinct_keys(self):
+        for table_type in [HashTable, SwissHashTable]:
+            ht = table_type(buckets=64, use_unicode=False)
+            self.fill(ht)
+            self.assertEqual(len(ht), len(self.keys))
+            for key, count in self.expected().items():
+                self.assertEqual(ht[key], count)
+            self.assertEqual(ht[b'\x00\x00\x00'], 0)
+            self.assertEqual(dict(ht.items()), self.expected())
+
+    def test_unicode_with_null(self):
+        ht = HashTable(buckets=64)
+        ht.update([u'a\x00b', u'a\x00b', u'a'])
+        self.assertEqual(ht[u'a\x00b'], 2)
+        self.assertEqual(ht[u'a'], 1)
+        self.assertEqual(dict(ht.items()), {u'a\x00b': 2, u'a': 1})
+
+    def test_invalid_utf8(self):
+        for table_type in [HashTable, SwissHashTable, SpaceSavingHashTable, ConcurrentHashTable]:
+            for key in [b'\x00\xff', b'a longer key which is not \xff UTF-8']:
+                ht = table_type(buckets=64)
+                ht.increment(key)
+                for iterable in [ht, ht.keys(), ht.items()]:
+                    with self.assertRaises(UnicodeDecodeError):
+                        list(iterable)
+                self.assertEqual(list(ht.values()), [1])
+                # the undecodable key is skipped by the iteration which raised
+                ht.increment(u'foo')
+                iterator = ht.items()
+                keys = []
+                for _ in range(2):
+                    try:
+                        keys.append(next(iterator))
+                    except UnicodeDecodeError:
+                        pass
+                self.assertEqual(keys, [(u'foo', 1)])
+
+    def test_pickle(self):
+        ht = HashTable(buckets=64, use_unicode=False)
+        self.fill(ht)
+        restored = pickle.loads(pickle.dumps(ht))
+        self.assertEqual(dict(restored.items()), self.expected())
+        for key, count in self.expected().items():
+            self.assertEqual(restored[key], count)
+
+    def test_prune(self):
+        ht = HashTable(buckets=64, use_unicode=False)
+        self.fill(ht)
+        ht.prune(5)
+        expected = dict((key, count) for key, count in self.expected().items() if count > 5)
+        self.assertEqual(dict(ht.items()), expected)
+        ht.update(struct.pack('<I', i) for i in range(1000))
+        self.assertEqual(ht[b'\x00' * 20], 10)
+
+    def test_null_terminated_state(self):
+        """States pickled before keys were length-prefixed hold null-terminated keys."""
+        ht = HashTable(buckets=64)
+        ht.update([u'foo', u'foo', u'a longer key', u''])
+        cls, args, state = ht.__reduce__()
+        strings, offset, terminated = state[5], 0, bytearray()
+        while offset < len(strings):
+            length = struct.unpack('=I', bytes(strings[offset:offset + 4]))[0]
+            terminated += strings[offset + 4:offset + 4 + length] + b'\x00'
+            offset += 4 + length
+        restored = cls(*args)
+        restored.__setstate__(state[:5] + (terminated,) + state[6:8])
+        self.assertEqual(dict(restored.items()), {u'foo': 2, u'a longer key': 1, u'': 1})
+
+    def test_invalid_state(self):
+        ht = HashTable(buckets=64)
+        ht.update([u'foo', u'a longer key'])
+        cls, args, state = ht.__reduce__()
+        restored = cls(*args)
+        with self.assertRaises(ValueError):
+            restored.__setstate__(state[:5] + (state[5][:-3],) + state[6:])
+        self.assertEqual(len(restored), 0)
+        self.assertEqual(list(restored.items()), [])
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,93 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import unittest
+from collections import Counter
+
+from bounter import HashTable
+
+
+class HashTableBufferTest(unittest.TestCase):
+    def setUp(self):
+        self.stream = [str(i % (1 + (i * 7919) % 97)) for i in range(5000)] + ['long key ' * 10] * 5
+        self.expected = Counter(self.stream)
+
+    def test_same_as_unbuffered(self):
+        ht = HashTable(buckets=1024, buffer_size=16)
+        ht.update(self.stream)
+        self.assertEqual(set(ht.items()), set(self.expected.items()))
+        self.assertEqual(len(ht), len(self.expected))
+        self.assertEqual(ht.total(), len(self.stream))
+        self.assertEqual(ht.cardinality(), len(self.expected))
+
+    def test_queries_flush(self):
+        ht = HashTable(buckets=64, buffer_size=64)
+        ht.increment('foo')
+        ht.increment('foo', 2)
+        self.assertEqual(ht['foo'], 3)
+        ht.increment('foo')
+        self.assertEqual(len(ht), 1)
+        self.assertEqual(ht.total(), 4)
+        ht.increment('foo')
+        self.assertEqual(list(ht.items()), [('foo', 5)])
+        ht.increment('foo')
+        ht['foo'] += 1
+        self.assertEqual(ht['foo'], 7)
+
+    def test_single_key_queries(self):
+        # lookups, assignments and len() leave the increments of other keys in the buffer
+        ht = HashTable(buckets=1024, buffer_size=64)
+        counts = Counter()
+        for i, key in enumerate(self.stream):
+            ht.increment(key)
+            counts[key] += 1
+            if i % 7 == 0:
+                self.assertEqual(ht[self.stream[i // 2]], counts[self.stream[i // 2]])
+            if i % 101 == 0:
+                ht[key] = 3
+                counts[key] = 3
+                self.assertEqual(len(ht), len(counts))
+            if i % 203 == 0:
+                del ht[key]
+                del counts[key]
+        self.assertEqual(len(ht), len(counts))
+        self.assertEqual(ht.total(), sum(counts.values()))
+        self.assertEqual(set(ht.items()), set(counts.items()))
+
+    def test_len_prunes(self):
+        # counting the buffered keys which would fill the table applies them, pruning it
+        ht = HashTable(buckets=64, buffer_size=64)
+        ht.update(str(i) for i in range(30))
+        ht.update(str(i) for i in range(20))
+        self.assertEqual(len(ht), 30)
+        ht.update(str(i) for i in range(30, 50))
+        size = len(ht)
+        self.assertLess(size, 48)
+        self.assertEqual(size, len(list(ht.items())))
+
+    def test_overflow(self):
+        ht = HashTable(buckets=64, buffer_size=64)
+        ht.increment('foo', 2 ** 63 - 2)
+        ht.increment('foo', 1)
+        with self.assertRaises(OverflowError):
+            ht.increment('foo', 1)
+            ht['foo']
+
+    def test_pickle(self):
+        ht = HashTable(buckets=64, buffer_size=64, use_unicode=False)
+        ht.update([b'a', b'b', b'a'])
+        reloaded = pickle.loads(pickle.dumps(ht))
+        self.assertEqual(set(reloaded.items()), {(b'a', 2), (b'b', 1)})
+        reloaded.increment(b'a')
+        self.assertEqual(reloaded[b'a'], 3)
+
+
+if __name__ == '__main__':
+    unittest.main()
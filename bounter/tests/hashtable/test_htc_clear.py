@@ -0,0 +1,49 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import unittest
+
+from bounter import HashTable
+
+
+class HashTableClearTest(unittest.TestCase):
+    def check_cleared(self, ht):
+        self.assertEqual(len(ht), 0)
+        self.assertEqual(ht.total(), 0)
+        self.assertEqual(ht.cardinality(), 0)
+        self.assertEqual(list(ht.items()), [])
+        self.assertEqual(ht['1'], 0)
+        ht.update(['foo', 'foo', 'bar'])
+        self.assertEqual(set(ht.items()), {('foo', 2), ('bar', 1)})
+        self.assertEqual(ht.total(), 3)
+        self.assertEqual(ht.cardinality(), 2)
+
+    def test_clear(self):
+        ht = HashTable(buckets=64)
+        ht.update(str(i) for i in range(100))
+        ht.clear()
+        self.check_cleared(ht)
+
+    def test_clear_large(self):
+        ht = HashTable(size_mb=64, buffer_size=16)
+        ht.update(str(i % 10) for i in range(1000))
+        ht.clear()
+        self.check_cleared(ht)
+
+    def test_clear_after_prune(self):
+        ht = HashTable(buckets=64)
+        ht.update(str(i) for i in range(100))
+        ht.prune(5)
+        ht.clear()
+        self.check_cleared(ht)
+        self.assertEqual(ht.quality(), 2 / 48.0)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,121 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import threading
+import unittest
+from collections import Counter
+
+from bounter import HashTable, ConcurrentHashTable
+from bounter.tests.hashtable.streams import skewed_stream
+
+
+class ConcurrentHashTableTest(unittest.TestCase):
+    """
+    A concurrent table is counted into by several threads at once, which prune it together when it fills up.
+    """
+
+    def run_threads(self, target, chunks):
+        threads = [threading.Thread(target=target, args=(chunk,)) for chunk in chunks]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+    def test_same_as_single_thread(self):
+        stream = skewed_stream(80000)
+        ht = ConcurrentHashTable(buckets=2 ** 15)
+        self.run_threads(ht.update, [stream[i::8] for i in range(8)])
+        counts = Counter(stream)
+        self.assertEqual(dict(ht.items()), counts)
+        self.assertEqual(len(ht), len(counts))
+        self.assertEqual(ht.total(), len(stream))
+        self.assertEqual(ht.cardinality(), len(counts))
+
+    def test_mixed_operations(self):
+        ht = ConcurrentHashTable(buckets=2 ** 12)
+
+        def work(offset):
+            for i in range(300):
+                ht.increment(u'shared %d' % (i % 50))
+                ht.increment(u'own %d %d' % (offset, i), 2)
+            ht.update({u'pair %d' % i: offset + 1 for i in range(20)})
+            ht[u'set %d' % offset] = 7
+
+        self.run_threads(work, range(6))
+        self.assertEqual(ht[u'shared 0'], 36)
+        self.assertEqual(ht[u'own 5 299'], 2)
+        self.assertEqual(ht[u'pair 3'], 21)
+        self.assertEqual(ht[u'set 4'], 7)
+        self.assertEqual(len(ht), 50 + 6 * 300 + 20 + 6)
+        self.assertEqual(ht.total(), 6 * (300 + 600 + 7) + 20 * 21)
+
+    def test_prune_while_counting(self):
+        stream = skewed_stream(200000, seed=1)
+        ht = ConcurrentHashTable(buckets=2 ** 12, prune_threads=2)
+        self.run_threads(ht.update, [stream[i::4] for i in range(4)])
+        self.assertLessEqual(len(ht), 3072)
+        self.assertEqual(ht.total(), len(stream))
+        counts = Counter(stream)
+        for key, count in ht.items():
+            self.assertEqual(ht[key], count)
+            self.assertLessEqual(count, counts[key])
+        # the heaviest keys are never pruned
+        for key, count in counts.most_common(5):
+            self.assertGreater(ht[key], count * 0.9)
+        self.assertAlmostEqual(ht.cardinality(), len(counts), delta=len(counts) * 0.05)
+
+    def test_same_as_hashtable(self):
+        stream = skewed_stream(50000, seed=2)
+        concurrent = ConcurrentHashTable(buckets=2 ** 12)
+        basic = HashTable(buckets=2 ** 12)
+        for ht in [concurrent, basic]:
+            ht.update(stream)
+            ht.update({u'extra': 3})
+            ht.prune(2)
+        # a single thread counts and prunes exactly like a HashTable
+        self.assertEqual(list(concurrent.items()), list(basic.items()))
+        self.assertEqual(concurrent.cardinality(), basic.cardinality())
+
+    def test_pickle(self):
+        ht = ConcurrentHashTable(buckets=2 ** 12)
+        ht.update(skewed_stream(30000, seed=3))
+        restored = pickle.loads(pickle.dumps(ht))
+        self.assertEqual(list(restored.items()), list(ht.items()))
+        self.assertEqual(restored.total(), ht.total())
+        restored.clear()
+        self.assertEqual(len(restored), 0)
+        self.run_threads(restored.update, [[u'foo', u'bar'], [u'foo']])
+        self.assertEqual(sorted(restored.items()), [(u'bar', 1), (u'foo', 2)])
+
+    def test_errors(self):
+        ht = ConcurrentHashTable(buckets=64)
+        with self.assertRaises(TypeError):
+            ht.update([u'foo', 1])
+        self.assertEqual(ht[u'foo'], 1)
+        with self.assertRaises(ValueError):
+            ht.update([(u'foo', -1)])
+        ht[u'big'] = 2 ** 63 - 1
+        with self.assertRaises(OverflowError):
+            ht.update([u'big'])
+        with self.assertRaises(OverflowError):
+            ht.increment(u'big')
+        self.assertEqual(ht[u'big'], 2 ** 63 - 1)
+        self.assertEqual(len(ht), 2)
+
+    def test_unsupported_options(self):
+        for option in ['incremental_prune', 'growable']:
+            with self.assertRaises(ValueError):
+                ConcurrentHashTable(buckets=64, **{option: True})
+        with self.assertRaises(ValueError):
+            ConcurrentHashTable(buckets=64, buffer_size=16)
+
+
+if __name__ == '__main__':
+    unittest.main()
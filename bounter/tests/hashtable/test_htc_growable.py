@@ -0,0 +1,109 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import unittest
+from collections import Counter
+
+from bounter import HashTable, SwissHashTable, SpaceSavingHashTable
+from bounter.tests.hashtable.streams import skewed_stream
+
+
+class HashTableGrowableTest(unittest.TestCase):
+    """
+    A growable table starts small and doubles up to its size, moving the keys of the previous table a few at a time.
+    """
+
+    def test_starts_small(self):
+        for cls in [HashTable, SwissHashTable]:
+            ht = cls(size_mb=64, growable=True)
+            self.assertEqual(ht.buckets(), 1024)
+            self.assertLess(ht._mem(), cls(size_mb=64)._mem() / 1000)
+            self.assertEqual(cls(buckets=256, growable=True).buckets(), 256)
+
+    def test_exact_while_growing(self):
+        for cls in [HashTable, SwissHashTable]:
+            ht = cls(buckets=2 ** 16, growable=True)
+            counts = Counter()
+            for i, key in enumerate(skewed_stream(60000, alpha=None, distinct=20000)):
+                ht.increment(key)
+                counts[key] += 1
+                if i % 4999 == 0:
+                    # lookups find keys in both tables while they are being moved
+                    for other in list(counts)[::7]:
+                        self.assertEqual(ht[other], counts[other])
+            self.assertEqual(ht.buckets(), 2 ** 16)
+            self.assertEqual(dict(ht.items()), counts)
+            self.assertEqual(ht.cardinality(), len(counts))
+
+    def test_same_as_fixed_size(self):
+        stream = skewed_stream(200000, seed=1, alpha=None, distinct=20000)
+        for cls in [HashTable, SwissHashTable]:
+            growable = cls(buckets=2 ** 14, growable=True)
+            fixed = cls(buckets=2 ** 14)
+            for ht in [growable, fixed]:
+                ht.update(stream)
+            # pruning starts at the same size, so the same keys survive
+            self.assertEqual(growable.buckets(), 2 ** 14)
+            self.assertEqual(sorted(growable.items()), sorted(fixed.items()))
+            self.assertEqual(growable.total(), fixed.total())
+            self.assertAlmostEqual(growable.quality(), fixed.quality())
+
+    def test_updates_and_deletes_during_growth(self):
+        ht = HashTable(buckets=2 ** 12, growable=True)
+        ht.update(str(i) for i in range(1000))
+        # the table has just doubled, the last keys of the previous table are still to be moved
+        self.assertEqual(ht.buckets(), 2048)
+        self.assertGreater(ht._mem(), (2048 + 1024) * 20)
+        for i in range(0, 1000, 3):
+            ht.increment(str(i), 2)
+        for i in range(1, 1000, 3):
+            del ht[str(i)]
+        ht['new'] = 5
+        expected = {str(i): 3 for i in range(0, 1000, 3)}
+        expected.update((str(i), 1) for i in range(2, 1000, 3))
+        expected['new'] = 5
+        self.assertEqual(dict(ht.items()), expected)
+        self.assertEqual(len(ht), len(expected))
+
+    def test_pickle(self):
+        ht = SwissHashTable(buckets=2 ** 15, growable=True)
+        ht.update(skewed_stream(7000, seed=2, alpha=None, distinct=20000))
+        restored = pickle.loads(pickle.dumps(ht))
+        self.assertEqual(restored.buckets(), ht.buckets())
+        self.assertEqual(sorted(restored.items()), sorted(ht.items()))
+        restored.update(skewed_stream(100000, seed=3, alpha=None, distinct=20000))
+        self.assertEqual(restored.buckets(), 2 ** 15)
+
+    def test_clear(self):
+        ht = HashTable(buckets=2 ** 14, growable=True)
+        ht.update(skewed_stream(10000, alpha=None, distinct=20000))
+        self.assertGreater(ht.buckets(), 1024)
+        ht.clear()
+        self.assertEqual(ht.buckets(), 1024)
+        self.assertEqual(ht._mem(), 1024 * 20 + 256 * 4)
+        ht.update(['foo', 'bar', 'foo'])
+        self.assertEqual(sorted(ht.items()), [('bar', 1), ('foo', 2)])
+
+    def test_incremental_prune(self):
+        ht = HashTable(buckets=2 ** 12, growable=True, incremental_prune=True)
+        ht.update(str(i) for i in range(2500))
+        # no pruning before the table has grown to its full size
+        self.assertEqual(len(ht), 2500)
+        ht.update(str(i) for i in range(2500, 20000))
+        self.assertEqual(ht.buckets(), 2 ** 12)
+        self.assertLess(len(ht), 3072)
+
+    def test_space_saving(self):
+        with self.assertRaises(ValueError):
+            SpaceSavingHashTable(buckets=2 ** 12, growable=True)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,47 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import unittest
+
+from bounter import HashTable
+
+
+class HashTableHyperLogLogDisabledTest(unittest.TestCase):
+    def setUp(self):
+        self.ht = HashTable(buckets=64, hll_precision=0)
+
+    def test_exact_cardinality_before_pruning(self):
+        self.ht.update(['foo', 'bar', 'foo'])
+        self.assertEqual(self.ht['foo'], 2)
+        self.assertEqual(self.ht.cardinality(), 2)
+        self.assertEqual(self.ht.quality(), 2 / 48.0)
+
+    def test_raises_after_pruning(self):
+        self.ht.update(str(i) for i in range(100))
+        with self.assertRaises(ValueError):
+            self.ht.cardinality()
+        with self.assertRaises(ValueError):
+            self.ht.quality()
+
+    def test_pickle(self):
+        self.ht.update(['foo', 'bar', 'foo'])
+        restored = pickle.loads(pickle.dumps(self.ht))
+        self.assertEqual(restored['foo'], 2)
+        self.assertEqual(restored.cardinality(), 2)
+
+    def test_clear(self):
+        self.ht.update(str(i) for i in range(100))
+        self.ht.clear()
+        self.ht.update(['foo'])
+        self.assertEqual(self.ht.cardinality(), 1)
+
+
+if __name__ == '__main__':
+    unittest.main()
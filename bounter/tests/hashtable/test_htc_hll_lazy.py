@@ -0,0 +1,82 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import unittest
+
+from bounter import HashTable
+
+
+class HashTableLazyHyperLogLogTest(unittest.TestCase):
+    """
+    The HLL is only filled once the table is pruned for the first time. These tests compare such tables
+    with a reference table that is pruned while still empty and therefore tracks every key from the start.
+    """
+
+    def reference(self, **kwargs):
+        ht = HashTable(**kwargs)
+        ht.prune(1)
+        return ht
+
+    def test_cardinality_after_first_prune(self):
+        for precision in [6, 12, 16]:
+            ht = HashTable(buckets=4096, hll_precision=precision)
+            reference = self.reference(buckets=4096, hll_precision=precision)
+            for table in [ht, reference]:
+                table.update(str(i) for i in range(3000))
+            self.assertEqual(ht.cardinality(), 3000)
+            for table in [ht, reference]:
+                table.prune(1)
+            self.assertEqual(ht.cardinality(), reference.cardinality())
+            self.assertEqual(ht.quality(), reference.quality())
+
+    def test_cardinality_after_automatic_prune(self):
+        ht = HashTable(buckets=1024)
+        reference = self.reference(buckets=1024)
+        for table in [ht, reference]:
+            table.update(str(i % 5000) for i in range(20000))
+        self.assertEqual(ht.cardinality(), reference.cardinality())
+        self.assertEqual(sorted(ht.items()), sorted(reference.items()))
+
+    def test_deleted_keys_are_counted(self):
+        ht = HashTable(buckets=1024)
+        reference = self.reference(buckets=1024)
+        for table in [ht, reference]:
+            table.update(str(i) for i in range(500))
+            for i in range(250):
+                del table[str(i)]
+            table.prune(0)
+            table.update(str(i) for i in range(500, 1000))
+            table.prune(1)
+        self.assertEqual(ht.cardinality(), reference.cardinality())
+
+    def test_pickle_before_first_prune(self):
+        ht = HashTable(buckets=4096)
+        reference = self.reference(buckets=4096)
+        for table in [ht, reference]:
+            table.update(str(i) for i in range(2000))
+        restored = pickle.loads(pickle.dumps(ht))
+        self.assertEqual(restored.cardinality(), 2000)
+        for table in [restored, reference]:
+            table.update(str(i) for i in range(2000, 3000))
+            table.prune(1)
+        self.assertEqual(restored.cardinality(), reference.cardinality())
+
+    def test_clear(self):
+        ht = HashTable(buckets=64)
+        ht.update(str(i) for i in range(100))
+        ht.clear()
+        reference = self.reference(buckets=64)
+        for table in [ht, reference]:
+            table.update(str(i) for i in range(100, 200))
+        self.assertEqual(ht.cardinality(), reference.cardinality())
+
+
+if __name__ == '__main__':
+    unittest.main()
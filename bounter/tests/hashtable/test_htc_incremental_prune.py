@@ -0,0 +1,108 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import unittest
+from collections import Counter
+
+from bounter import HashTable, SwissHashTable
+from bounter.tests.hashtable.streams import uniform_stream
+
+
+class HashTableIncrementalPruneTest(unittest.TestCase):
+    """
+    An incremental prune sweeps a few buckets per new key, so the table has to stay consistent at all times.
+    """
+
+    def assertConsistent(self, ht, counts):
+        items = dict(ht.items())
+        self.assertEqual(len(ht), len(items))
+        for key, count in items.items():
+            self.assertEqual(ht[key], count)
+            self.assertLessEqual(count, counts[key])
+
+    def test_lookups_during_prune(self):
+        for cls in [HashTable, SwissHashTable]:
+            ht = cls(buckets=512, incremental_prune=True)
+            counts = Counter()
+            for i, key in enumerate(uniform_stream(2000, 6000, heavy=20)):
+                ht.increment(key)
+                counts[key] += 1
+                if i % 37 == 0:
+                    self.assertConsistent(ht, counts)
+            self.assertConsistent(ht, counts)
+            self.assertEqual(ht.total(), 6000)
+            for i in range(20):
+                # heavy keys may only have been pruned while they were still light
+                self.assertGreater(ht[u'heavy %d' % i], counts[u'heavy %d' % i] - 5)
+
+    def test_prunes_early(self):
+        ht = HashTable(buckets=1024, incremental_prune=True)
+        reference = HashTable(buckets=1024)
+        for table in [ht, reference]:
+            table.update(str(i) for i in range(700))
+        # the incremental prune started at 640 keys and has been evicting since
+        self.assertLess(len(ht), 700)
+        self.assertEqual(len(reference), 700)
+        ht.update(str(i) for i in range(700, 10000))
+        self.assertLess(len(ht), 768)
+        self.assertEqual(ht.total(), 10000)
+
+    def test_exact_below_threshold(self):
+        stream = uniform_stream(300, 20000, seed=1, heavy=20)
+        ht = HashTable(buckets=1024, incremental_prune=True)
+        ht.update(stream)
+        self.assertEqual(dict(ht.items()), Counter(stream))
+
+    def test_cardinality(self):
+        ht = SwissHashTable(buckets=1024, incremental_prune=True)
+        for i in range(900):
+            ht.increment(str(i))
+            if len(ht) < i + 1:
+                # the first prune has not seen every key yet when it starts
+                self.assertAlmostEqual(ht.cardinality(), i + 1, delta=(i + 1) * 0.05)
+                break
+        else:
+            self.fail("The table did not start pruning.")
+        ht.update(str(i) for i in range(900, 20000))
+        self.assertAlmostEqual(ht.cardinality(), 20000, delta=20000 * 0.05)
+        self.assertLessEqual(ht.quality(), 20000 * 1.05 / (1024 - 128))
+
+    def test_keys_released(self):
+        ht = HashTable(buckets=2 ** 12, incremental_prune=True)
+        ht.update('long key %s' % ('x' * 200 + str(i)) for i in range(100000))
+        # at most one table of keys is waiting to be released
+        self.assertLess(ht._mem() - ht.buckets() * 20, 2 * 3072 * 220 + 2 ** 20)
+
+    def test_prune_and_pickle_during_prune(self):
+        stream = uniform_stream(2000, 3000, seed=2, heavy=20)
+        for cls in [HashTable, SwissHashTable]:
+            ht = cls(buckets=1024, incremental_prune=True)
+            ht.update(stream)
+            restored = pickle.loads(pickle.dumps(ht))
+            self.assertEqual(sorted(restored.items()), sorted(ht.items()))
+            restored.update(stream)
+            self.assertConsistent(restored, Counter(stream * 2))
+
+            ht.prune(1)
+            self.assertTrue(all(count > 1 for count in ht.values()))
+            self.assertConsistent(ht, Counter(stream))
+
+    def test_clear_during_prune(self):
+        ht = HashTable(buckets=256, incremental_prune=True)
+        ht.update(str(i) for i in range(181))
+        ht.clear()
+        self.assertEqual(ht._mem(), ht.buckets() * 20 + 256 * 4)
+        ht.update(['foo', 'bar'])
+        self.assertEqual(sorted(ht.items()), [('bar', 1), ('foo', 1)])
+        self.assertEqual(ht.cardinality(), 2)
+
+
+if __name__ == '__main__':
+    unittest.main()
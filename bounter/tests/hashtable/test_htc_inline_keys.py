@@ -0,0 +1,74 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import unittest
+
+from bounter import HashTable
+
+
+class HashTableInlineKeysTest(unittest.TestCase):
+    """
+    Keys of up to 8 bytes are stored inside the table, longer ones (and the empty key) outside of it.
+    """
+
+    def setUp(self):
+        self.keys = [u'x' * length for length in range(20)] + [u'abcdefg', u'abcdefgh', u'abcdefghi', u'čšž', u'čšžý', u'čšžýá']
+        self.counts = dict((key, i + 1) for i, key in enumerate(self.keys))
+
+    def fill(self, ht):
+        for key, count in self.counts.items():
+            ht.increment(key, count)
+
+    def test_get_and_set(self):
+        ht = HashTable(buckets=128)
+        self.fill(ht)
+        for key, count in self.counts.items():
+            self.assertEqual(ht[key], count)
+        self.assertEqual(ht['abcdefgx'], 0)
+        self.assertEqual(ht['abcdefghx'], 0)
+        ht['abcdefgh'] = 100
+        del ht['xx']
+        self.assertEqual(ht['abcdefgh'], 100)
+        self.assertEqual(ht['xx'], 0)
+
+    def test_iteration(self):
+        ht = HashTable(buckets=128)
+        self.fill(ht)
+        self.assertEqual(dict(ht.items()), self.counts)
+
+    def test_bytes(self):
+        ht = HashTable(buckets=128, use_unicode=False)
+        self.fill(ht)
+        expected = dict((key.encode('utf-8'), count) for key, count in self.counts.items())
+        self.assertEqual(dict(ht.items()), expected)
+
+    def test_pickle(self):
+        ht = HashTable(buckets=128)
+        self.fill(ht)
+        restored = pickle.loads(pickle.dumps(ht))
+        self.assertEqual(dict(restored.items()), self.counts)
+        for key, count in self.counts.items():
+            self.assertEqual(restored[key], count)
+
+    def test_prune(self):
+        ht = HashTable(buckets=64)
+        self.fill(ht)
+        ht.prune(10)
+        expected = dict((key, count) for key, count in self.counts.items() if count > 10)
+        self.assertEqual(dict(ht.items()), expected)
+        for key, count in expected.items():
+            self.assertEqual(ht[key], count)
+        ht.update(str(i) for i in range(1000))
+        for key, count in expected.items():
+            self.assertEqual(ht[key], count)
+
+
+if __name__ == '__main__':
+    unittest.main()
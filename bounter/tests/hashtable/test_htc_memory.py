@@ -0,0 +1,79 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import unittest
+from collections import Counter
+
+from bounter import HashTable
+
+
+class HashTableKeyStorageTest(unittest.TestCase):
+    """
+    Keys are kept in an arena which is compacted whenever the table is pruned.
+    """
+
+    def table_mem(self, ht):
+        return ht.buckets() * 20 + 256 * 4
+
+    def test_mem_counts_keys(self):
+        ht = HashTable(buckets=1024)
+        empty = ht._mem()
+        self.assertEqual(empty, self.table_mem(ht))
+        ht.update(['foo', 'bar', 'foo'])
+        self.assertEqual(ht._mem(), empty)
+        ht.update(['a longer key', 'another longer key'])
+        self.assertGreaterEqual(ht._mem() - empty, 32)
+
+    def test_prune_releases_keys(self):
+        ht = HashTable(buckets=2 ** 12)
+        long_keys = ['long key %s' % ('x' * 200 + str(i)) for i in range(2000)]
+        ht.update(long_keys)
+        ht.update(['short'] * 10)
+        before = ht._mem() - self.table_mem(ht)
+        ht.prune(1)
+        after = ht._mem() - self.table_mem(ht)
+        self.assertEqual(dict(ht.items()), {'short': 10})
+        self.assertLess(after, before / 100)
+
+    def test_keys_survive_compaction(self):
+        ht = HashTable(buckets=64)
+        stream = [str(i % 40) for i in range(2000)] + [str(i) for i in range(100, 200)]
+        ht.update(stream)
+        counts = Counter(stream)
+        items = dict(ht.items())
+        self.assertTrue(items)
+        for key, count in items.items():
+            self.assertEqual(count, counts[key])
+            self.assertEqual(ht[key], count)
+            ht.increment(key, 5)
+            self.assertEqual(ht[key], count + 5)
+
+    def test_pickle(self):
+        ht = HashTable(buckets=64)
+        ht.update(str(i % 40) for i in range(2000))
+        ht.update(str(i) for i in range(100, 200))
+        restored = pickle.loads(pickle.dumps(ht))
+        self.assertEqual(sorted(restored.items()), sorted(ht.items()))
+        for key, count in ht.items():
+            self.assertEqual(restored[key], count)
+        restored.update(str(i) for i in range(200, 300))
+        self.assertEqual(restored.total(), ht.total() + 100)
+
+    def test_clear(self):
+        ht = HashTable(buckets=1024)
+        ht.update(str(i) for i in range(500))
+        ht.clear()
+        self.assertEqual(ht._mem(), self.table_mem(ht))
+        ht.update(['foo', 'bar'])
+        self.assertEqual(sorted(ht.items()), [('bar', 1), ('foo', 1)])
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,154 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import sys
+import threading
+import unittest
+from collections import Counter
+
+from bounter import HashTable, SwissHashTable, SpaceSavingHashTable, ConcurrentHashTable
+from bounter.tests.hashtable.streams import skewed_stream
+
+
+class HashTableMergeTest(unittest.TestCase):
+    """
+    Updating a table with another one of the same type merges the other table's buckets directly.
+    """
+
+    classes = [HashTable, SwissHashTable, SpaceSavingHashTable, ConcurrentHashTable]
+
+    def test_same_as_items(self):
+        first = skewed_stream(3000)
+        second = skewed_stream(3000, seed=1)
+        for cls in self.classes:
+            merged = cls(buckets=2 ** 14)
+            other = cls(buckets=2 ** 12)
+            merged.update(first)
+            other.update(second)
+            del other[second[0]]
+            merged.update(other)
+            expected = Counter(first) + Counter(second)
+            del expected[second[0]]
+            expected.update(k for k in first if k == second[0])
+            self.assertEqual(dict(merged.items()), expected)
+            self.assertEqual(len(merged), len(expected))
+            self.assertEqual(merged.cardinality(), len(Counter(first + second)))
+            for key in list(expected)[::13]:
+                self.assertEqual(merged[key], expected[key])
+
+    def test_merge_into_itself(self):
+        for cls in self.classes:
+            ht = cls(buckets=256)
+            ht.update([u'foo', u'bar', u'foo', u'a much longer key'])
+            ht.update(ht)
+            self.assertEqual(sorted(ht.items()), [(u'a much longer key', 2), (u'bar', 2), (u'foo', 4)])
+            self.assertEqual(ht.total(), 8)
+
+    def test_growable(self):
+        stream = skewed_stream(20000, seed=2)
+        for cls in [HashTable, SwissHashTable]:
+            merged = cls(buckets=2 ** 16, growable=True)
+            other = cls(buckets=2 ** 16, growable=True)
+            other.update(stream)
+            merged.update(other)
+            self.assertEqual(dict(merged.items()), Counter(stream))
+
+    def test_threads(self):
+        # a table is not changed by another thread while it is merged
+        switch_interval = sys.getswitchinterval()
+        sys.setswitchinterval(1e-6)
+        try:
+            for cls in self.classes:
+                options = {} if cls in [SpaceSavingHashTable, ConcurrentHashTable] else {'growable': True}
+                other = cls(buckets=2 ** 16, **options)
+                merged = cls(buckets=2 ** 16)
+                keys = [u'key number %d' % i for i in range(30000)]
+
+                def merge():
+                    for _ in range(20):
+                        merged.update(other)
+
+                threads = [threading.Thread(target=lambda: [other.increment(key) for key in keys]),
+                           threading.Thread(target=merge)]
+                for thread in threads:
+                    thread.start()
+                for thread in threads:
+                    thread.join()
+                self.assertEqual(dict(other.items()), dict.fromkeys(keys, 1))
+                self.assertLessEqual(len(merged), len(keys))
+                self.assertEqual(merged.total(), sum(merged.values()))
+        finally:
+            sys.setswitchinterval(switch_interval)
+
+    def test_prune_while_merging(self):
+        streams = [skewed_stream(20000, seed=i, distinct=20000) for i in range(8)]
+        for cls in [HashTable, SwissHashTable, ConcurrentHashTable]:
+            workers = [cls(buckets=2 ** 12, prune_threads=2) for _ in streams]
+            for worker, stream in zip(workers, streams):
+                worker.update(stream)
+            merged = cls(buckets=2 ** 13, prune_threads=2)
+            for worker in workers:
+                merged.update(worker)
+
+            counts = Counter()
+            for stream in streams:
+                counts.update(stream)
+            self.assertLessEqual(len(merged), 6144)
+            # pruned counts are still part of the total
+            self.assertEqual(merged.total(), sum(counts.values()))
+            for key, count in merged.items():
+                self.assertLessEqual(count, counts[key])
+            for key, count in counts.most_common(5):
+                self.assertGreater(merged[key], count * 0.9)
+            # the HLLs of the workers remember the keys they have pruned
+            self.assertAlmostEqual(merged.cardinality(), len(counts), delta=len(counts) * 0.05)
+
+    def test_pruned_into_unpruned(self):
+        stream = skewed_stream(40000, seed=3, distinct=20000)
+        small = HashTable(buckets=2 ** 12)
+        small.update(stream)
+        merged = HashTable(buckets=2 ** 16)
+        merged.update([u'only here %d' % i for i in range(1000)])
+        merged.update(small)
+        self.assertAlmostEqual(merged.cardinality(), len(set(stream)) + 1000, delta=(len(set(stream)) + 1000) * 0.05)
+
+    def test_space_saving_errors(self):
+        first = SpaceSavingHashTable(buckets=64)
+        second = SpaceSavingHashTable(buckets=64)
+        first.update(skewed_stream(2000, seed=4, distinct=100))
+        second.update(skewed_stream(2000, seed=5, distinct=100))
+        errors = {key: first.error(key) + second.error(key) for key in set(first) | set(second)}
+        first.update(second)
+        for key in first:
+            if key in errors:
+                # a key which replaces another one takes over its count as error as well
+                self.assertGreaterEqual(first.error(key), errors[key])
+
+    def test_overflow(self):
+        for cls in self.classes:
+            merged = cls(buckets=64)
+            merged[u'big'] = 2 ** 63 - 1
+            other = cls(buckets=64)
+            other.update([u'big'])
+            with self.assertRaises(OverflowError):
+                merged.update(other)
+            self.assertEqual(merged[u'big'], 2 ** 63 - 1)
+
+    def test_different_hll_precisions(self):
+        merged = HashTable(buckets=64, hll_precision=10)
+        other = HashTable(buckets=64, hll_precision=12)
+        other.update(str(i) for i in range(200))
+        with self.assertRaises(ValueError):
+            merged.update(other)
+        # an unpruned table only adds its keys
+        merged.update(HashTable(buckets=64, hll_precision=12))
+
+
+if __name__ == '__main__':
+    unittest.main()
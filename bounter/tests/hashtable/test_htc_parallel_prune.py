@@ -0,0 +1,112 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import sys
+import threading
+import unittest
+
+from bounter import HashTable, SwissHashTable
+from bounter.tests.hashtable.streams import skewed_stream
+
+
+class HashTableParallelPruneTest(unittest.TestCase):
+    """
+    Pruning the ranges between empty buckets on several threads must leave the table exactly as a single sweep does.
+    """
+
+    buckets = 2 ** 17
+
+    def assertSameTables(self, first, second):
+        # iteration follows the buckets, so the keys must have ended up in the very same places
+        self.assertEqual(list(first.items()), list(second.items()))
+        self.assertEqual(len(first), len(second))
+        self.assertEqual(first.total(), second.total())
+        self.assertEqual(first.cardinality(), second.cardinality())
+
+    def test_explicit_prune(self):
+        stream = skewed_stream(90000, alpha=1.0, distinct=None)
+        for cls in [HashTable, SwissHashTable]:
+            for threads in [2, 3, 8, 0]:
+                serial = cls(buckets=self.buckets)
+                parallel = cls(buckets=self.buckets)
+                for ht in [serial, parallel]:
+                    ht.update(stream)
+                serial.prune(1)
+                parallel.prune(1, threads=threads)
+                self.assertSameTables(serial, parallel)
+                self.assertGreater(len(parallel), 0)
+                self.assertTrue(all(count > 1 for count in parallel.values()))
+
+                # the second prune no longer seeds the HLL
+                for ht in [serial, parallel]:
+                    ht.update(stream[:20000])
+                serial.prune(3)
+                parallel.prune(3, threads)
+                self.assertSameTables(serial, parallel)
+
+    def test_automatic_prune(self):
+        stream = skewed_stream(500000, seed=1, alpha=1.0, distinct=None)
+        for cls in [HashTable, SwissHashTable]:
+            serial = cls(buckets=self.buckets)
+            parallel = cls(buckets=self.buckets, prune_threads=4)
+            for ht in [serial, parallel]:
+                ht.update(stream)
+            self.assertSameTables(serial, parallel)
+            for key, count in parallel.items():
+                self.assertEqual(parallel[key], count)
+
+    def test_small_table(self):
+        serial = HashTable(buckets=64)
+        parallel = HashTable(buckets=64, prune_threads=8)
+        for ht in [serial, parallel]:
+            ht.update(str(i % 100) for i in range(1000))
+        self.assertSameTables(serial, parallel)
+
+    def test_pickle(self):
+        ht = HashTable(buckets=self.buckets, prune_threads=4)
+        ht.update(skewed_stream(200000, seed=2, alpha=1.0, distinct=None))
+        restored = pickle.loads(pickle.dumps(ht))
+        self.assertEqual(list(restored.items()), list(ht.items()))
+        restored.prune(2)
+        ht.prune(2, threads=1)
+        self.assertSameTables(restored, ht)
+
+    def test_python_threads(self):
+        # other Python threads must not use the table while its keys are moved by the prune threads
+        switch_interval = sys.getswitchinterval()
+        sys.setswitchinterval(1e-6)
+        try:
+            for cls in [HashTable, SwissHashTable]:
+                ht = cls(buckets=2 ** 16, prune_threads=2)
+                chunks = [[u'thread %d key %d' % (t, i) for i in range(60000)] for t in range(4)]
+                threads = [threading.Thread(target=lambda chunk: [ht.increment(key) for key in chunk], args=(chunk,))
+                           for chunk in chunks[:2]]
+                threads += [threading.Thread(target=ht.update, args=(chunk,)) for chunk in chunks[2:]]
+                for thread in threads:
+                    thread.start()
+                for thread in threads:
+                    thread.join()
+                self.assertEqual(ht.total(), 240000)
+                self.assertLess(len(ht), 2 ** 16)
+                for key, count in ht.items():
+                    self.assertEqual(ht[key], count)
+        finally:
+            sys.setswitchinterval(switch_interval)
+
+    def test_invalid_threads(self):
+        ht = HashTable(buckets=64)
+        with self.assertRaises(TypeError):
+            ht.prune(1, threads='all')
+        with self.assertRaises(TypeError):
+            HashTable(buckets=64, prune_threads=1.5)
+
+
+if __name__ == '__main__':
+    unittest.main()
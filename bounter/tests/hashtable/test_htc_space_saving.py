@@ -0,0 +1,127 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import unittest
+from collections import Counter
+
+from bounter import HashTable, SpaceSavingHashTable
+from bounter.tests.hashtable.streams import skewed_stream
+
+
+def noisy_stream(length, seed=0):
+    # fewer frequent keys than the other tests use, while the noise keeps replacing the minimum
+    return skewed_stream(length, seed, alpha=0.7, skew=0.6, short=u'w%d', noise=u'noise number %d')
+
+
+class SpaceSavingHashTableTest(unittest.TestCase):
+    """
+    A full Space-Saving table replaces the key with the lowest count, which the new key takes over as its error.
+    """
+
+    def test_exact_until_full(self):
+        ht = SpaceSavingHashTable(buckets=256)
+        stream = [str(i % 150) for i in range(1000)]
+        ht.update(stream)
+        self.assertEqual(dict(ht.items()), Counter(stream))
+        self.assertTrue(all(ht.error(key) == 0 for key in ht))
+        self.assertEqual(ht.error('missing'), 0)
+        self.assertEqual(ht.cardinality(), 150)
+
+    def test_error_bounds(self):
+        stream = noisy_stream(50000)
+        counts = Counter()
+        ht = SpaceSavingHashTable(buckets=512)
+        for i, key in enumerate(stream):
+            ht.increment(key, 1 + i % 3)
+            counts[key] += 1 + i % 3
+        self.assertEqual(len(ht), 384)
+        for key, count in ht.items():
+            self.assertLessEqual(count - ht.error(key), counts[key])
+            self.assertLessEqual(counts[key], count)
+        for key in counts:
+            if key not in ht:
+                self.assertLessEqual(counts[key], ht.error(key))
+        self.assertAlmostEqual(ht.cardinality(), len(counts), delta=len(counts) * 0.05)
+
+    def test_top(self):
+        stream = noisy_stream(100000, seed=1)
+        ht = SpaceSavingHashTable(buckets=1024)
+        ht.update(stream)
+        top = ht.top(10)
+        self.assertEqual(len(top), 10)
+        self.assertEqual([count for _, count, _ in top], sorted(ht.values(), reverse=True)[:10])
+        self.assertTrue(ht.top_guaranteed(10))
+        self.assertEqual(set(key for key, _, _ in top), set(key for key, _ in Counter(stream).most_common(10)))
+        for key, count, error in top:
+            self.assertEqual(ht[key], count)
+            self.assertEqual(ht.error(key), error)
+        self.assertFalse(ht.top_guaranteed(700))
+        self.assertEqual(ht.top(0), [])
+        self.assertEqual(len(ht.top(5000)), len(ht))
+        with self.assertRaises(ValueError):
+            ht.top(-1)
+
+    def test_deleted_keys_go_first(self):
+        ht = SpaceSavingHashTable(buckets=16)
+        ht.update({str(i): 10 + i for i in range(12)})
+        del ht['5']
+        ht['7'] = 0
+        ht.update(['new', 'newer'])
+        self.assertEqual(ht['new'], 1)
+        self.assertEqual(ht['newer'], 1)
+        self.assertEqual(ht.error('new'), 0)
+        self.assertEqual(len(ht), 12)
+        self.assertEqual(ht.top(1), [('11', 21, 0)])
+
+        ht.increment('newest', 2)
+        # the lowest count is replaced
+        self.assertEqual(ht['newest'], 3)
+        self.assertEqual(ht.error('newest'), 1)
+
+        ht['newest'] = 50
+        self.assertEqual(ht.error('newest'), 0)
+        self.assertEqual(ht.top(1), [('newest', 50, 0)])
+
+    def test_pickle_and_prune(self):
+        ht = SpaceSavingHashTable(buckets=512)
+        ht.update(noisy_stream(30000, seed=2))
+        restored = pickle.loads(pickle.dumps(ht))
+        self.assertEqual(sorted(restored.items()), sorted(ht.items()))
+        self.assertEqual(restored.top(20), ht.top(20))
+
+        for table in [ht, restored]:
+            table.prune(100)
+            self.assertTrue(all(count > 100 for count in table.values()))
+            table.update(noisy_stream(30000, seed=3))
+        self.assertEqual(restored.top(20), ht.top(20))
+        self.assertEqual(len(ht), 384)
+
+    def test_clear(self):
+        ht = SpaceSavingHashTable(buckets=64)
+        ht.update(noisy_stream(1000))
+        ht.clear()
+        self.assertEqual(ht.top(10), [])
+        ht.update(['foo', 'bar', 'foo'])
+        self.assertEqual(ht.top(10), [('foo', 2, 0), ('bar', 1, 0)])
+
+    def test_memory(self):
+        ht = SpaceSavingHashTable(size_mb=4)
+        self.assertLessEqual(ht._mem(), HashTable(size_mb=4)._mem())
+        ht.update('long key number %d' % i for i in range(200000))
+        # keys of evicted entries are released
+        self.assertLess(ht._mem(), HashTable(size_mb=4)._mem() + 3 * 24576 * 25)
+
+    def test_no_incremental_prune(self):
+        with self.assertRaises(ValueError):
+            SpaceSavingHashTable(buckets=64, incremental_prune=True)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,97 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+# Copyright (C) 2017 Rare Technologies
+#
+# This code is distributed under the terms and conditions
+# from the MIT License (MIT).
+
+import pickle
+import unittest
+from collections import Counter
+
+from bounter import HashTable, SwissHashTable
+from bounter.tests.hashtable.streams import uniform_stream
+
+
+class SwissHashTableTest(unittest.TestCase):
+    """
+    The variant probing groups of control bytes must count exactly like the basic table, only pruning later.
+    """
+
+    def test_same_counts_as_basic(self):
+        stream = uniform_stream(1000, 20000)
+        swiss = SwissHashTable(buckets=4096)
+        basic = HashTable(buckets=4096)
+        for ht in [swiss, basic]:
+            ht.update(stream)
+        self.assertEqual(dict(swiss.items()), dict(basic.items()))
+        self.assertEqual(dict(swiss.items()), Counter(stream))
+        for key, count in Counter(stream).items():
+            self.assertEqual(swiss[key], count)
+        self.assertEqual(swiss['missing'], 0)
+        self.assertEqual(swiss.cardinality(), basic.cardinality())
+        self.assertEqual(swiss.total(), basic.total())
+
+    def test_load_limit(self):
+        ht = SwissHashTable(buckets=64)
+        ht.update(str(i) for i in range(56))
+        self.assertEqual(len(ht), 56)
+        self.assertEqual(ht.quality(), 1.0)
+        ht.update(['56'])
+        self.assertLess(len(ht), 56)
+
+    def test_small_tables(self):
+        for buckets in [4, 8, 16, 32]:
+            ht = SwissHashTable(buckets=buckets)
+            ht.update(str(i % (buckets * 2)) for i in range(buckets * 20))
+            self.assertLess(len(ht), buckets)
+            for key, count in ht.items():
+                self.assertEqual(ht[key], count)
+
+    def test_pruning(self):
+        stream = uniform_stream(5000, 50000, seed=1)
+        ht = SwissHashTable(buckets=1024)
+        ht.update(stream)
+        counts = Counter(stream)
+        items = dict(ht.items())
+        self.assertTrue(items)
+        for key, count in items.items():
+            self.assertLessEqual(count, counts[key])
+            self.assertEqual(ht[key], count)
+        self.assertAlmostEqual(ht.cardinality(), len(counts), delta=len(counts) * 0.02)
+
+    def test_set_and_delete(self):
+        ht = SwissHashTable(buckets=64)
+        ht['foo'] = 5
+        ht['a longer key'] = 7
+        del ht['foo']
+        self.assertEqual(ht['foo'], 0)
+        self.assertEqual(ht['a longer key'], 7)
+        self.assertEqual(dict(ht.items()), {'a longer key': 7})
+
+    def test_pickle(self):
+        ht = SwissHashTable(buckets=1024)
+        ht.update(uniform_stream(500, 5000))
+        restored = pickle.loads(pickle.dumps(ht))
+        self.assertIsInstance(restored, SwissHashTable)
+        self.assertEqual(dict(restored.items()), dict(ht.items()))
+        for key, count in ht.items():
+            self.assertEqual(restored[key], count)
+        restored.update(uniform_stream(500, 5000))
+        ht.update(uniform_stream(500, 5000))
+        self.assertEqual(dict(restored.items()), dict(ht.items()))
+
+    def test_clear(self):
+        ht = SwissHashTable(buckets=64)
+        ht.update(str(i) for i in range(100))
+        ht.clear()
+        self.assertEqual(len(ht), 0)
+        self.assertEqual(ht['99'], 0)
+        ht.update(['foo', 'foo'])
+        self.assertEqual(dict(ht.items()), {'foo': 2})
+
+
+if __name__ == '__main__':
+    unittest.main()
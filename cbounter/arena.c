@@ -0,0 +1,106 @@
+//-----------------------------------------------------------------------------
+// Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+// Copyright (C) 2017 Rare Technologies
+//
+// This code is distributed under the terms and conditions
+// from the MIT License (MIT).
+
+#include <stdlib.h>
+#include "arena.h"
+
+void Arena_init(Arena *self)
+{
+    self->head = NULL;
+    self->used = 0;
+    self->reserved = 0;
+}
+
+static int Arena_add_slab(Arena *self, size_t size)
+{
+    arena_slab_t * slab = (arena_slab_t *) malloc(sizeof(arena_slab_t) + size);
+    if (!slab)
+        return 1;
+    slab->next = self->head;
+    slab->size = size;
+    slab->used = 0;
+    self->head = slab;
+    self->reserved += sizeof(arena_slab_t) + size;
+    return 0;
+}
+
+int Arena_reserve(Arena *self, size_t size)
+{
+    if (self->head && self->head->size - self->head->used >= size)
+        return 0;
+    return Arena_add_slab(self, size);
+}
+
+char * Arena_alloc(Arena *self, size_t size)
+{
+    arena_slab_t * slab = self->head;
+    if (!slab || slab->size - slab->used < size)
+    {
+        // the slabs double together with the arena, so that small arenas stay small
+        size_t slab_size = self->reserved;
+        if (slab_size < ARENA_MIN_SLAB)
+            slab_size = ARENA_MIN_SLAB;
+        if (slab_size > ARENA_MAX_SLAB)
+            slab_size = ARENA_MAX_SLAB;
+        if (slab_size < size)
+            slab_size = size;
+        if (Arena_add_slab(self, slab_size))
+            return NULL;
+        slab = self->head;
+    }
+
+    char * result = slab->data + slab->used;
+    slab->used += size;
+    self->used += size;
+    return result;
+}
+
+void Arena_merge(Arena *self, Arena *other)
+{
+    arena_slab_t * tail = other->head;
+    if (!tail)
+        return;
+    if (!self->head)
+    {
+        *self = *other;
+        Arena_init(other);
+        return;
+    }
+
+    // the slabs of the other arena go behind the one being filled
+    while (tail->next)
+        tail = tail->next;
+    tail->next = self->head->next;
+    self->head->next = other->head;
+    self->used += other->used;
+    self->reserved += other->reserved;
+    Arena_init(other);
+}
+
+int Arena_release_slab(Arena *self)
+{
+    arena_slab_t * slab = self->head;
+    if (!slab)
+        return 0;
+    self->head = slab->next;
+    self->used -= slab->used;
+    self->reserved -= sizeof(arena_slab_t) + slab->size;
+    free(slab);
+    return self->head != NULL;
+}
+
+void Arena_dealloc(Arena *self)
+{
+    arena_slab_t * slab = self->head;
+    while (slab)
+    {
+        arena_slab_t * next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    Arena_init(self);
+}
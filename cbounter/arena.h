@@ -0,0 +1,51 @@
+//-----------------------------------------------------------------------------
+// Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+// Copyright (C) 2017 Rare Technologies
+//
+// This code is distributed under the terms and conditions
+// from the MIT License (MIT).
+//
+// Bump allocator for many small strings that are released all at once.
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Slabs grow with the arena from the smallest to the largest size, larger requests get a slab of their own. */
+#define ARENA_MIN_SLAB (1 << 12)
+#define ARENA_MAX_SLAB (1 << 20)
+
+typedef struct arena_slab_s {
+    struct arena_slab_s * next; /* previously filled slab */
+    size_t size;                /* capacity of data */
+    size_t used;
+    char data[];
+} arena_slab_t;
+
+typedef struct {
+    arena_slab_t * head; /* slab currently being filled */
+    size_t used;         /* bytes handed out */
+    size_t reserved;     /* bytes allocated from the system, including slab headers */
+} Arena;
+
+void Arena_init(Arena *self);
+
+/* Returns `size` bytes of storage which stay valid until the arena is released, or NULL when out of memory. */
+char * Arena_alloc(Arena *self, size_t size);
+
+/* Makes sure that the next allocations of `size` bytes in total fit into a single slab. Returns 0 when successful, 1 otherwise. */
+int Arena_reserve(Arena *self, size_t size);
+
+/* Takes over all slabs of `other`, whose storage stays valid, leaving `other` empty. */
+void Arena_merge(Arena *self, Arena *other);
+
+/* Releases the most recently added slab, so that a large arena can be released in small steps. Returns 0 when the arena
+ * has no slabs left, 1 otherwise.
+ */
+int Arena_release_slab(Arena *self);
+
+/* Releases all slabs, leaving the arena empty. */
+void Arena_dealloc(Arena *self);
+
+#endif
@@ -21,20 +21,138 @@ static inline uint32_t rand_32b()
 #include "cms_conservative.c"
 #include "cms_log8.c"
 #include "cms_log1024.c"
+#include "cms_hll.c"
+#include "parallel.h"
 #include <time.h>
 
+typedef struct {
+    void * source;
+    void ** rows; // target rows, one per row being converted
+    uint32_t first_row;
+    uint32_t seed;
+} cms_convert_job_t;
+
+#define CONVERT_SOURCE CMS_Conservative
+#define CONVERT_SOURCE_CELL uint32_t
+#define CONVERT_TARGET CMS_Log1024
+#define CONVERT_TARGET_CELL uint16_t
+#include "cms_convert.c"
+
+#define CONVERT_SOURCE CMS_Conservative
+#define CONVERT_SOURCE_CELL uint32_t
+#define CONVERT_TARGET CMS_Log8
+#define CONVERT_TARGET_CELL uint8_t
+#include "cms_convert.c"
+
+#define CONVERT_SOURCE CMS_Log1024
+#define CONVERT_SOURCE_CELL uint16_t
+#define CONVERT_TARGET CMS_Log8
+#define CONVERT_TARGET_CELL uint8_t
+#include "cms_convert.c"
+
+/* Converts a sketch into a narrower counter encoding. */
+static PyObject *
+cmsc_convert(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"sketch", "log_counting", "path", "threads", NULL};
+    PyObject * sketch;
+    int log_counting;
+    const char * path = NULL;
+    unsigned int threads = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oi|zI", kwlist, &sketch, &log_counting, &path, &threads))
+        return NULL;
+    if (!threads)
+        threads = parallel_cpu_count();
+
+    if (Py_TYPE(sketch) == &CMS_ConservativeType && log_counting == 1024)
+        return CMS_Conservative_to_CMS_Log1024((CMS_Conservative *) sketch, path, threads);
+    if (Py_TYPE(sketch) == &CMS_ConservativeType && log_counting == 8)
+        return CMS_Conservative_to_CMS_Log8((CMS_Conservative *) sketch, path, threads);
+    if (Py_TYPE(sketch) == &CMS_Log1024Type && log_counting == 8)
+        return CMS_Log1024_to_CMS_Log8((CMS_Log1024 *) sketch, path, threads);
+
+    char * msg = "Unsupported conversion, the sketch can only be converted to a narrower log_counting (1024 or 8).";
+    PyErr_SetString(PyExc_ValueError, msg);
+    return NULL;
+}
+
+/* Opens a sketch stored by convert(). */
+static PyObject *
+cmsc_load(PyObject *module, PyObject *args)
+{
+    const char * path;
+    cms_file_header_t header;
+    PyObject * sketch = NULL;
+
+    if (!PyArg_ParseTuple(args, "s", &path))
+        return NULL;
+
+    FILE * file = fopen(path, "rb");
+    if (!file)
+        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+
+    // the file stores one byte per HLL register, of which there are 2^precision, or none with precision 0
+    int hll_precision = 0;
+    int valid = fread(&header, sizeof(header), 1, file) == 1;
+    while (valid && hll_precision < 31 && (1U << hll_precision) < header.hll_size)
+        hll_precision++;
+
+    if (!valid || memcmp(header.magic, CMS_FILE_MAGIC, 8) || (header.hll_size && (1U << hll_precision) != header.hll_size)
+        || header.depth < 1 || header.depth > 32 || !header.width || (header.width & (header.width - 1)))
+    {
+        PyErr_SetString(PyExc_ValueError, "Not a sketch file!");
+    }
+    else if (header.cell_size == sizeof(uint32_t))
+    {
+        sketch = PyObject_CallFunction((PyObject *) &CMS_ConservativeType, "IIIKi", header.width, header.depth, 0,
+            (unsigned long long) 0, hll_precision);
+        if (sketch && CMS_Conservative_load_file((CMS_Conservative *) sketch, file, &header))
+            Py_CLEAR(sketch);
+    }
+    else if (header.cell_size == sizeof(uint16_t))
+    {
+        sketch = PyObject_CallFunction((PyObject *) &CMS_Log1024Type, "IIIKi", header.width, header.depth, 0,
+            (unsigned long long) 0, hll_precision);
+        if (sketch && CMS_Log1024_load_file((CMS_Log1024 *) sketch, file, &header))
+            Py_CLEAR(sketch);
+    }
+    else if (header.cell_size == sizeof(uint8_t))
+    {
+        sketch = PyObject_CallFunction((PyObject *) &CMS_Log8Type, "IIIKi", header.width, header.depth, 0,
+            (unsigned long long) 0, hll_precision);
+        if (sketch && CMS_Log8_load_file((CMS_Log8 *) sketch, file, &header))
+            Py_CLEAR(sketch);
+    }
+    else
+    {
+        PyErr_SetString(PyExc_ValueError, "Unsupported cell size in sketch file!");
+    }
+
+    fclose(file);
+    return sketch;
+}
+
+static PyMethodDef module_methods[] = {
+    {"convert", (PyCFunction)cmsc_convert, METH_VARARGS | METH_KEYWORDS,
+     "Converts a sketch into a narrower counter encoding, either in memory or into a file."
+    },
+    {"load", (PyCFunction)cmsc_load, METH_VARARGS,
+     "Opens a sketch file written by convert, mapping its table into memory."
+    },
+    {"union_cardinality", (PyCFunction)cmsc_union_cardinality, METH_VARARGS,
+     "Estimates the cardinality of the union of a sequence of HyperLogLogs without merging them."
+    },
+    {NULL}  /* Sentinel */
+};
+
 #if PY_MAJOR_VERSION >= 3
 static PyModuleDef CMSC_module = {
     PyModuleDef_HEAD_INIT,
     "bounter-cmsc",
     "C implementation of Count-Min Sketch.",
     -1,
-    NULL, NULL, NULL, NULL, NULL
-};
-
-#else
-static PyMethodDef module_methods[] = {
-    {NULL}  /* Sentinel */
+    module_methods, NULL, NULL, NULL, NULL
 };
 #endif
 
@@ -51,7 +169,11 @@ PyMODINIT_FUNC initbounter_cmsc(void)
     PyObject* m;
     if (PyType_Ready(&CMS_ConservativeType) < 0
         || PyType_Ready(&CMS_Log8Type) < 0
-        || PyType_Ready(&CMS_Log1024Type) < 0) {
+        || PyType_Ready(&CMS_Log1024Type) < 0
+        || PyType_Ready(&CMS_Conservative_RingType) < 0
+        || PyType_Ready(&CMS_Log8_RingType) < 0
+        || PyType_Ready(&CMS_Log1024_RingType) < 0
+        || PyType_Ready(&CMS_HyperLogLogType) < 0) {
 
     #if PY_MAJOR_VERSION >= 3
         return NULL;
@@ -84,6 +206,18 @@ PyMODINIT_FUNC initbounter_cmsc(void)
     Py_INCREF(&CMS_Log1024Type);
     PyModule_AddObject(m, "CMS_Log1024", (PyObject *)&CMS_Log1024Type);
 
+    Py_INCREF(&CMS_Conservative_RingType);
+    PyModule_AddObject(m, "CMS_Conservative_Ring", (PyObject *)&CMS_Conservative_RingType);
+
+    Py_INCREF(&CMS_Log8_RingType);
+    PyModule_AddObject(m, "CMS_Log8_Ring", (PyObject *)&CMS_Log8_RingType);
+
+    Py_INCREF(&CMS_Log1024_RingType);
+    PyModule_AddObject(m, "CMS_Log1024_Ring", (PyObject *)&CMS_Log1024_RingType);
+
+    Py_INCREF(&CMS_HyperLogLogType);
+    PyModule_AddObject(m, "HyperLogLog", (PyObject *)&CMS_HyperLogLogType);
+
 
     #if PY_MAJOR_VERSION >= 3
     return m;
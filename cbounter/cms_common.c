@@ -14,8 +14,77 @@
 #include "structmember.h"
 #include "murmur3.h"
 #include "hll.h"
+#include "combiner.h"
+#include "pages.h"
 #include <math.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifndef CMS_FILE_MAGIC
+#define CMS_FILE_MAGIC "BNTRCMS1"
+#define CMS_FILE_ALIGN 4096
+
+/* Header of a sketch stored in a file. The table follows the HLL registers, aligned to CMS_FILE_ALIGN,
+ * with rows stored one after another so that it can be mapped into memory directly.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t cell_size;
+    uint32_t depth;
+    uint32_t width;
+    uint32_t hll_size;
+    long long total;
+} cms_file_header_t;
+
+static inline long long cms_file_table_offset(const cms_file_header_t * header)
+{
+    return ((long long) CMS_FILE_ALIGN + header->hll_size + CMS_FILE_ALIGN - 1) / CMS_FILE_ALIGN * CMS_FILE_ALIGN;
+}
+
+/* Number of bits the doorkeeper sets for each key. */
+#define CMS_DOORKEEPER_HASHES 3
+
+/* Serializes a HLL into a new bytearray for pickling. */
+static inline PyObject * cms_hll_state(HyperLogLog * hll)
+{
+    PyObject *state = PyByteArray_FromStringAndSize(NULL, HyperLogLog_serialized_size(hll));
+    if (state)
+        HyperLogLog_serialize(hll, PyByteArray_AS_STRING(state));
+    return state;
+}
+
+/* Restores a HLL from a pickled bytearray. Returns 0 when successful, -1 with an exception set otherwise. */
+static inline int cms_hll_set_state(HyperLogLog * hll, PyObject * state)
+{
+    char * buffer = PyByteArray_AsString(state);
+    if (!buffer)
+        return -1;
+    if (HyperLogLog_deserialize(hll, buffer, PyByteArray_Size(state)))
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid HyperLogLog state!");
+        return -1;
+    }
+    return 0;
+}
+
+/* Adds a key to the HLL using a 64-bit hash made of its first row hash and, only when needed, its second row hash.
+ * Returns 1 when out of memory, 0 otherwise. */
+static inline int cms_hll_add(HyperLogLog * hll, uint32_t first_hash, const char * data, Py_ssize_t dataLength)
+{
+    if (!hll->k)
+        return 0;
+    uint32_t second_hash = 0;
+    if (HyperLogLog_needs_low_bits(hll, first_hash))
+        MurmurHash3_x86_32((void *) data, dataLength, 1, (void *) &second_hash);
+    return HyperLogLog_add(hll, ((uint64_t) first_hash << 32) | second_hash);
+}
+#endif
 
 typedef struct {
     PyObject_HEAD
@@ -25,6 +94,12 @@ typedef struct {
     long long total;
     CMS_CELL_TYPE ** table;
     HyperLogLog hll;
+    Combiner buffer;
+    void * mapping; // file mapping holding the table, if loaded from a file
+    size_t mapping_size;
+    uint64_t * doorkeeper; // bloom filter absorbing the first occurrence of each key, if enabled
+    uint32_t doorkeeper_mask;
+    unsigned long long doorkeeper_bits; // 0 when disabled
 } CMS_TYPE;
 
 /* Destructor invoked by python. */
@@ -33,13 +108,22 @@ CMS_VARIANT(_dealloc)(CMS_TYPE* self)
 {
     // free our own tables
     int i;
-    for (i = 0; i < self->depth; i++)
+    if (self->table && !self->mapping)
     {
-        free(self->table[i]);
+        for (i = 0; i < self->depth; i++)
+        {
+            free(self->table[i]);
+        }
     }
     free(self->table);
-    // then deallocate hll
+    #ifndef _WIN32
+    if (self->mapping)
+        munmap(self->mapping, self->mapping_size);
+    #endif
+    // then deallocate hll, buffer and doorkeeper
     HyperLogLog_dealloc(&self->hll);
+    Combiner_dealloc(&self->buffer);
+    free(self->doorkeeper);
     // finally, destroy itself
     #if PY_MAJOR_VERSION >= 3
     Py_TYPE(self)->tp_free((PyObject*) self);
@@ -59,17 +143,27 @@ CMS_VARIANT(_new)(PyTypeObject *type, PyObject *args, PyObject *kwds)
 static int
 CMS_VARIANT(_init)(CMS_TYPE *self, PyObject *args, PyObject *kwds)
 {
-    static char *kwlist[] = {"width", "depth", NULL};
+    static char *kwlist[] = {"width", "depth", "buffer_size", "doorkeeper", "hll_precision", NULL};
 
     uint32_t w;
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "II", kwlist,
-				      &w, &self->depth)) {
+    uint32_t buffer_size = 0;
+    unsigned long long doorkeeper = 0;
+    int hll_precision = HLL_DEFAULT_PRECISION;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "II|IKi", kwlist,
+				      &w, &self->depth, &buffer_size, &doorkeeper, &hll_precision)) {
+        return -1;
+    }
+
+    if (hll_precision && (hll_precision < HLL_MIN_PRECISION || hll_precision > HLL_MAX_PRECISION)) {
+        char * msg = "HyperLogLog precision must be 0 or in the range 4-18";
+        PyErr_SetString(PyExc_ValueError, msg);
         return -1;
     }
 
     if (self->depth  < 1 || self->depth > 32) {
         char * msg = "Depth must be in the range 1-16";
         PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
     }
 
     short int hash_length = -1;
@@ -80,7 +174,35 @@ CMS_VARIANT(_init)(CMS_TYPE *self, PyObject *args, PyObject *kwds)
     self->width = 1 << hash_length;
     self->hash_mask = self->width - 1;
 
-    HyperLogLog_init(&self->hll, 16);
+    HyperLogLog_init(&self->hll, hll_precision);
+
+    if (buffer_size && Combiner_init(&self->buffer, buffer_size))
+    {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    if (doorkeeper)
+    {
+        if (doorkeeper > 0x100000000ULL)
+        {
+            char * msg = "The doorkeeper can have at most 2^32 bits!";
+            PyErr_SetString(PyExc_ValueError, msg);
+            return -1;
+        }
+        // round up to a power of 2 of at least 64 bits
+        uint64_t bits = 64;
+        while (bits < doorkeeper)
+            bits <<= 1;
+        self->doorkeeper_bits = bits;
+        self->doorkeeper_mask = bits - 1;
+        self->doorkeeper = (uint64_t *) calloc(bits >> 6, sizeof(uint64_t));
+        if (!self->doorkeeper)
+        {
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
 
     self->table = (CMS_CELL_TYPE **) malloc(self->depth * sizeof(CMS_CELL_TYPE *));
     int i;
@@ -92,18 +214,131 @@ CMS_VARIANT(_init)(CMS_TYPE *self, PyObject *args, PyObject *kwds)
 }
 
 static PyMemberDef CMS_VARIANT(_members[]) = {
+    {"width", T_UINT, offsetof(CMS_TYPE, width), READONLY, "Number of buckets in a row."},
+    {"depth", T_SHORT, offsetof(CMS_TYPE, depth), READONLY, "Number of rows."},
+    {"doorkeeper", T_ULONGLONG, offsetof(CMS_TYPE, doorkeeper_bits), READONLY, "Number of bits of the doorkeeper."},
     {NULL} /* Sentinel */
 };
 
 static inline int CMS_VARIANT(should_inc)(CMS_CELL_TYPE value);
 
+/* Conservative update of the cells a single key maps to, one cell per row. */
+static inline void
+CMS_VARIANT(_update_cells)(CMS_CELL_TYPE ** cells, short int depth, long long increment)
+{
+    CMS_CELL_TYPE min_value = -1;
+    int i;
+    for (i = 0; i < depth; i++)
+    {
+        if (*cells[i] < min_value)
+            min_value = *cells[i];
+    }
+
+    CMS_CELL_TYPE result = min_value;
+    for (; increment > 0; increment--)
+        result += CMS_VARIANT(should_inc)(result);
+
+    if (result > min_value)
+    {
+        for (i = 0; i < depth; i++)
+            if (*cells[i] < result)
+                *cells[i] = result;
+    }
+}
+
+/**
+  * Checks whether all doorkeeper bits of a key are set, setting them if `store` is true.
+  * Bit positions are derived from the hashes of the first two rows by double hashing.
+  */
+static inline int
+CMS_VARIANT(_doorkeeper_test)(CMS_TYPE *self, const uint32_t * hashes, const char *data, Py_ssize_t dataLength, char store)
+{
+    uint32_t second_hash;
+    if (self->depth > 1)
+        second_hash = hashes[1];
+    else
+        MurmurHash3_x86_32((void *) data, dataLength, 1, (void *) &second_hash);
+
+    // rotate, so that positions do not follow the table buckets taken from the low bits
+    uint32_t position = (hashes[0] >> 16) | (hashes[0] << 16);
+    uint32_t step = ((second_hash >> 16) | (second_hash << 16)) | 1;
+    int present = 1;
+    int i;
+    for (i = 0; i < CMS_DOORKEEPER_HASHES; i++, position += step)
+    {
+        uint32_t bit = position & self->doorkeeper_mask;
+        uint64_t mask = 1ULL << (bit & 63);
+        if (!(self->doorkeeper[bit >> 6] & mask))
+        {
+            present = 0;
+            if (!store)
+                break;
+            self->doorkeeper[bit >> 6] |= mask;
+        }
+    }
+    return present;
+}
+
+/* Applies an increment of a key whose hash for the first row is already known.
+ * The key is added to the HLL beforehand, with the GIL held, as adding may reallocate its sparse list. */
+static inline void
+CMS_VARIANT(_apply)(CMS_TYPE *self, uint32_t first_hash, const char *data, Py_ssize_t dataLength, long long increment)
+{
+    CMS_CELL_TYPE * cells[32];
+    uint32_t hashes[32];
+
+    hashes[0] = first_hash;
+
+    int i;
+    for (i = 1; i < self->depth; i++)
+        MurmurHash3_x86_32((void *) data, dataLength, i, (void *) &hashes[i]);
+
+    // the first occurrence of a key only marks it in the doorkeeper
+    if (self->doorkeeper && !CMS_VARIANT(_doorkeeper_test)(self, hashes, data, dataLength, 1))
+    {
+        if (!--increment)
+            return;
+    }
+
+    for (i = 0; i < self->depth; i++)
+        cells[i] = &self->table[i][hashes[i] & self->hash_mask];
+
+    CMS_VARIANT(_update_cells)(cells, self->depth, increment);
+}
+
+/* Applies all increments held by the pre-aggregation buffer. */
+static void
+CMS_VARIANT(_flush)(CMS_TYPE *self)
+{
+    if (!self->buffer.used)
+        return;
+
+    combiner_entry_t * entries = self->buffer.entries;
+    uint32_t i;
+    for (i = 0; i < self->buffer.size; i++)
+    {
+        if (entries[i].count)
+        {
+            CMS_VARIANT(_apply)(self, entries[i].hash, entries[i].key, entries[i].length, entries[i].count);
+            entries[i].count = 0;
+        }
+    }
+    self->buffer.used = 0;
+}
+
+/* Applies the buffered increments of a single key, so that looking it up does not flush the whole buffer. */
+static inline void
+CMS_VARIANT(_flush_key)(CMS_TYPE *self, uint32_t hash, const char *data, Py_ssize_t dataLength)
+{
+    combiner_entry_t taken;
+    if (Combiner_take(&self->buffer, hash, data, dataLength, &taken))
+        CMS_VARIANT(_apply)(self, taken.hash, taken.key, taken.length, taken.count);
+}
+
 static inline PyObject *
 CMS_VARIANT(_increment_obj)(CMS_TYPE *self, char *data, Py_ssize_t dataLength, long long increment)
 {
-    uint32_t buckets[32];
-    CMS_CELL_TYPE values[32];
     uint32_t hash;
-    CMS_CELL_TYPE min_value = -1;
 
     if (increment < 0)
     {
@@ -116,35 +351,23 @@ CMS_VARIANT(_increment_obj)(CMS_TYPE *self, char *data, Py_ssize_t dataLength, l
         Py_INCREF(Py_None);
         return Py_None;
     }
+    MurmurHash3_x86_32((void *) data, dataLength, 0, (void *) &hash);
+    if (cms_hll_add(&self->hll, hash, data, dataLength))
+        return PyErr_NoMemory();
+
     Py_BEGIN_ALLOW_THREADS
 
     self->total += increment;
 
-    int i;
-    for (i = 0; i < self->depth; i++)
+    if (self->buffer.entries && dataLength < COMBINER_KEY_SIZE)
     {
-        MurmurHash3_x86_32((void *) data, dataLength, i, (void *) &hash);
-        uint32_t bucket = hash & self->hash_mask;
-        buckets[i] = bucket;
-        CMS_CELL_TYPE value = self->table[i][bucket];
-        if (value < min_value)
-            min_value = value;
-        values[i] = self->table[i][bucket];
-
-        if (i == 0)
-            HyperLogLog_add(&self->hll, hash);
+        combiner_entry_t evicted;
+        if (Combiner_add(&self->buffer, hash, data, dataLength, increment, &evicted))
+            CMS_VARIANT(_apply)(self, evicted.hash, evicted.key, evicted.length, evicted.count);
     }
-
-    CMS_CELL_TYPE result = min_value;
-    for (; increment > 0; increment--)
-        result += CMS_VARIANT(should_inc)(result);
-
-    if (result > min_value)
+    else
     {
-        int i;
-        for (i = 0; i < self->depth; i++)
-            if (values[i] < result)
-                self->table[i][buckets[i]] = result;
+        CMS_VARIANT(_apply)(self, hash, data, dataLength, increment);
     }
 
     Py_END_ALLOW_THREADS
@@ -233,26 +456,39 @@ CMS_VARIANT(_getitem)(CMS_TYPE *self, PyObject *args)
     if (!data)
         return NULL;
 
-    uint32_t hash;
+    uint32_t hashes[32];
     CMS_CELL_TYPE min_value = -1;
     int i;
+    for (i = 0; i < self->depth; i++)
+        MurmurHash3_x86_32((void *) data, dataLength, i, (void *) &hashes[i]);
+
+    CMS_VARIANT(_flush_key)(self, hashes[0], data, dataLength);
     for (i = 0; i < self->depth; i++)
     {
-        MurmurHash3_x86_32((void *) data, dataLength, i, (void *) &hash);
-        uint32_t bucket = hash & self->hash_mask;
-        CMS_CELL_TYPE value = self->table[i][bucket];
+        CMS_CELL_TYPE value = self->table[i][hashes[i] & self->hash_mask];
         if (value < min_value)
             min_value = value;
     }
 
+    long long result = CMS_VARIANT(decode) (min_value);
+    if (self->doorkeeper)
+        result += CMS_VARIANT(_doorkeeper_test)(self, hashes, data, dataLength, 0);
+
     Py_XDECREF(free_after);
-    return Py_BuildValue("L", CMS_VARIANT(decode) (min_value));
+    return Py_BuildValue("L", result);
 }
 
 /* Retrieves estimate of the set cardinality */
 static PyObject *
 CMS_VARIANT(_cardinality)(CMS_TYPE *self, PyObject *args)
 {
+   if (!self->hll.k)
+   {
+       char * msg = "Cardinality is not tracked, the CMS was created with hll_precision=0.";
+       PyErr_SetString(PyExc_ValueError, msg);
+       return NULL;
+   }
+   CMS_VARIANT(_flush)(self);
    double cardinality = HyperLogLog_cardinality(&self->hll);
    return Py_BuildValue("L", (long long) cardinality);
 }
@@ -264,6 +500,91 @@ CMS_VARIANT(_total)(CMS_TYPE *self, PyObject *args)
    return Py_BuildValue("L", self->total);
 }
 
+/**
+  * Retrieves statistics of the table for monitoring its load. With `sample`, only about that many cells
+  * (rounded up to a power of 2) are examined in each row, spread evenly from a random offset.
+  */
+static PyObject *
+CMS_VARIANT(_stats)(CMS_TYPE *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"sample", NULL};
+    uint32_t sample = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &sample))
+        return NULL;
+
+    CMS_VARIANT(_flush)(self);
+
+    uint32_t step = 1;
+    while (sample && self->width / ((uint64_t) step << 1) >= sample)
+        step <<= 1;
+    uint32_t offset = rand_32b() & (step - 1);
+    uint32_t examined = self->width / step;
+
+    // histo[i] counts decoded values with bit length i, i.e. 0 in bucket 0 and [2^(i-1), 2^i) in bucket i
+    unsigned long long histo[65] = {0};
+    unsigned long long filled[32] = {0};
+    unsigned long long saturated = 0;
+    int i;
+
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < self->depth; i++)
+    {
+        const CMS_CELL_TYPE * row = self->table[i];
+        uint32_t j;
+        for (j = offset; j < self->width; j += step)
+        {
+            CMS_CELL_TYPE value = row[j];
+            if (!value)
+            {
+                histo[0]++;
+                continue;
+            }
+            filled[i]++;
+            saturated += value == (CMS_CELL_TYPE) -1;
+            unsigned long long decoded = (unsigned long long) CMS_VARIANT(decode)(value);
+            int bits = 0;
+            while (decoded)
+                bits++, decoded >>= 1;
+            histo[bits]++;
+        }
+    }
+    Py_END_ALLOW_THREADS
+
+    int histo_length = 65;
+    while (histo_length > 1 && !histo[histo_length - 1])
+        histo_length--;
+
+    PyObject *row_fill = PyList_New(self->depth);
+    PyObject *histogram = PyList_New(histo_length);
+    if (!row_fill || !histogram)
+    {
+        Py_XDECREF(row_fill);
+        Py_XDECREF(histogram);
+        return NULL;
+    }
+
+    // a key missing from the table is overestimated only when it hits a filled cell in every row
+    double collision_probability = 1;
+    for (i = 0; i < self->depth; i++)
+    {
+        double fill = (double) filled[i] / examined;
+        collision_probability *= fill;
+        PyList_SetItem(row_fill, i, PyFloat_FromDouble(fill));
+    }
+    for (i = 0; i < histo_length; i++)
+        PyList_SetItem(histogram, i, PyLong_FromUnsignedLongLong(histo[i]));
+
+    // the classic Count-min bound: overestimate within e * total / width with probability 1 - e^-depth
+    return Py_BuildValue("{s:N,s:N,s:d,s:d,s:d,s:d,s:I}",
+        "row_fill", row_fill,
+        "histogram", histogram,
+        "saturated", (double) saturated / ((double) examined * self->depth),
+        "collision_probability", collision_probability,
+        "error_bound", exp(1) * self->total / self->width,
+        "error_probability", exp(-self->depth),
+        "sampled", examined);
+}
+
 static inline CMS_CELL_TYPE CMS_VARIANT(_merge_value) (CMS_CELL_TYPE v1, CMS_CELL_TYPE v2, uint32_t merge_seed);
 
 /**
@@ -286,8 +607,24 @@ CMS_VARIANT(_merge)(CMS_TYPE *self, PyObject *args)
         PyErr_SetString(PyExc_ValueError, msg);
         return NULL;
     }
+    if (other->hll.k != self->hll.k)
+    {
+        char * msg = "CMS to merge must use the same HyperLogLog precision.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+    if (self->doorkeeper || other->doorkeeper)
+    {
+        // a key seen once by each sketch would only be remembered once by the merged doorkeeper
+        char * msg = "CMS with a doorkeeper can not be merged.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
 
     Py_BEGIN_ALLOW_THREADS
+    CMS_VARIANT(_flush)(self);
+    CMS_VARIANT(_flush)(other);
+
     uint32_t i,j;
     uint32_t merge_seed = rand_32b();
     for (i = 0; i < self->depth; i++)
@@ -301,9 +638,10 @@ CMS_VARIANT(_merge)(CMS_TYPE *self, PyObject *args)
     }
 
     self->total += other->total;
-    HyperLogLog_merge(&self->hll, &other->hll);
 
     Py_END_ALLOW_THREADS
+    if (HyperLogLog_merge(&self->hll, &other->hll))
+        return PyErr_NoMemory();
     Py_INCREF(Py_None);
     return Py_None;
 }
@@ -378,8 +716,11 @@ CMS_VARIANT(_update)(CMS_TYPE * self, PyObject *args)
 static PyObject *
 CMS_VARIANT(_reduce)(CMS_TYPE *self)
 {
-    PyObject *args = Py_BuildValue("(II)", self->width, self->depth);
-    PyObject *state_table = PyList_New(self->depth + 2);
+    CMS_VARIANT(_flush)(self);
+
+    PyObject *args = Py_BuildValue("(IIIKi)", self->width, self->depth, self->buffer.size, self->doorkeeper_bits,
+        (int) self->hll.k);
+    PyObject *state_table = PyList_New(self->depth + (self->doorkeeper ? 3 : 2));
     int i;
     for (i = 0; i < self->depth; i++)
     {
@@ -388,11 +729,18 @@ CMS_VARIANT(_reduce)(CMS_TYPE *self)
             return NULL;
         PyList_SetItem(state_table, i, row);
     }
-    PyObject *hll = PyByteArray_FromStringAndSize(self->hll.registers, self->hll.size);
+    PyObject *hll = cms_hll_state(&self->hll);
     if (!hll)
         return NULL;
     PyList_SetItem(state_table, self->depth, hll);
     PyList_SetItem(state_table, self->depth + 1, Py_BuildValue("i", self->total));
+    if (self->doorkeeper)
+    {
+        PyObject *doorkeeper = PyByteArray_FromStringAndSize((char *) self->doorkeeper, self->doorkeeper_bits >> 3);
+        if (!doorkeeper)
+            return NULL;
+        PyList_SetItem(state_table, self->depth + 2, doorkeeper);
+    }
     return Py_BuildValue("(OOO)", Py_TYPE(self), args, state_table);
 }
 
@@ -407,7 +755,6 @@ CMS_VARIANT(_set_state)(CMS_TYPE * self, PyObject * state)
 
     Py_ssize_t rowlen = self->width * sizeof(CMS_CELL_TYPE);
     CMS_CELL_TYPE *row_buffer;
-    hll_cell_t *hll_buffer;
 
     int i;
     for (i = 0; i < self->depth; i++)
@@ -420,17 +767,154 @@ CMS_VARIANT(_set_state)(CMS_TYPE * self, PyObject * state)
     }
 
     PyObject *row = PyList_GetItem(state_table, self->depth);
-    hll_buffer = PyByteArray_AsString(row);
-    if (!hll_buffer)
+    if (!row || cms_hll_set_state(&self->hll, row))
         return NULL;
-    memcpy(self->hll.registers, hll_buffer, self->hll.size);
 
     self->total = PyLong_AsLongLong(PyList_GetItem(state_table, self->depth + 1));
 
+    if (self->doorkeeper)
+    {
+        PyObject *item = PyList_GetItem(state_table, self->depth + 2);
+        if (!item)
+            return NULL;
+        char * doorkeeper = PyByteArray_AsString(item);
+        if (!doorkeeper)
+            return NULL;
+        memcpy(self->doorkeeper, doorkeeper, self->doorkeeper_bits >> 3);
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/**
+  * Resets the sketch to its initial empty state, keeping its dimensions. Table pages are released to the OS
+  * rather than rewritten, so clearing a large table costs no more than the pages touched since.
+  */
+static PyObject *
+CMS_VARIANT(_clear)(CMS_TYPE *self)
+{
+    size_t row_size = (size_t) self->width * sizeof(CMS_CELL_TYPE);
+    int i;
+
+    #ifndef _WIN32
+    if (self->mapping)
+    {
+        // releasing pages of a private file mapping would restore the file content, use fresh zeroed rows instead
+        CMS_CELL_TYPE * rows[32];
+        for (i = 0; i < self->depth; i++)
+        {
+            rows[i] = (CMS_CELL_TYPE *) calloc(self->width, sizeof(CMS_CELL_TYPE));
+            if (!rows[i])
+            {
+                while (i--)
+                    free(rows[i]);
+                return PyErr_NoMemory();
+            }
+        }
+        memcpy(self->table, rows, self->depth * sizeof(CMS_CELL_TYPE *));
+        munmap(self->mapping, self->mapping_size);
+        self->mapping = NULL;
+        self->mapping_size = 0;
+    }
+    else
+    #endif
+    {
+        for (i = 0; i < self->depth; i++)
+            pages_zero(self->table[i], row_size);
+    }
+
+    if (self->doorkeeper)
+        pages_zero(self->doorkeeper, self->doorkeeper_bits >> 3);
+    HyperLogLog_clear(&self->hll);
+    Combiner_clear(&self->buffer);
+    self->total = 0;
+
     Py_INCREF(Py_None);
     return Py_None;
 }
 
+/**
+  * Replaces the table and state with the content of a sketch file, whose header was already read and validated
+  * against this instance. The table is mapped into memory copy-on-write where supported.
+  * Returns 0 when successful, -1 with an exception set otherwise.
+  */
+static int
+CMS_VARIANT(_load_file)(CMS_TYPE *self, FILE * file, const cms_file_header_t * header)
+{
+    size_t row_size = (size_t) self->width * sizeof(CMS_CELL_TYPE);
+    long long table_offset = cms_file_table_offset(header);
+    int i;
+
+    if (header->hll_size != self->hll.size)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid or truncated sketch file!");
+        return -1;
+    }
+
+    // files store plain registers, none when cardinality is not tracked
+    char * registers = (char *) malloc(self->hll.size + 1);
+    if (!registers)
+    {
+        PyErr_NoMemory();
+        return -1;
+    }
+    int failed = fseek(file, CMS_FILE_ALIGN, SEEK_SET)
+        || fread(registers, 1, self->hll.size, file) != self->hll.size
+        || HyperLogLog_deserialize(&self->hll, registers, self->hll.size);
+    free(registers);
+    if (failed)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid or truncated sketch file!");
+        return -1;
+    }
+
+    #ifndef _WIN32
+    struct stat file_stat;
+    size_t mapping_size = table_offset + row_size * self->depth;
+    if (fstat(fileno(file), &file_stat) || (size_t) file_stat.st_size < mapping_size)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid or truncated sketch file!");
+        return -1;
+    }
+
+    char * mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(file), 0);
+    if (mapping == MAP_FAILED)
+    {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+
+    for (i = 0; i < self->depth; i++)
+    {
+        if (!self->mapping)
+            free(self->table[i]);
+        self->table[i] = (CMS_CELL_TYPE *) (mapping + table_offset + row_size * i);
+    }
+    if (self->mapping)
+        munmap(self->mapping, self->mapping_size);
+    self->mapping = mapping;
+    self->mapping_size = mapping_size;
+    #else
+    if (fseek(file, (long) table_offset, SEEK_SET))
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid or truncated sketch file!");
+        return -1;
+    }
+    for (i = 0; i < self->depth; i++)
+    {
+        if (fread(self->table[i], 1, row_size, file) != row_size)
+        {
+            PyErr_SetString(PyExc_ValueError, "Invalid or truncated sketch file!");
+            return -1;
+        }
+    }
+    #endif
+
+    self->total = header->total;
+    return 0;
+}
+
 static PyMethodDef CMS_VARIANT(_methods)[] = {
     {"increment", (PyCFunction)CMS_VARIANT(_increment), METH_VARARGS,
      "Increase counter by one."
@@ -447,6 +931,12 @@ static PyMethodDef CMS_VARIANT(_methods)[] = {
     {"merge", (PyCFunction)CMS_VARIANT(_merge), METH_VARARGS,
     "Merges another CMS instance into this one."
     },
+    {"stats", (PyCFunction)CMS_VARIANT(_stats), METH_VARARGS | METH_KEYWORDS,
+    "Retrieves fill, value distribution and error statistics of the table."
+    },
+    {"clear", (PyCFunction)CMS_VARIANT(_clear), METH_NOARGS,
+    "Resets all counters to zero."
+    },
     {"update", (PyCFunction)CMS_VARIANT(_update), METH_VARARGS,
     "Updates this CMS with values from another CMS, iterable, or dictionary."
     },
@@ -504,3 +994,5 @@ static PyTypeObject CMS_VARIANT(Type) = {
     0,                               /* tp_alloc */
     CMS_VARIANT(_new),                 /* tp_new */
 };
+
+#include "cms_ring.c"
@@ -0,0 +1,138 @@
+//-----------------------------------------------------------------------------
+// Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+// Copyright (C) 2017 Rare Technologies
+//
+// This code is distributed under the terms and conditions
+// from the MIT License (MIT).
+//
+// Conversion of a sketch into a narrower counter encoding, rounding every cell like merge does.
+// Included from cms_cmodule.c for every pair of CONVERT_SOURCE and CONVERT_TARGET types.
+
+#define CONVERT_VARIANT(suffix) GLUE_I(GLUE_I(CONVERT_SOURCE, GLUE_I(_to_, CONVERT_TARGET)), suffix)
+
+/* Converts one row of the source into the buffer of its job. */
+static void
+CONVERT_VARIANT(_row)(void * context, uint32_t index)
+{
+    cms_convert_job_t * job = (cms_convert_job_t *) context;
+    CONVERT_SOURCE * source = (CONVERT_SOURCE *) job->source;
+    uint32_t row = job->first_row + index;
+    CONVERT_SOURCE_CELL * source_row = source->table[row];
+    CONVERT_TARGET_CELL * target_row = (CONVERT_TARGET_CELL *) job->rows[index];
+    uint32_t seed = job->seed ^ (row * 0x9E3779B9);
+
+    uint32_t j;
+    for (j = 0; j < source->width; j++)
+    {
+        long long value = GLUE_I(CONVERT_SOURCE, decode)(source_row[j]);
+        target_row[j] = GLUE_I(CONVERT_TARGET, _encode)(value, seed ^ j);
+    }
+}
+
+/* Converts the source into a new sketch, or into a sketch file when path is given. */
+static PyObject *
+CONVERT_VARIANT()(CONVERT_SOURCE * source, const char * path, uint32_t threads)
+{
+    cms_convert_job_t job = {source, NULL, 0, rand_32b()};
+    GLUE_I(CONVERT_SOURCE, _flush)(source);
+
+    if (!path)
+    {
+        CONVERT_TARGET * target = (CONVERT_TARGET *) PyObject_CallFunction(
+            (PyObject *) &GLUE_I(CONVERT_TARGET, Type), "IIIKi", source->width, source->depth, 0, source->doorkeeper_bits,
+            (int) source->hll.k);
+        if (!target)
+            return NULL;
+        if (source->doorkeeper)
+            memcpy(target->doorkeeper, source->doorkeeper, source->doorkeeper_bits >> 3);
+
+        job.rows = (void **) target->table;
+        Py_BEGIN_ALLOW_THREADS
+        parallel_for(threads, source->depth, CONVERT_VARIANT(_row), &job);
+        Py_END_ALLOW_THREADS
+
+        target->total = source->total;
+        if (HyperLogLog_merge(&target->hll, &source->hll))
+        {
+            Py_DECREF(target);
+            return PyErr_NoMemory();
+        }
+        return (PyObject *) target;
+    }
+
+    if (source->doorkeeper)
+    {
+        char * msg = "CMS with a doorkeeper can not be converted to a file.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+
+    // the file is written in batches of one row per thread
+    size_t row_size = (size_t) source->width * sizeof(CONVERT_TARGET_CELL);
+    uint32_t batch = threads < (uint32_t) source->depth ? threads : (uint32_t) source->depth;
+    cms_file_header_t header = {CMS_FILE_MAGIC, sizeof(CONVERT_TARGET_CELL), source->depth, source->width,
+                                source->hll.size, source->total};
+    int failed = 0;
+
+    job.rows = (void **) calloc(batch, sizeof(void *));
+    FILE * file = job.rows ? fopen(path, "wb") : NULL;
+    if (!file)
+    {
+        free(job.rows);
+        if (job.rows)
+            return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return PyErr_NoMemory();
+    }
+
+    // files store plain registers, none when cardinality is not tracked; they are read with the GIL held
+    hll_cell_t * registers = (hll_cell_t *) malloc(source->hll.size + 1);
+    failed = !registers;
+    if (registers)
+        HyperLogLog_registers(&source->hll, registers);
+
+    Py_BEGIN_ALLOW_THREADS
+    uint32_t i;
+    for (i = 0; i < batch && !failed; i++)
+    {
+        job.rows[i] = malloc(row_size);
+        failed = !job.rows[i];
+    }
+
+    char padding[CMS_FILE_ALIGN] = {0};
+    long long table_offset = cms_file_table_offset(&header);
+    failed = failed
+        || fwrite(&header, sizeof(header), 1, file) != 1
+        || fwrite(padding, CMS_FILE_ALIGN - sizeof(header), 1, file) != 1
+        || fwrite(registers, 1, source->hll.size, file) != source->hll.size
+        || fwrite(padding, 1, table_offset - CMS_FILE_ALIGN - source->hll.size, file)
+            != (size_t) (table_offset - CMS_FILE_ALIGN - source->hll.size);
+
+    for (job.first_row = 0; job.first_row < (uint32_t) source->depth && !failed; job.first_row += batch)
+    {
+        uint32_t rows = source->depth - job.first_row;
+        if (rows > batch)
+            rows = batch;
+        parallel_for(threads, rows, CONVERT_VARIANT(_row), &job);
+        for (i = 0; i < rows && !failed; i++)
+            failed = fwrite(job.rows[i], 1, row_size, file) != row_size;
+    }
+    failed = fclose(file) || failed;
+
+    for (i = 0; i < batch; i++)
+        free(job.rows[i]);
+    free(job.rows);
+    free(registers);
+    Py_END_ALLOW_THREADS
+
+    if (failed)
+        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+#undef CONVERT_VARIANT
+#undef CONVERT_SOURCE
+#undef CONVERT_SOURCE_CELL
+#undef CONVERT_TARGET
+#undef CONVERT_TARGET_CELL
@@ -0,0 +1,480 @@
+//-----------------------------------------------------------------------------
+// Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+// Copyright (C) 2017 Rare Technologies
+//
+// This code is distributed under the terms and conditions
+// from the MIT License (MIT).
+//
+// Standalone HyperLogLog cardinality estimator. Keys are hashed the same way as by the CMS, so that registers
+// are interchangeable with those of a sketch. Included from cms_cmodule.c.
+
+typedef struct {
+    PyObject_HEAD
+    HyperLogLog hll;
+    long long total;
+} CMS_HyperLogLog;
+
+static PyTypeObject CMS_HyperLogLogType;
+
+/* Destructor invoked by python. */
+static void
+CMS_HyperLogLog_dealloc(CMS_HyperLogLog * self)
+{
+    HyperLogLog_dealloc(&self->hll);
+
+    #if PY_MAJOR_VERSION >= 3
+    Py_TYPE(self)->tp_free((PyObject*) self);
+    #else
+    self->ob_type->tp_free((PyObject*) self);
+    #endif
+}
+
+static PyObject *
+CMS_HyperLogLog_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    CMS_HyperLogLog *self;
+    self = (CMS_HyperLogLog *)type->tp_alloc(type, 0);
+    return (PyObject *)self;
+}
+
+static int
+CMS_HyperLogLog_init(CMS_HyperLogLog *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"precision", NULL};
+    int precision = HLL_DEFAULT_PRECISION;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i", kwlist, &precision))
+        return -1;
+
+    if (precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION)
+    {
+        char * msg = "HyperLogLog precision must be in the range 4-18";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
+
+    HyperLogLog_dealloc(&self->hll);
+    HyperLogLog_init(&self->hll, precision);
+    self->total = 0;
+    return 0;
+}
+
+static PyMemberDef CMS_HyperLogLog_members[] = {
+    {"precision", T_SHORT, offsetof(CMS_HyperLogLog, hll.k), READONLY, "Number of index bits of the registers"},
+    {NULL} /* Sentinel */
+};
+
+/* Adds a key to the registers, returns 1 when out of memory and 0 otherwise. */
+static inline int
+CMS_HyperLogLog_add_key(HyperLogLog * hll, const char * data, Py_ssize_t dataLength)
+{
+    uint32_t hash;
+    MurmurHash3_x86_32((void *) data, dataLength, 0, (void *) &hash);
+    return cms_hll_add(hll, hash, data, dataLength);
+}
+
+/* Adds an element to the estimator. The optional count only contributes to the total. */
+static PyObject *
+CMS_HyperLogLog_add(CMS_HyperLogLog *self, PyObject *args)
+{
+    PyObject * pkey;
+    PyObject * free_after = NULL;
+    Py_ssize_t dataLength = 0;
+    long long count = 1;
+
+    if (!PyArg_ParseTuple(args, "O|L", &pkey, &count))
+        return NULL;
+    if (count < 0)
+    {
+        char * msg = "Increment must be positive!.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+    char * data = CMS_Conservative_parse_key(pkey, &dataLength, &free_after);
+    if (!data)
+        return NULL;
+
+    if (count > 0)
+    {
+        if (CMS_HyperLogLog_add_key(&self->hll, data, dataLength))
+        {
+            Py_XDECREF(free_after);
+            return PyErr_NoMemory();
+        }
+        self->total += count;
+    }
+
+    Py_XDECREF(free_after);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Adds every item of a contiguous buffer, each itemsize bytes long. */
+static PyObject *
+CMS_HyperLogLog_add_buffer(CMS_HyperLogLog *self, PyObject *arg)
+{
+    Py_buffer view;
+    if (PyObject_GetBuffer(arg, &view, PyBUF_C_CONTIGUOUS))
+        return NULL;
+
+    const char * data = (const char *) view.buf;
+    Py_ssize_t itemsize = view.itemsize > 0 ? view.itemsize : 1;
+    Py_ssize_t items = view.len / itemsize;
+    Py_ssize_t i;
+
+    for (i = 0; i < items; i++)
+        if (CMS_HyperLogLog_add_key(&self->hll, data + i * itemsize, itemsize))
+            break;
+
+    // the items added before running out of memory stay counted
+    self->total += i;
+    PyBuffer_Release(&view);
+    if (i < items)
+        return PyErr_NoMemory();
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/**
+  * Parses an item of an iterable passed to add_many: a key or a (key, count) tuple.
+  * The item is replaced by the object which keeps the key alive. Returns 0 when successful, -1 otherwise.
+  */
+static inline int
+CMS_HyperLogLog_parse_item(PyObject ** item, const char ** key, Py_ssize_t * dataLength, long long * increment)
+{
+    PyObject * pkey = *item;
+    PyObject * free_after = NULL;
+    if (PyTuple_Check(*item) && !PyArg_ParseTuple(*item, "O|L", &pkey, increment))
+        return -1;
+    if (*increment < 0)
+    {
+        char * msg = "Increment must be positive!.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
+    *key = CMS_Conservative_parse_key(pkey, dataLength, &free_after);
+    if (!*key)
+        return -1;
+    // Python 2 unicode keys are encoded into a new object
+    if (free_after)
+    {
+        Py_DECREF(*item);
+        *item = free_after;
+    }
+    return 0;
+}
+
+/**
+  * Adds all elements of an iterable (or the keys of (key, count) tuples and dictionary items), or all items
+  * of a buffer such as an array. The GIL is held throughout, as adding may reallocate the sparse list.
+  */
+static PyObject *
+CMS_HyperLogLog_add_many(CMS_HyperLogLog *self, PyObject *args)
+{
+    PyObject * arg;
+    PyObject * should_dealloc = NULL;
+
+    if (!PyArg_ParseTuple(args, "O", &arg))
+        return NULL;
+
+    if (!PyDict_Check(arg) && PyObject_CheckBuffer(arg))
+        return CMS_HyperLogLog_add_buffer(self, arg);
+
+    if (PyDict_Check(arg))
+    {
+        arg = PyDict_Items(arg);
+        if (!arg)
+            return NULL;
+        should_dealloc = arg;
+    }
+    PyObject * iterator = PyObject_GetIter(arg);
+    Py_XDECREF(should_dealloc);
+    if (!iterator)
+    {
+        char * msg = "Unsupported argument type!";
+        PyErr_SetString(PyExc_TypeError, msg);
+        return NULL;
+    }
+
+    PyObject * item;
+    while ((item = PyIter_Next(iterator)))
+    {
+        const char * key;
+        Py_ssize_t dataLength;
+        long long increment = 1;
+        if (CMS_HyperLogLog_parse_item(&item, &key, &dataLength, &increment))
+        {
+            Py_DECREF(item);
+            break;
+        }
+        if (increment)
+        {
+            if (CMS_HyperLogLog_add_key(&self->hll, key, dataLength))
+            {
+                Py_DECREF(item);
+                PyErr_NoMemory();
+                break;
+            }
+            self->total += increment;
+        }
+        Py_DECREF(item);
+    }
+    Py_DECREF(iterator);
+
+    if (PyErr_Occurred())
+        return NULL;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Merges another estimator of the same precision into this one. */
+static PyObject *
+CMS_HyperLogLog_merge(CMS_HyperLogLog *self, PyObject *args)
+{
+    CMS_HyperLogLog *other;
+    if (!PyArg_ParseTuple(args, "O!", &CMS_HyperLogLogType, &other))
+    {
+        char * msg = "Object to merge must be a HyperLogLog.";
+        PyErr_SetString(PyExc_TypeError, msg);
+        return NULL;
+    }
+    if (other->hll.k != self->hll.k)
+    {
+        char * msg = "HyperLogLog to merge must use the same precision.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+
+    if (HyperLogLog_merge(&self->hll, &other->hll))
+        return PyErr_NoMemory();
+    self->total += other->total;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/**
+  * Collects the estimators of a sequence of HyperLogLog objects, which must all have the same precision.
+  * The sequence is returned in `fast`, keeping the estimators alive until it is released.
+  * Returns a new array, or NULL with an exception set.
+  */
+static HyperLogLog **
+CMS_HyperLogLog_collect(PyObject * sequence, PyObject ** fast, Py_ssize_t * count)
+{
+    *fast = PySequence_Fast(sequence, "Expected a sequence of HyperLogLog objects.");
+    if (!*fast)
+        return NULL;
+    *count = PySequence_Fast_GET_SIZE(*fast);
+    HyperLogLog ** hlls = (HyperLogLog **) malloc((*count ? *count : 1) * sizeof(HyperLogLog *));
+    if (!hlls)
+    {
+        Py_CLEAR(*fast);
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    Py_ssize_t i;
+    for (i = 0; i < *count; i++)
+    {
+        PyObject * item = PySequence_Fast_GET_ITEM(*fast, i);
+        if (!PyObject_TypeCheck(item, &CMS_HyperLogLogType))
+            PyErr_SetString(PyExc_TypeError, "Expected a sequence of HyperLogLog objects.");
+        else if (i && ((CMS_HyperLogLog *) item)->hll.k != hlls[0]->k)
+            PyErr_SetString(PyExc_ValueError, "HyperLogLogs to combine must use the same precision.");
+        else
+        {
+            hlls[i] = &((CMS_HyperLogLog *) item)->hll;
+            continue;
+        }
+        free(hlls);
+        Py_CLEAR(*fast);
+        return NULL;
+    }
+    return hlls;
+}
+
+/* Merges a sequence of estimators of the same precision into this one, streaming all of them in a single pass. */
+static PyObject *
+CMS_HyperLogLog_merge_many(CMS_HyperLogLog *self, PyObject *args)
+{
+    PyObject * sequence;
+    PyObject * fast;
+    Py_ssize_t count;
+
+    if (!PyArg_ParseTuple(args, "O", &sequence))
+        return NULL;
+    HyperLogLog ** hlls = CMS_HyperLogLog_collect(sequence, &fast, &count);
+    if (!hlls)
+        return NULL;
+    if (count && hlls[0]->k != self->hll.k)
+    {
+        char * msg = "HyperLogLog to merge must use the same precision.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        free(hlls);
+        Py_DECREF(fast);
+        return NULL;
+    }
+
+    int failed = HyperLogLog_merge_many(&self->hll, hlls, count);
+    Py_ssize_t i;
+    for (i = 0; i < count && !failed; i++)
+        self->total += ((CMS_HyperLogLog *) PySequence_Fast_GET_ITEM(fast, i))->total;
+    free(hlls);
+    Py_DECREF(fast);
+
+    if (failed)
+        return PyErr_NoMemory();
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Estimates the cardinality of the union of a sequence of estimators without merging them. */
+static PyObject *
+cmsc_union_cardinality(PyObject *module, PyObject *args)
+{
+    PyObject * sequence;
+    PyObject * fast;
+    Py_ssize_t count;
+
+    if (!PyArg_ParseTuple(args, "O", &sequence))
+        return NULL;
+    HyperLogLog ** hlls = CMS_HyperLogLog_collect(sequence, &fast, &count);
+    if (!hlls)
+        return NULL;
+
+    double cardinality = HyperLogLog_union_cardinality(hlls, count);
+    free(hlls);
+    Py_DECREF(fast);
+
+    if (cardinality < 0)
+        return PyErr_NoMemory();
+    return Py_BuildValue("L", (long long) cardinality);
+}
+
+/* Retrieves estimate of the set cardinality */
+static PyObject *
+CMS_HyperLogLog_cardinality(CMS_HyperLogLog *self)
+{
+    double cardinality = HyperLogLog_cardinality(&self->hll);
+    return Py_BuildValue("L", (long long) cardinality);
+}
+
+/* Retrieves the total number of added elements, including repeats */
+static PyObject *
+CMS_HyperLogLog_total(CMS_HyperLogLog *self)
+{
+    return Py_BuildValue("L", self->total);
+}
+
+static PyObject *
+CMS_HyperLogLog_clear(CMS_HyperLogLog *self)
+{
+    HyperLogLog_clear(&self->hll);
+    self->total = 0;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Serialization function for pickling. The state is the compact serialized form of the registers. */
+static PyObject *
+CMS_HyperLogLog_reduce(CMS_HyperLogLog *self)
+{
+    PyObject *hll = cms_hll_state(&self->hll);
+    if (!hll)
+        return NULL;
+    return Py_BuildValue("(O(i)(NL))", Py_TYPE(self), (int) self->hll.k, hll, self->total);
+}
+
+/* De-serialization function for pickling. */
+static PyObject *
+CMS_HyperLogLog_set_state(CMS_HyperLogLog * self, PyObject * args)
+{
+    PyObject * hll;
+    long long total;
+
+    if (!PyArg_ParseTuple(args, "(OL):setstate", &hll, &total))
+        return NULL;
+    if (cms_hll_set_state(&self->hll, hll))
+        return NULL;
+    self->total = total;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyMethodDef CMS_HyperLogLog_methods[] = {
+    {"add", (PyCFunction)CMS_HyperLogLog_add, METH_VARARGS,
+     "Adds an element, optionally with a count contributing to the total."
+    },
+    {"add_many", (PyCFunction)CMS_HyperLogLog_add_many, METH_VARARGS,
+     "Adds all elements of an iterable, or all items of a buffer such as an array."
+    },
+    {"merge", (PyCFunction)CMS_HyperLogLog_merge, METH_VARARGS,
+     "Merges another HyperLogLog of the same precision into this one."
+    },
+    {"merge_many", (PyCFunction)CMS_HyperLogLog_merge_many, METH_VARARGS,
+     "Merges a sequence of HyperLogLogs of the same precision into this one in a single pass."
+    },
+    {"cardinality", (PyCFunction)CMS_HyperLogLog_cardinality, METH_NOARGS,
+     "Retrieves estimate of the set cardinality."
+    },
+    {"total", (PyCFunction)CMS_HyperLogLog_total, METH_NOARGS,
+     "Retrieves the total number of added elements."
+    },
+    {"clear", (PyCFunction)CMS_HyperLogLog_clear, METH_NOARGS,
+     "Resets the estimator to its initial empty state."
+    },
+    {"__reduce__", (PyCFunction)CMS_HyperLogLog_reduce, METH_NOARGS,
+     "Serialization function for pickling."
+    },
+    {"__setstate__", (PyCFunction)CMS_HyperLogLog_set_state, METH_VARARGS,
+    "De-serialization function for pickling."
+    },
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject CMS_HyperLogLogType = {
+    #if PY_MAJOR_VERSION >= 3
+    PyVarObject_HEAD_INIT(NULL, 0)
+    #else
+    PyObject_HEAD_INIT(NULL)
+    0,                               /* ob_size */
+    #endif
+    "bounter_cmsc.HyperLogLog",      /* tp_name */
+    sizeof(CMS_HyperLogLog),         /* tp_basicsize */
+    0,                               /* tp_itemsize */
+    (destructor)CMS_HyperLogLog_dealloc, /* tp_dealloc */
+    0,                               /* tp_print */
+    0,                               /* tp_getattr */
+    0,                               /* tp_setattr */
+    0,                               /* tp_compare */
+    0,                               /* tp_repr */
+    0,                               /* tp_as_number */
+    0,                               /* tp_as_sequence */
+    0,                               /* tp_as_mapping */
+    0,                               /* tp_hash */
+    0,                               /* tp_call */
+    0,                               /* tp_str */
+    0,                               /* tp_getattro */
+    0,                               /* tp_setattro */
+    0,                               /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,              /* tp_flags */
+    "HyperLogLog object",            /* tp_doc */
+    0,		                     /* tp_traverse */
+    0,		                     /* tp_clear */
+    0,		                     /* tp_richcompare */
+    0,		                     /* tp_weaklistoffset */
+    0,		                     /* tp_iter */
+    0,		                     /* tp_iternext */
+    CMS_HyperLogLog_methods,         /* tp_methods */
+    CMS_HyperLogLog_members,         /* tp_members */
+    0,                               /* tp_getset */
+    0,                               /* tp_base */
+    0,                               /* tp_dict */
+    0,                               /* tp_descr_get */
+    0,                               /* tp_descr_set */
+    0,                               /* tp_dictoffset */
+    (initproc)CMS_HyperLogLog_init,  /* tp_init */
+    0,                               /* tp_alloc */
+    CMS_HyperLogLog_new,             /* tp_new */
+};
@@ -30,11 +30,9 @@ static inline long long CMS_VARIANT(decode)(CMS_CELL_TYPE value)
         return (1024 + (value & 1023)) << ((value >> 10) - 1);
 }
 
-static inline CMS_CELL_TYPE CMS_VARIANT(_merge_value) (CMS_CELL_TYPE v1, CMS_CELL_TYPE v2, uint32_t merge_seed)
+/* Encodes an exact value, rounding it randomly to one of the two closest representable values. */
+static inline CMS_CELL_TYPE CMS_VARIANT(_encode) (long long decoded, uint32_t seed)
 {
-    long long decoded = CMS_VARIANT(decode)(v1);
-    decoded += CMS_VARIANT(decode)(v2);
-
     if (decoded <= 2048)
         return decoded;
 
@@ -55,8 +53,13 @@ static inline CMS_CELL_TYPE CMS_VARIANT(_merge_value) (CMS_CELL_TYPE v1, CMS_CEL
     uint32_t mask = 0xFFFFFFFF >> shift;
 
     uint32_t r;
-    MurmurHash3_x86_32  ((void *) &decoded, 8, merge_seed, (void *) &r);
+    MurmurHash3_x86_32  ((void *) &decoded, 8, seed, (void *) &r);
     uint32_t remainder = mask & decoded;
 
     return (log_result << 10) + (h & 1023) + ((mask & r) < remainder);
 }
+
+static inline CMS_CELL_TYPE CMS_VARIANT(_merge_value) (CMS_CELL_TYPE v1, CMS_CELL_TYPE v2, uint32_t merge_seed)
+{
+    return CMS_VARIANT(_encode)(CMS_VARIANT(decode)(v1) + CMS_VARIANT(decode)(v2), merge_seed);
+}
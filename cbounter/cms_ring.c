@@ -0,0 +1,469 @@
+//-----------------------------------------------------------------------------
+// Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+// Copyright (C) 2017 Rare Technologies
+//
+// This code is distributed under the terms and conditions
+// from the MIT License (MIT).
+//
+// Ring of Count-min Sketch tables, one per time bucket ("slot"), sharing width, depth and hash functions.
+// Included from cms_common.c for every cell type.
+
+#define CMS_RING(suffix) CMS_VARIANT(GLUE(_Ring, suffix))
+
+#include "pages.h"
+
+typedef struct {
+    PyObject_HEAD
+    short int depth;
+    uint32_t width;
+    uint32_t hash_mask;
+    uint32_t slots;
+    uint32_t head; // slot receiving increments
+    long long * totals;
+    CMS_CELL_TYPE ** table; // one depth * width block per slot, rows stored one after another
+    HyperLogLog * hll; // one per slot
+} CMS_VARIANT(_Ring);
+
+/* Destructor invoked by python. */
+static void
+CMS_RING(_dealloc)(CMS_VARIANT(_Ring) * self)
+{
+    uint32_t i;
+    if (self->table)
+    {
+        for (i = 0; i < self->slots; i++)
+            free(self->table[i]);
+    }
+    if (self->hll)
+    {
+        for (i = 0; i < self->slots; i++)
+            HyperLogLog_dealloc(&self->hll[i]);
+    }
+    free(self->table);
+    free(self->hll);
+    free(self->totals);
+
+    #if PY_MAJOR_VERSION >= 3
+    Py_TYPE(self)->tp_free((PyObject*) self);
+    #else
+    self->ob_type->tp_free((PyObject*) self);
+    #endif
+}
+
+static PyObject *
+CMS_RING(_new)(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    CMS_VARIANT(_Ring) *self;
+    self = (CMS_VARIANT(_Ring) *)type->tp_alloc(type, 0);
+    return (PyObject *)self;
+}
+
+static int
+CMS_RING(_init)(CMS_VARIANT(_Ring) *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"width", "depth", "slots", NULL};
+
+    uint32_t w;
+    uint32_t slots;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "III", kwlist,
+                      &w, &self->depth, &slots)) {
+        return -1;
+    }
+
+    if (self->depth < 1 || self->depth > 32)
+    {
+        char * msg = "Depth must be in the range 1-32";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
+    if (slots < 1)
+    {
+        char * msg = "The ring must have at least one slot";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
+
+    short int hash_length = -1;
+    while (0 != w)
+        hash_length++, w >>= 1;
+    if (hash_length < 0)
+        hash_length = 0;
+    self->width = 1 << hash_length;
+    self->hash_mask = self->width - 1;
+    self->head = 0;
+
+    self->table = (CMS_CELL_TYPE **) calloc(slots, sizeof(CMS_CELL_TYPE *));
+    self->hll = (HyperLogLog *) calloc(slots, sizeof(HyperLogLog));
+    self->totals = (long long *) calloc(slots, sizeof(long long));
+    if (!self->table || !self->hll || !self->totals)
+    {
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->slots = slots;
+
+    uint32_t i;
+    for (i = 0; i < slots; i++)
+    {
+        self->table[i] = (CMS_CELL_TYPE *) calloc((size_t) self->depth * self->width, sizeof(CMS_CELL_TYPE));
+        if (!self->table[i])
+        {
+            char * msg = "Unable to allocate a table with requested size!";
+            PyErr_SetString(PyExc_MemoryError, msg);
+            return -1;
+        }
+        HyperLogLog_init(&self->hll[i], HLL_DEFAULT_PRECISION);
+    }
+    return 0;
+}
+
+static PyMemberDef CMS_RING(_members[]) = {
+    {NULL} /* Sentinel */
+};
+
+/* Computes the offset of the key within a slot for each row. The offsets are the same for all slots. */
+static inline uint32_t
+CMS_RING(_offsets)(CMS_VARIANT(_Ring) *self, char *data, Py_ssize_t dataLength, size_t * offsets)
+{
+    uint32_t hash;
+    uint32_t first_hash = 0;
+    int i;
+    for (i = 0; i < self->depth; i++)
+    {
+        MurmurHash3_x86_32((void *) data, dataLength, i, (void *) &hash);
+        offsets[i] = (size_t) i * self->width + (hash & self->hash_mask);
+        if (i == 0)
+            first_hash = hash;
+    }
+    return first_hash;
+}
+
+/* Parses the optional number of most recent slots to aggregate; all slots by default. */
+static inline int
+CMS_RING(_parse_last)(CMS_VARIANT(_Ring) *self, PyObject * plast, uint32_t * last)
+{
+    *last = self->slots;
+    if (plast && plast != Py_None)
+    {
+        long value = PyLong_AsLong(plast);
+        if (value == -1 && PyErr_Occurred())
+            return -1;
+        if (value < 1 || value > self->slots)
+        {
+            char * msg = "The number of slots must be between 1 and the size of the ring!";
+            PyErr_SetString(PyExc_ValueError, msg);
+            return -1;
+        }
+        *last = value;
+    }
+    return 0;
+}
+
+/* Adds an element to the current slot. */
+static PyObject *
+CMS_RING(_increment)(CMS_VARIANT(_Ring) *self, PyObject *args)
+{
+    PyObject * pkey;
+    PyObject * free_after = NULL;
+    Py_ssize_t dataLength = 0;
+    long long increment = 1;
+
+    if (!PyArg_ParseTuple(args, "O|L", &pkey, &increment))
+        return NULL;
+    if (increment < 0)
+    {
+        char * msg = "Increment must be positive!.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+    char * data = CMS_VARIANT(_parse_key)(pkey, &dataLength, &free_after);
+    if (!data)
+        return NULL;
+
+    if (increment > 0)
+    {
+        size_t offsets[32];
+        CMS_CELL_TYPE * cells[32];
+        CMS_CELL_TYPE * slot = self->table[self->head];
+
+        uint32_t hash = CMS_RING(_offsets)(self, data, dataLength, offsets);
+        int i;
+        for (i = 0; i < self->depth; i++)
+            cells[i] = &slot[offsets[i]];
+
+        if (cms_hll_add(&self->hll[self->head], hash, data, dataLength))
+        {
+            Py_XDECREF(free_after);
+            return PyErr_NoMemory();
+        }
+        CMS_VARIANT(_update_cells)(cells, self->depth, increment);
+        self->totals[self->head] += increment;
+    }
+
+    Py_XDECREF(free_after);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Retrieves estimate for the frequency of a single element summed over the most recent slots. */
+static PyObject *
+CMS_RING(_getitem)(CMS_VARIANT(_Ring) *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"key", "last", NULL};
+    PyObject * pkey;
+    PyObject * plast = NULL;
+    PyObject * free_after = NULL;
+    Py_ssize_t dataLength = 0;
+    uint32_t last;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &pkey, &plast))
+        return NULL;
+    if (CMS_RING(_parse_last)(self, plast, &last))
+        return NULL;
+    char * data = CMS_VARIANT(_parse_key)(pkey, &dataLength, &free_after);
+    if (!data)
+        return NULL;
+
+    size_t offsets[32];
+    CMS_RING(_offsets)(self, data, dataLength, offsets);
+    Py_XDECREF(free_after);
+
+    long long result = 0;
+    uint32_t n;
+    uint32_t s = self->head;
+    for (n = 0; n < last; n++)
+    {
+        CMS_CELL_TYPE * slot = self->table[s];
+        CMS_CELL_TYPE min_value = -1;
+        int i;
+        for (i = 0; i < self->depth; i++)
+        {
+            CMS_CELL_TYPE value = slot[offsets[i]];
+            if (value < min_value)
+                min_value = value;
+        }
+        result += CMS_VARIANT(decode)(min_value);
+        s = s ? s - 1 : self->slots - 1;
+    }
+
+    return Py_BuildValue("L", result);
+}
+
+/* Advances the ring to the next slot, discarding the contents of the oldest one. */
+static PyObject *
+CMS_RING(_rotate)(CMS_VARIANT(_Ring) *self)
+{
+    uint32_t head = (self->head + 1) % self->slots;
+
+    Py_BEGIN_ALLOW_THREADS
+    pages_zero(self->table[head], (size_t) self->depth * self->width * sizeof(CMS_CELL_TYPE));
+    Py_END_ALLOW_THREADS
+    HyperLogLog_clear(&self->hll[head]);
+
+    self->totals[head] = 0;
+    self->head = head;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Retrieves the total number of increments over the most recent slots */
+static PyObject *
+CMS_RING(_total)(CMS_VARIANT(_Ring) *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"last", NULL};
+    PyObject * plast = NULL;
+    uint32_t last;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &plast))
+        return NULL;
+    if (CMS_RING(_parse_last)(self, plast, &last))
+        return NULL;
+
+    long long result = 0;
+    uint32_t n;
+    uint32_t s = self->head;
+    for (n = 0; n < last; n++)
+    {
+        result += self->totals[s];
+        s = s ? s - 1 : self->slots - 1;
+    }
+    return Py_BuildValue("L", result);
+}
+
+/* Retrieves estimate of the set cardinality over the most recent slots */
+static PyObject *
+CMS_RING(_cardinality)(CMS_VARIANT(_Ring) *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"last", NULL};
+    PyObject * plast = NULL;
+    uint32_t last;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &plast))
+        return NULL;
+    if (CMS_RING(_parse_last)(self, plast, &last))
+        return NULL;
+
+    HyperLogLog ** hlls = (HyperLogLog **) malloc(last * sizeof(HyperLogLog *));
+    if (!hlls)
+        return PyErr_NoMemory();
+    uint32_t n;
+    uint32_t s = self->head;
+    for (n = 0; n < last; n++)
+    {
+        hlls[n] = &self->hll[s];
+        s = s ? s - 1 : self->slots - 1;
+    }
+    double cardinality = HyperLogLog_union_cardinality(hlls, last);
+    free(hlls);
+    if (cardinality < 0)
+        return PyErr_NoMemory();
+
+    return Py_BuildValue("L", (long long) cardinality);
+}
+
+static PyObject *
+CMS_RING(_slots)(CMS_VARIANT(_Ring) *self)
+{
+    return Py_BuildValue("I", self->slots);
+}
+
+/* Serialization function for pickling. */
+static PyObject *
+CMS_RING(_reduce)(CMS_VARIANT(_Ring) *self)
+{
+    PyObject *args = Py_BuildValue("(III)", self->width, self->depth, self->slots);
+    PyObject *state_table = PyList_New(2 * self->slots + 1);
+    Py_ssize_t slot_size = (Py_ssize_t) self->depth * self->width * sizeof(CMS_CELL_TYPE);
+    uint32_t i;
+    for (i = 0; i < self->slots; i++)
+    {
+        PyObject *slot = PyByteArray_FromStringAndSize((char *) self->table[i], slot_size);
+        if (!slot)
+            return NULL;
+        PyList_SetItem(state_table, i, slot);
+
+        PyObject *hll = cms_hll_state(&self->hll[i]);
+        if (!hll)
+            return NULL;
+        PyList_SetItem(state_table, self->slots + i, hll);
+    }
+    PyObject *totals = PyByteArray_FromStringAndSize((char *) self->totals, self->slots * sizeof(long long));
+    if (!totals)
+        return NULL;
+    PyList_SetItem(state_table, 2 * self->slots, totals);
+
+    return Py_BuildValue("(ON(IN))", Py_TYPE(self), args, self->head, state_table);
+}
+
+/* De-serialization function for pickling. */
+static PyObject *
+CMS_RING(_set_state)(CMS_VARIANT(_Ring) * self, PyObject * state)
+{
+    PyObject *state_table;
+    uint32_t head;
+
+    if (!PyArg_ParseTuple(state, "(IO!):setstate", &head, &PyList_Type, &state_table))
+        return NULL;
+    if (head >= self->slots || PyList_Size(state_table) != 2 * self->slots + 1)
+    {
+        char * msg = "Invalid ring state!";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+
+    Py_ssize_t slot_size = (Py_ssize_t) self->depth * self->width * sizeof(CMS_CELL_TYPE);
+    uint32_t i;
+    for (i = 0; i < self->slots; i++)
+    {
+        char * buffer = PyByteArray_AsString(PyList_GetItem(state_table, i));
+        if (!buffer)
+            return NULL;
+        memcpy(self->table[i], buffer, slot_size);
+
+        if (cms_hll_set_state(&self->hll[i], PyList_GetItem(state_table, self->slots + i)))
+            return NULL;
+    }
+    char * totals = PyByteArray_AsString(PyList_GetItem(state_table, 2 * self->slots));
+    if (!totals)
+        return NULL;
+    memcpy(self->totals, totals, self->slots * sizeof(long long));
+    self->head = head;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyMethodDef CMS_RING(_methods)[] = {
+    {"increment", (PyCFunction)CMS_RING(_increment), METH_VARARGS,
+     "Increase counter of the current slot."
+    },
+    {"get", (PyCFunction)CMS_RING(_getitem), METH_VARARGS | METH_KEYWORDS,
+    "Retrieves estimate for the frequency of a single element summed over the last n slots (all by default)."
+    },
+    {"rotate", (PyCFunction)CMS_RING(_rotate), METH_NOARGS,
+    "Moves to the next slot, clearing the oldest one."
+    },
+    {"cardinality", (PyCFunction)CMS_RING(_cardinality), METH_VARARGS | METH_KEYWORDS,
+    "Retrieves estimate of the set cardinality over the last n slots (all by default)."
+    },
+    {"total", (PyCFunction)CMS_RING(_total), METH_VARARGS | METH_KEYWORDS,
+    "Retrieves the total number of increments over the last n slots (all by default)."
+    },
+    {"slots", (PyCFunction)CMS_RING(_slots), METH_NOARGS,
+    "Returns the number of slots in the ring."
+    },
+    {"__reduce__", (PyCFunction)CMS_RING(_reduce), METH_NOARGS,
+     "Serialization function for pickling."
+    },
+    {"__setstate__", (PyCFunction)CMS_RING(_set_state), METH_VARARGS,
+    "De-serialization function for pickling."
+    },
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject CMS_RING(Type) = {
+    #if PY_MAJOR_VERSION >= 3
+    PyVarObject_HEAD_INIT(NULL, 0)
+    #else
+    PyObject_HEAD_INIT(NULL)
+    0,                               /* ob_size */
+    #endif
+    "bounter_cmsc." CMS_TYPE_STRING "_Ring",      /* tp_name */
+    sizeof(CMS_VARIANT(_Ring)),        /* tp_basicsize */
+    0,                               /* tp_itemsize */
+    (destructor)CMS_RING(_dealloc), /* tp_dealloc */
+    0,                               /* tp_print */
+    0,                               /* tp_getattr */
+    0,                               /* tp_setattr */
+    0,                               /* tp_compare */
+    0,                               /* tp_repr */
+    0,                               /* tp_as_number */
+    0,                               /* tp_as_sequence */
+    0,                               /* tp_as_mapping */
+    0,                               /* tp_hash */
+    0,                               /* tp_call */
+    0,                               /* tp_str */
+    0,                               /* tp_getattro */
+    0,                               /* tp_setattro */
+    0,                               /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,         /* tp_flags */
+    CMS_TYPE_STRING "_Ring object",            /* tp_doc */
+    0,		                     /* tp_traverse */
+    0,		                     /* tp_clear */
+    0,		                     /* tp_richcompare */
+    0,		                     /* tp_weaklistoffset */
+    0,		                     /* tp_iter */
+    0,		                     /* tp_iternext */
+    CMS_RING(_methods),             /* tp_methods */
+    CMS_RING(_members),             /* tp_members */
+    0,                               /* tp_getset */
+    0,                               /* tp_base */
+    0,                               /* tp_dict */
+    0,                               /* tp_descr_get */
+    0,                               /* tp_descr_set */
+    0,                               /* tp_dictoffset */
+    (initproc)CMS_RING(_init),      /* tp_init */
+    0,                               /* tp_alloc */
+    CMS_RING(_new),                 /* tp_new */
+};
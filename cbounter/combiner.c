@@ -0,0 +1,93 @@
+//-----------------------------------------------------------------------------
+// Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+// Copyright (C) 2017 Rare Technologies
+//
+// This code is distributed under the terms and conditions
+// from the MIT License (MIT).
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "combiner.h"
+
+int Combiner_init(Combiner *self, uint32_t size)
+{
+    uint32_t capacity = 1;
+    while (capacity < size && capacity < 0x80000000)
+        capacity <<= 1;
+
+    self->size = capacity;
+    self->mask = capacity - 1;
+    self->used = 0;
+    self->entries = (combiner_entry_t *) calloc(capacity, sizeof(combiner_entry_t));
+    return self->entries == NULL;
+}
+
+void Combiner_dealloc(Combiner *self)
+{
+    free(self->entries);
+    self->entries = NULL;
+    self->size = 0;
+    self->used = 0;
+}
+
+/* Returns the only entry which may hold the key. */
+static inline combiner_entry_t * Combiner_entry(Combiner *self, uint32_t hash)
+{
+    // mix in the high bits so that entries do not follow table buckets, which are taken from the low bits
+    return &self->entries[((hash >> 16) ^ hash) & self->mask];
+}
+
+static inline int Combiner_holds(const combiner_entry_t *entry, uint32_t hash, const char *data, uint32_t length)
+{
+    return entry->count && entry->hash == hash && entry->length == length && !memcmp(entry->key, data, length);
+}
+
+int Combiner_add(Combiner *self, uint32_t hash, const char *data, uint32_t length, long long increment,
+                 combiner_entry_t *evicted)
+{
+    combiner_entry_t * entry = Combiner_entry(self, hash);
+    int result = 0;
+
+    if (entry->count)
+    {
+        if (Combiner_holds(entry, hash, data, length) && entry->count <= LLONG_MAX - increment)
+        {
+            entry->count += increment;
+            return 0;
+        }
+        memcpy(evicted, entry, sizeof(combiner_entry_t));
+        result = 1;
+    }
+    else
+    {
+        self->used++;
+    }
+
+    entry->hash = hash;
+    entry->length = length;
+    entry->count = increment;
+    memcpy(entry->key, data, length);
+    entry->key[length] = 0;
+    return result;
+}
+
+int Combiner_take(Combiner *self, uint32_t hash, const char *data, uint32_t length, combiner_entry_t *taken)
+{
+    if (!self->used)
+        return 0;
+    combiner_entry_t * entry = Combiner_entry(self, hash);
+    if (!Combiner_holds(entry, hash, data, length))
+        return 0;
+    memcpy(taken, entry, sizeof(combiner_entry_t));
+    entry->count = 0;
+    self->used--;
+    return 1;
+}
+
+void Combiner_clear(Combiner *self)
+{
+    if (self->used)
+        memset(self->entries, 0, self->size * sizeof(combiner_entry_t));
+    self->used = 0;
+}
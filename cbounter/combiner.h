@@ -0,0 +1,53 @@
+//-----------------------------------------------------------------------------
+// Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+// Copyright (C) 2017 Rare Technologies
+//
+// This code is distributed under the terms and conditions
+// from the MIT License (MIT).
+//
+// Small direct-mapped write-combining buffer which sums repeated increments of the same key
+// before they are applied to a counting structure.
+
+#ifndef COMBINER_H
+#define COMBINER_H
+
+#include <stdint.h>
+
+/* Keys of this length or longer bypass the buffer. */
+#define COMBINER_KEY_SIZE 48
+
+typedef struct {
+    uint32_t hash;
+    uint32_t length;
+    long long count; /* 0 marks an empty entry */
+    char key[COMBINER_KEY_SIZE]; /* null-terminated copy of the key */
+} combiner_entry_t;
+
+typedef struct {
+    uint32_t size;    /* number of entries, power of 2 */
+    uint32_t mask;
+    uint32_t used;    /* number of non-empty entries */
+    combiner_entry_t * entries;
+} Combiner;
+
+/* Allocates at least `size` entries. Returns 0 when successful, 1 otherwise. */
+int Combiner_init(Combiner *self, uint32_t size);
+
+void Combiner_dealloc(Combiner *self);
+
+/* Adds an increment of the key. When the entry of the key is taken by a different key (or its sum would overflow),
+ * the previous content is moved to `evicted` and the function returns 1. The caller is responsible for applying it.
+ * Returns 0 when the increment was absorbed without eviction.
+ */
+int Combiner_add(Combiner *self, uint32_t hash, const char *data, uint32_t length, long long increment,
+                 combiner_entry_t *evicted);
+
+/* Removes the pending increments of a single key, moving them to `taken`, so that only they need to be applied before
+ * the key is looked up. Returns 1 when the buffer held the key, 0 otherwise.
+ */
+int Combiner_take(Combiner *self, uint32_t hash, const char *data, uint32_t length, combiner_entry_t *taken);
+
+/* Empties the buffer without applying its content. */
+void Combiner_clear(Combiner *self);
+
+#endif
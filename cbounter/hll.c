@@ -18,87 +18,500 @@
 #include "hll.h"
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* Packs a register update into a sparse list entry, ordered by index and then by rank. */
+#define HLL_ENTRY(index, rank) (((uint32_t) (index) << 6) | (rank))
+
+static inline uint8_t * hll_put_varint(uint8_t *out, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t) value;
+    return out;
+}
+
+/* Reads a variable-length number, returns NULL when it does not end before `end`. */
+static inline const uint8_t * hll_get_varint(const uint8_t *in, const uint8_t *end, uint32_t *value)
+{
+    uint32_t result = 0;
+    int shift;
+    for (shift = 0; in < end && shift < 35; shift += 7)
+    {
+        uint8_t byte = *in++;
+        result |= (uint32_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return in;
+        }
+    }
+    return NULL;
+}
+
+/* Loads a group of 8 packed registers, the register at the lowest index in the lowest bits. */
+static inline uint64_t hll_load_group(const uint8_t *group)
+{
+    return (uint64_t) group[0] | (uint64_t) group[1] << 8 | (uint64_t) group[2] << 16
+        | (uint64_t) group[3] << 24 | (uint64_t) group[4] << 32 | (uint64_t) group[5] << 40;
+}
+
+static inline void hll_store_group(uint8_t *group, uint64_t value)
+{
+    int i;
+    for (i = 0; i < HLL_GROUP_BYTES; i++)
+        group[i] = (uint8_t) (value >> (8 * i));
+}
+
+/* Loads 4 consecutive groups, 24 bytes, with three word loads where the byte order allows. */
+static inline void hll_load_groups4(const uint8_t *groups, uint64_t *out)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t w[3];
+    memcpy(w, groups, sizeof(w));
+    out[0] = w[0] & 0xFFFFFFFFFFFFULL;
+    out[1] = ((w[0] >> 48) | (w[1] << 16)) & 0xFFFFFFFFFFFFULL;
+    out[2] = ((w[1] >> 32) | (w[2] << 32)) & 0xFFFFFFFFFFFFULL;
+    out[3] = w[2] >> 16;
+#else
+    int i;
+    for (i = 0; i < 4; i++)
+        out[i] = hll_load_group(groups + i * HLL_GROUP_BYTES);
+#endif
+}
+
+/* Lanes 0, 2, 4 and 6 of a group, and the bit just above each of them. */
+#define HLL_EVEN_LANES 0x03F03F03F03FULL
+#define HLL_EVEN_GUARDS 0x040040040040ULL
+
+/* Takes the maximum of each of 4 lanes separated by gaps of 6 bits. */
+static inline uint64_t hll_max_lanes(uint64_t a, uint64_t b)
+{
+    // the guard bit survives the subtraction exactly when a >= b in its lane
+    uint64_t greater = (((a | HLL_EVEN_GUARDS) - b) & HLL_EVEN_GUARDS) >> 6;
+    uint64_t mask = greater * 63;
+    return (a & mask) | (b & ~mask);
+}
+
+/* Takes the maximum of each register of two groups, all 8 at once. */
+static inline uint64_t hll_max_group(uint64_t a, uint64_t b)
+{
+    uint64_t even = hll_max_lanes(a & HLL_EVEN_LANES, b & HLL_EVEN_LANES);
+    uint64_t odd = hll_max_lanes((a >> 6) & HLL_EVEN_LANES, (b >> 6) & HLL_EVEN_LANES);
+    return even | (odd << 6);
+}
+
+/* Gets a packed register. Its 6 bits at a bit offset of 6 * index lie within the byte of that offset when the offset
+ * within the byte is at most 2, within the 2 bytes starting there otherwise. The last register of a group is of the
+ * first kind, so the second byte is never read past the end of the array. */
+static inline uint32_t hll_get_register(const uint8_t *registers, uint32_t index)
+{
+    uint32_t offset = index * 6;
+    const uint8_t *p = registers + (offset >> 3);
+    uint32_t word = ((offset & 7) > 2) ? p[0] | (uint32_t) p[1] << 8 : p[0];
+    return (word >> (offset & 7)) & 63;
+}
+
+static inline void hll_set_register(uint8_t *registers, uint32_t index, uint32_t value)
+{
+    uint32_t offset = index * 6;
+    uint8_t *p = registers + (offset >> 3);
+    if ((offset & 7) <= 2)
+    {
+        p[0] = (uint8_t) ((p[0] & ~(63U << (offset & 7))) | (value << (offset & 7)));
+        return;
+    }
+    uint32_t word = p[0] | (uint32_t) p[1] << 8;
+    word = (word & ~(63U << (offset & 7))) | (value << (offset & 7));
+    p[0] = (uint8_t) word;
+    p[1] = (uint8_t) (word >> 8);
+}
 
 void HyperLogLog_init(HyperLogLog *self, uint32_t k)
 {
     self->k = k;
-    self->size = 1 << self->k;
-    self->registers = (hll_cell_t *) calloc(self->size, sizeof(char));
+    self->size = k ? 1 << k : 0;
+    self->registers = NULL;
+    self->sparse = NULL;
+    self->sparse_count = 0;
+    self->sparse_capacity = 0;
+    memset(self->sparse_start, 0, sizeof(self->sparse_start));
+    memset(self->histogram, 0, sizeof(self->histogram));
+    self->histogram[0] = self->size;
 }
 
 void HyperLogLog_dealloc(HyperLogLog* self)
 {
     free(self->registers);
+    free(self->sparse);
+}
+
+/* Resets all registers to zero, returning to the sparse representation. */
+void HyperLogLog_clear(HyperLogLog *self)
+{
+    free(self->registers);
+    self->registers = NULL;
+    free(self->sparse);
+    self->sparse = NULL;
+    self->sparse_count = 0;
+    self->sparse_capacity = 0;
+    memset(self->sparse_start, 0, sizeof(self->sparse_start));
+    memset(self->histogram, 0, sizeof(self->histogram));
+    self->histogram[0] = self->size;
+}
+
+/* Recounts the histogram of register values of the dense representation, a group of registers at a time.
+ * Four partial histograms let consecutive registers of the same value be counted without waiting on each other. */
+static void HyperLogLog_count_registers(HyperLogLog *self)
+{
+    uint32_t partial[4][64] = {{0}};
+    uint32_t i;
+    for (i = 0; i < HLL_DENSE_BYTES(self->size); i += HLL_GROUP_BYTES)
+    {
+        uint64_t group = hll_load_group(self->registers + i);
+        partial[0][group & 63]++;
+        partial[1][(group >> 6) & 63]++;
+        partial[2][(group >> 12) & 63]++;
+        partial[3][(group >> 18) & 63]++;
+        partial[0][(group >> 24) & 63]++;
+        partial[1][(group >> 30) & 63]++;
+        partial[2][(group >> 36) & 63]++;
+        partial[3][(group >> 42) & 63]++;
+    }
+    for (i = 0; i < 64; i++)
+        self->histogram[i] = partial[0][i] + partial[1][i] + partial[2][i] + partial[3][i];
+    self->histogram[64] = self->histogram[65] = 0;
+}
+
+/* Gets the range of indexes an index belongs to. */
+static inline uint32_t HyperLogLog_sparse_range(const HyperLogLog *self, uint32_t index)
+{
+    return self->k > 8 ? index >> (self->k - 8) : index;
+}
+
+/* Writes all registers into `registers` (2^k bytes), whatever the representation. */
+void HyperLogLog_registers(HyperLogLog *self, hll_cell_t *registers)
+{
+    uint32_t i;
+    if (self->registers)
+    {
+        for (i = 0; i < self->size; i += 8)
+        {
+            uint64_t group = hll_load_group(self->registers + i / 8 * HLL_GROUP_BYTES);
+            int j;
+            for (j = 0; j < 8; j++)
+                registers[i + j] = (group >> (6 * j)) & 63;
+        }
+        return;
+    }
+
+    memset(registers, 0, self->size);
+    for (i = 0; i < self->sparse_count; i++)
+        registers[self->sparse[i] >> 6] = self->sparse[i] & 63;
+}
+
+/* Switches to the dense representation. Returns 0 when successful, 1 when out of memory. */
+static int HyperLogLog_densify(HyperLogLog *self)
+{
+    uint8_t * registers = (uint8_t *) calloc(HLL_DENSE_BYTES(self->size), 1);
+    if (!registers)
+        return 1;
+    uint32_t histogram[HLL_RANKS];
+    memcpy(histogram, self->histogram, sizeof(histogram));
+    uint32_t i;
+    for (i = 0; i < self->sparse_count; i++)
+        hll_set_register(registers, self->sparse[i] >> 6, self->sparse[i] & 63);
+    HyperLogLog_clear(self);
+    self->registers = registers;
+    memcpy(self->histogram, histogram, sizeof(histogram));
+    return 0;
+}
+
+/* Finds the position of the first entry of the sparse list with an index not lower than `index`.
+ * Only the few entries within the range of the index are scanned. */
+static inline uint32_t HyperLogLog_sparse_find(const HyperLogLog *self, uint32_t index)
+{
+    uint32_t range = HyperLogLog_sparse_range(self, index);
+    uint32_t position = self->sparse_start[range];
+    uint32_t end = self->sparse_start[range + 1];
+    while (position < end && (self->sparse[position] >> 6) < index)
+        position++;
+    return position;
+}
+
+/* Raises the register at the index to the rank, returns 1 when the list cannot grow for lack of memory. */
+static inline int HyperLogLog_add_entry(HyperLogLog *self, uint32_t index, uint32_t rank)
+{
+    if (self->registers)
+    {
+        uint32_t current = hll_get_register(self->registers, index);
+        if (rank > current)
+        {
+            self->histogram[current]--;
+            self->histogram[rank]++;
+            hll_set_register(self->registers, index, rank);
+        }
+        return 0;
+    }
+
+    uint32_t position = HyperLogLog_sparse_find(self, index);
+    if (position < self->sparse_count && (self->sparse[position] >> 6) == index)
+    {
+        if (rank > (self->sparse[position] & 63))
+        {
+            self->histogram[self->sparse[position] & 63]--;
+            self->histogram[rank]++;
+            self->sparse[position] = HLL_ENTRY(index, rank);
+        }
+        return 0;
+    }
+
+    // switch to registers once the list would take more than its share of their size
+    if (self->sparse_count == self->sparse_capacity)
+    {
+        uint32_t limit = HLL_DENSE_BYTES(self->size) / HLL_SPARSE_RATIO / sizeof(uint32_t);
+        uint32_t capacity = self->sparse_capacity ? self->sparse_capacity * 2 : 16;
+        if (capacity > limit)
+            capacity = limit;
+        if (capacity <= self->sparse_capacity)
+        {
+            if (HyperLogLog_densify(self))
+                return 1;
+            return HyperLogLog_add_entry(self, index, rank);
+        }
+        uint32_t * sparse = (uint32_t *) realloc(self->sparse, capacity * sizeof(uint32_t));
+        if (!sparse)
+            return 1;
+        self->sparse = sparse;
+        self->sparse_capacity = capacity;
+    }
+
+    memmove(&self->sparse[position + 1], &self->sparse[position], (self->sparse_count - position) * sizeof(uint32_t));
+    self->sparse[position] = HLL_ENTRY(index, rank);
+    self->sparse_count++;
+    self->histogram[0]--;
+    self->histogram[rank]++;
+
+    uint32_t range;
+    for (range = HyperLogLog_sparse_range(self, index) + 1; range <= HLL_SPARSE_RANGES; range++)
+        self->sparse_start[range]++;
+    return 0;
 }
 
-/* Adds a hash to the cardinality estimator. */
-void HyperLogLog_add(HyperLogLog *self, uint32_t hash)
+/* Adds a 64-bit hash to the cardinality estimator. */
+int HyperLogLog_add(HyperLogLog *self, uint64_t hash)
 {
     uint32_t index;
     uint32_t rank;
 
     /* Use the first k bits as a zero based index */
-    index = (hash >> (32 - self->k));
+    index = (uint32_t) (hash >> (64 - self->k));
 
-    /* Compute the rank, lzc + 1, of the remaining 32 - k bits */
-    rank = leadingZeroCount((hash << self->k) >> self->k) - self->k + 1;
+    /* Compute the rank, lzc + 1, of the remaining 64 - k bits */
+    uint64_t remaining = hash << self->k;
+    uint32_t high = (uint32_t) (remaining >> 32);
+    if (high)
+        rank = leadingZeroCount(high) + 1;
+    else if ((uint32_t) remaining)
+        rank = leadingZeroCount((uint32_t) remaining) + 33;
+    else
+        rank = 64 - self->k + 1;
 
-    if (rank > self->registers[index])
-        self->registers[index] = rank;
+    return HyperLogLog_add_entry(self, index, rank);
 }
 
-/* Gets a cardinality estimate. */
-double HyperLogLog_cardinality(HyperLogLog *self)
+/* Helper of the estimator, see Ertl: New cardinality estimation algorithms for HyperLogLog sketches (2017). */
+static double HyperLogLog_sigma(double x)
 {
-    static const double two_32 = 4294967296.0;
-    static const double neg_two_32 = -4294967296.0;
-
-    double alpha = 0.0;
-    switch (self->size) {
-      case 16:
-          alpha = 0.673;
-          break;
-      case 32:
-          alpha = 0.697;
-          break;
-      case 64:
-          alpha = 0.709;
-          break;
-      default:
-          alpha = 0.7213/(1.0 + 1.079/(double) self->size);
-          break;
-    }
+    if (x == 1.0)
+        return INFINITY;
+    double y = 1.0;
+    double z = x;
+    double previous;
+    do {
+        x *= x;
+        previous = z;
+        z += x * y;
+        y += y;
+    } while (z != previous);
+    return z;
+}
+
+/* Helper of the estimator, see Ertl: New cardinality estimation algorithms for HyperLogLog sketches (2017). */
+static double HyperLogLog_tau(double x)
+{
+    if (x == 0.0 || x == 1.0)
+        return 0.0;
+    double y = 1.0;
+    double z = 1.0 - x;
+    double previous;
+    do {
+        x = sqrt(x);
+        previous = z;
+        y *= 0.5;
+        z -= (1.0 - x) * (1.0 - x) * y;
+    } while (z != previous);
+    return z / 3.0;
+}
 
+/* Computes the estimate from the histogram of register values of an estimator with 2^k registers. */
+static double HyperLogLog_estimate(uint32_t k, const uint32_t *histogram)
+{
+    uint32_t q = 64 - k;
     uint32_t i;
-    double rank;
-    double sum = 0.0;
-    for (i = 0; i < self->size; i++) {
-        rank = (double) self->registers[i];
-        sum = sum + pow(2, -1*rank);
-    }
 
-    double estimate = alpha * (1/sum) * self->size * self->size;
+    double m = (double) (1 << k);
+    double z = m * HyperLogLog_tau(1.0 - histogram[q + 1] / m);
+    for (i = q; i >= 1; i--)
+        z = 0.5 * (z + histogram[i]);
+    z += m * HyperLogLog_sigma(histogram[0] / m);
 
-    if (estimate <= 2.5 * self->size) {
-        uint32_t zeros = 0;
-    uint32_t i;
+    return 0.5 / log(2.0) * m * m / z;
+}
+
+/* Gets a cardinality estimate.
+ *
+ * Uses the improved raw estimator by Ertl, which corrects the small range bias of the classic
+ * estimator (like the empirical bias tables of HLL++, but without them) and needs no large range
+ * correction with 64-bit hashes, so it stays unbiased over the whole range.
+ */
+double HyperLogLog_cardinality(HyperLogLog *self)
+{
+    return HyperLogLog_estimate(self->k, self->histogram);
+}
 
-    for (i = 0; i < self->size; i++) {
-            if (self->registers[i] == 0) {
-                zeros += 1;
+/* Number of register groups combined at a time by HyperLogLog_union, small enough to stay in the L1 cache. */
+#define HLL_UNION_BLOCK 256
+
+/* Streams the union of estimators of the same size in a single pass over their registers.
+ * The registers are combined a block of groups at a time. Dense inputs are folded in with the SWAR maximum of
+ * 8 registers per word, and the entries of sparse inputs are applied as the block reaches their indexes.
+ * Writes the packed registers into `registers`, unless it is NULL, and their histogram into `histogram`.
+ * Returns 0 when successful, 1 when out of memory.
+ */
+static int HyperLogLog_union(HyperLogLog **hlls, size_t count, uint8_t *registers, uint32_t *histogram)
+{
+    uint32_t * cursors = (uint32_t *) calloc(count ? count : 1, sizeof(uint32_t));
+    if (!cursors)
+        return 1;
+
+    uint32_t partial[4][64] = {{0}};
+    uint64_t block[HLL_UNION_BLOCK];
+    uint32_t groups = hlls[0]->size / 8;
+    uint32_t first, g;
+    size_t j;
+    for (first = 0; first < groups; first += HLL_UNION_BLOCK)
+    {
+        uint32_t length = groups - first < HLL_UNION_BLOCK ? groups - first : HLL_UNION_BLOCK;
+        memset(block, 0, sizeof(block));
+        for (j = 0; j < count; j++)
+        {
+            const HyperLogLog * hll = hlls[j];
+            if (hll->registers)
+            {
+                const uint8_t * source = hll->registers + (size_t) first * HLL_GROUP_BYTES;
+                uint64_t loaded[4];
+                for (g = 0; g + 4 <= length; g += 4)
+                {
+                    hll_load_groups4(source + g * HLL_GROUP_BYTES, loaded);
+                    block[g] = hll_max_group(block[g], loaded[0]);
+                    block[g + 1] = hll_max_group(block[g + 1], loaded[1]);
+                    block[g + 2] = hll_max_group(block[g + 2], loaded[2]);
+                    block[g + 3] = hll_max_group(block[g + 3], loaded[3]);
+                }
+                for (; g < length; g++)
+                    block[g] = hll_max_group(block[g], hll_load_group(source + g * HLL_GROUP_BYTES));
+                continue;
             }
+            // entries are sorted by index, and the group of an entry is its index / 8
+            uint32_t c;
+            for (c = cursors[j]; c < hll->sparse_count && (hll->sparse[c] >> 9) < first + length; c++)
+            {
+                uint32_t shift = 6 * ((hll->sparse[c] >> 6) & 7);
+                uint64_t * group = &block[(hll->sparse[c] >> 9) - first];
+                if ((hll->sparse[c] & 63) > ((*group >> shift) & 63))
+                    *group = (*group & ~(63ULL << shift)) | ((uint64_t) (hll->sparse[c] & 63) << shift);
+            }
+            cursors[j] = c;
+        }
+
+        for (g = 0; g < length; g++)
+        {
+            uint64_t group = block[g];
+            if (registers)
+                hll_store_group(registers + (size_t) (first + g) * HLL_GROUP_BYTES, group);
+            partial[0][group & 63]++;
+            partial[1][(group >> 6) & 63]++;
+            partial[2][(group >> 12) & 63]++;
+            partial[3][(group >> 18) & 63]++;
+            partial[0][(group >> 24) & 63]++;
+            partial[1][(group >> 30) & 63]++;
+            partial[2][(group >> 36) & 63]++;
+            partial[3][(group >> 42) & 63]++;
+        }
+    }
+
+    for (g = 0; g < 64; g++)
+        histogram[g] = partial[0][g] + partial[1][g] + partial[2][g] + partial[3][g];
+    histogram[64] = histogram[65] = 0;
+    free(cursors);
+    return 0;
+}
+
+/* Merges other HyperLogLogs into the current HyperLogLog in a single pass. The others are unaffected.
+ * Returns 0 when successful, 1 when the sizes differ or memory runs out.
+ */
+int HyperLogLog_merge_many(HyperLogLog *self, HyperLogLog **hlls, size_t count)
+{
+    size_t j;
+    int sparse = 1;
+    for (j = 0; j < count; j++)
+    {
+        if (hlls[j]->size != self->size)
+            return 1;
+        sparse = sparse && !hlls[j]->registers;
     }
+    if (!self->k)
+        return 0;
 
-        if (zeros != 0) {
-            double size = (double) self->size;
-            estimate = size * log(size / (double) zeros);
+    // sparse entries are inserted one by one, which switches to registers when they grow too many
+    if (sparse)
+    {
+        for (j = 0; j < count; j++)
+        {
+            const HyperLogLog * hll = hlls[j];
+            uint32_t i;
+            for (i = 0; i < hll->sparse_count; i++)
+                if (HyperLogLog_add_entry(self, hll->sparse[i] >> 6, hll->sparse[i] & 63))
+                    return 1;
         }
+        return 0;
     }
 
-    if (estimate > (1.0/30.0) * two_32) {
-        estimate = neg_two_32 * log(1.0 - estimate/two_32);
+    HyperLogLog ** inputs = (HyperLogLog **) malloc((count + 1) * sizeof(HyperLogLog *));
+    uint8_t * registers = (uint8_t *) malloc(HLL_DENSE_BYTES(self->size));
+    uint32_t histogram[HLL_RANKS];
+    int failed = !inputs || !registers;
+    if (!failed)
+    {
+        inputs[0] = self;
+        memcpy(inputs + 1, hlls, count * sizeof(HyperLogLog *));
+        failed = HyperLogLog_union(inputs, count + 1, registers, histogram);
+    }
+    free(inputs);
+    if (failed)
+    {
+        free(registers);
+        return 1;
     }
-    return estimate;
+
+    HyperLogLog_clear(self);
+    self->registers = registers;
+    memcpy(self->histogram, histogram, sizeof(histogram));
+    return 0;
 }
 
 /* Merges another HyperLogLog into the current HyperLogLog. The registers of
@@ -106,16 +519,210 @@ double HyperLogLog_cardinality(HyperLogLog *self)
  */
 int HyperLogLog_merge(HyperLogLog *self, HyperLogLog *hll)
 {
-    if (hll->size != self->size) {
-        return 1;
+    return HyperLogLog_merge_many(self, &hll, 1);
+}
+
+/* Gets a cardinality estimate of the union of estimators of the same size, without merging them.
+ * Returns -1 when the sizes differ or memory runs out.
+ */
+double HyperLogLog_union_cardinality(HyperLogLog **hlls, size_t count)
+{
+    size_t j;
+    uint32_t histogram[HLL_RANKS];
+    if (!count)
+        return 0.0;
+    for (j = 1; j < count; j++)
+    {
+        if (hlls[j]->size != hlls[0]->size)
+            return -1.0;
+    }
+    if (!hlls[0]->k || HyperLogLog_union(hlls, count, NULL, histogram))
+        return -1.0;
+    return HyperLogLog_estimate(hlls[0]->k, histogram);
+}
+
+/* Gets the number of bytes HyperLogLog_serialize writes. */
+size_t HyperLogLog_serialized_size(HyperLogLog *self)
+{
+    if (!self->k)
+        return 0;
+    size_t dense = HLL_DENSE_HEADER + HLL_DENSE_BYTES(self->size);
+    if (self->registers)
+        return dense;
+
+    size_t length = HLL_SPARSE_HEADER;
+    uint32_t previous = 0;
+    uint32_t i;
+    uint8_t varint[5];
+    for (i = 0; i < self->sparse_count; i++)
+    {
+        length += hll_put_varint(varint, self->sparse[i] - previous) - varint;
+        previous = self->sparse[i];
+    }
+    return length < dense ? length : dense;
+}
+
+/* Writes a compact copy of the estimator: a versioned header followed by either the packed registers or,
+ * when shorter, the sparse list with entries stored as variable-length deltas. */
+void HyperLogLog_serialize(HyperLogLog *self, char *buffer)
+{
+    if (!self->k)
+        return;
+    uint8_t * out = (uint8_t *) buffer;
+    out[0] = HLL_FORMAT_MARKER;
+    out[1] = HLL_FORMAT_VERSION;
+    out[2] = (uint8_t) self->k;
+
+    if (HyperLogLog_serialized_size(self) == HLL_DENSE_HEADER + HLL_DENSE_BYTES(self->size))
+    {
+        out[3] = 'D';
+        if (self->registers)
+            memcpy(out + HLL_DENSE_HEADER, self->registers, HLL_DENSE_BYTES(self->size));
+        else
+        {
+            memset(out + HLL_DENSE_HEADER, 0, HLL_DENSE_BYTES(self->size));
+            uint32_t i;
+            for (i = 0; i < self->sparse_count; i++)
+                hll_set_register(out + HLL_DENSE_HEADER, self->sparse[i] >> 6, self->sparse[i] & 63);
+        }
+        return;
+    }
+
+    out[3] = 'S';
+    int i;
+    for (i = 0; i < 4; i++)
+        out[4 + i] = (uint8_t) (self->sparse_count >> (8 * i));
+
+    out += HLL_SPARSE_HEADER;
+    uint32_t previous = 0;
+    uint32_t j;
+    for (j = 0; j < self->sparse_count; j++)
+    {
+        out = hll_put_varint(out, self->sparse[j] - previous);
+        previous = self->sparse[j];
     }
+}
+
+/* Replaces the state with packed registers, unless some are out of the valid range.
+ * Returns 0 when successful, 1 otherwise. */
+static int HyperLogLog_set_registers(HyperLogLog *self, uint8_t *registers)
+{
+    uint8_t * previous = self->registers;
+    uint32_t histogram[HLL_RANKS];
+    memcpy(histogram, self->histogram, sizeof(histogram));
+
+    self->registers = registers;
+    HyperLogLog_count_registers(self);
+    uint32_t i;
+    for (i = 64 - self->k + 2; i < HLL_RANKS; i++)
+    {
+        if (self->histogram[i])
+        {
+            self->registers = previous;
+            memcpy(self->histogram, histogram, sizeof(histogram));
+            return 1;
+        }
+    }
+
+    free(previous);
+    free(self->sparse);
+    self->sparse = NULL;
+    self->sparse_count = 0;
+    self->sparse_capacity = 0;
+    memset(self->sparse_start, 0, sizeof(self->sparse_start));
+    return 0;
+}
 
+/* Replaces the state with a serialized copy of an estimator of the same size. Plain registers, one byte each
+ * as stored by older versions and in sketch files, are accepted too.
+ * Returns 0 when successful, 1 when the data is invalid or can not be stored.
+ */
+int HyperLogLog_deserialize(HyperLogLog *self, const char *buffer, size_t length)
+{
+    const uint8_t * in = (const uint8_t *) buffer;
     uint32_t i;
-    for (i = 0; i < self->size; i++) {
-        if (self->registers[i] < hll->registers[i])
-            self->registers[i] = hll->registers[i];
+
+    if (!self->k)
+        return length != 0;
+
+    if (length == self->size && (!length || in[0] != HLL_FORMAT_MARKER))
+    {
+        uint8_t * registers = (uint8_t *) calloc(HLL_DENSE_BYTES(self->size), 1);
+        if (!registers)
+            return 1;
+        // registers are not validated otherwise, clamp them to the valid range
+        for (i = 0; i < self->size; i++)
+            hll_set_register(registers, i, in[i] <= 64 - self->k + 1 ? in[i] : 64 - self->k + 1);
+        HyperLogLog_clear(self);
+        self->registers = registers;
+        HyperLogLog_count_registers(self);
+        return 0;
+    }
+
+    if (length < HLL_DENSE_HEADER || in[0] != HLL_FORMAT_MARKER || in[1] != HLL_FORMAT_VERSION || in[2] != self->k)
+        return 1;
+
+    if (in[3] == 'D')
+    {
+        if (length != HLL_DENSE_HEADER + HLL_DENSE_BYTES(self->size))
+            return 1;
+        uint8_t * registers = (uint8_t *) malloc(HLL_DENSE_BYTES(self->size));
+        if (!registers)
+            return 1;
+        memcpy(registers, in + HLL_DENSE_HEADER, HLL_DENSE_BYTES(self->size));
+        if (HyperLogLog_set_registers(self, registers))
+        {
+            free(registers);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (in[3] != 'S' || length < HLL_SPARSE_HEADER)
+        return 1;
+
+    uint32_t count = 0;
+    for (i = 0; i < 4; i++)
+        count |= (uint32_t) in[4 + i] << (8 * i);
+    if (count > length - HLL_SPARSE_HEADER || count * sizeof(uint32_t) > HLL_DENSE_BYTES(self->size) / HLL_SPARSE_RATIO)
+        return 1;
+
+    uint32_t * sparse = (uint32_t *) malloc((count ? count : 1) * sizeof(uint32_t));
+    if (!sparse)
+        return 1;
+
+    // validate the list, so that its consumers need not
+    const uint8_t *end = in + length;
+    uint32_t entry = 0, delta, j;
+    in += HLL_SPARSE_HEADER;
+    for (j = 0; j < count; j++)
+    {
+        in = hll_get_varint(in, end, &delta);
+        if (!in || (uint64_t) entry + delta >= ((uint64_t) self->size << 6)
+            || (j && ((entry + delta) >> 6) <= (entry >> 6))
+            || !((entry + delta) & 63) || ((entry + delta) & 63) > (uint32_t) (64 - self->k + 1))
+            break;
+        entry += delta;
+        sparse[j] = entry;
+    }
+    if (j < count || in != end)
+    {
+        free(sparse);
+        return 1;
     }
 
+    HyperLogLog_clear(self);
+    self->sparse = sparse;
+    self->sparse_count = count;
+    self->sparse_capacity = count ? count : 1;
+    for (j = 0; j < count; j++)
+    {
+        self->sparse_start[HyperLogLog_sparse_range(self, sparse[j] >> 6) + 1]++;
+        self->histogram[sparse[j] & 63]++;
+    }
+    self->histogram[0] -= count;
+    for (j = 1; j <= HLL_SPARSE_RANGES; j++)
+        self->sparse_start[j] += self->sparse_start[j - 1];
     return 0;
 }
 
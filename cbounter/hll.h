@@ -17,26 +17,80 @@
 #ifndef HLL_H
 #define HLL_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 uint32_t leadingZeroCount(uint32_t x);
 
 uint32_t ones(uint32_t x);
 
 typedef unsigned char hll_cell_t;
 
+/* Supported precisions: the sparse list offsets are 16-bit, which bounds k from above. */
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 18
+#define HLL_DEFAULT_PRECISION 16
+
+/* Registers are packed at 6 bits, in groups of 8 registers stored in 6 bytes. */
+#define HLL_GROUP_BYTES 6
+#define HLL_DENSE_BYTES(size) ((size) / 8 * HLL_GROUP_BYTES)
+
+/* Serialized estimators start with a marker, which plain registers (values up to 61) never do, and a version. */
+#define HLL_FORMAT_MARKER 'H'
+#define HLL_FORMAT_VERSION 1
+
+/* The sparse list is converted into registers once it would take more than 1/HLL_SPARSE_RATIO of their size. */
+#define HLL_SPARSE_RATIO 4
+
+/* Sizes of the headers of serialized dense and sparse HyperLogLogs. */
+#define HLL_DENSE_HEADER 4
+#define HLL_SPARSE_HEADER 8
+
+/* Number of index ranges the sparse list is partitioned into for lookups. */
+#define HLL_SPARSE_RANGES 256
+
+/* Number of distinct register values: ranks of 64-bit hashes go up to 64 - k + 1. */
+#define HLL_RANKS 66
+
 typedef struct {
     short int k;      /* size = 2^k */
     uint32_t size;    /* number of registers */
-    hll_cell_t * registers; /* ranks */
+    uint8_t * registers; /* packed ranks, NULL while the sparse representation is used */
+
+    /* Sparse representation: (index << 6 | rank) entries of the non-zero registers, sorted by index. */
+    uint32_t * sparse;
+    uint32_t sparse_count;
+    uint32_t sparse_capacity;
+    uint16_t sparse_start[HLL_SPARSE_RANGES + 1]; /* position of the first entry of each range of indexes */
+
+    uint32_t histogram[HLL_RANKS]; /* number of registers holding each value, kept up to date by all updates */
 } HyperLogLog;
 
+/* Initializes an empty HyperLogLog with 2^k registers, starting in the sparse representation.
+ * k must be in the range HLL_MIN_PRECISION-HLL_MAX_PRECISION, or 0 for a disabled estimator without registers,
+ * which callers must not add to or estimate from. It can still be cleared, merged with and serialized. */
 void HyperLogLog_init(HyperLogLog *self, uint32_t k);
 
 void HyperLogLog_dealloc(HyperLogLog* self);
 
-/* Adds a hash to the cardinality estimator. */
-void HyperLogLog_add(HyperLogLog *self, uint32_t hash);
+/* Resets all registers to zero, returning to the sparse representation. */
+void HyperLogLog_clear(HyperLogLog *self);
+
+/* Adds a 64-bit hash to the cardinality estimator.
+ * Returns 1 when out of memory to grow the sparse representation, leaving the estimator unchanged, 0 otherwise. */
+int HyperLogLog_add(HyperLogLog *self, uint64_t hash);
 
-/* Gets a cardinality estimate. */
+/* Whether the register update for a hash with the given high 32 bits depends on its low 32 bits.
+ * Callers composing the 64-bit hash of two 32-bit hashes only need to compute the second one
+ * when this is true, which happens with probability 2^-(32-k). Otherwise the update is the same as
+ * with the original 32-bit hashing, so registers stored by older versions remain valid.
+ */
+static inline int HyperLogLog_needs_low_bits(const HyperLogLog *self, uint32_t high)
+{
+    return !(high << self->k);
+}
+
+/* Gets a cardinality estimate. Takes constant time, computed from the histogram of register values. */
 double HyperLogLog_cardinality(HyperLogLog *self);
 
 /* Merges another HyperLogLog into the current HyperLogLog. The registers of
@@ -45,4 +99,30 @@ double HyperLogLog_cardinality(HyperLogLog *self);
  */
 int HyperLogLog_merge(HyperLogLog *self, HyperLogLog *hll);
 
+/* Merges other HyperLogLogs into the current HyperLogLog in a single pass. The others are unaffected.
+ * Returns 0 when successful, 1 when the sizes differ or memory runs out.
+ */
+int HyperLogLog_merge_many(HyperLogLog *self, HyperLogLog **hlls, size_t count);
+
+/* Gets a cardinality estimate of the union of estimators of the same size, without merging them.
+ * Returns -1 when the sizes differ or memory runs out.
+ */
+double HyperLogLog_union_cardinality(HyperLogLog **hlls, size_t count);
+
+/* Writes all registers into `registers` (2^k bytes), whatever the representation. */
+void HyperLogLog_registers(HyperLogLog *self, hll_cell_t *registers);
+
+/* Gets the number of bytes HyperLogLog_serialize writes. */
+size_t HyperLogLog_serialized_size(HyperLogLog *self);
+
+/* Writes a compact copy of the estimator: a versioned header followed by either the packed registers or,
+ * when shorter, the sparse list with entries stored as variable-length deltas. */
+void HyperLogLog_serialize(HyperLogLog *self, char *buffer);
+
+/* Replaces the state with a serialized copy of an estimator of the same size. Plain registers, one byte each
+ * as stored by older versions and in sketch files, are accepted too.
+ * Returns 0 when successful, 1 when the data is invalid or can not be stored.
+ */
+int HyperLogLog_deserialize(HyperLogLog *self, const char *buffer, size_t length);
+
 #endif
@@ -8,6 +8,9 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include "ht_basic.c"
+#include "ht_swiss.c"
+#include "ht_spacesaving.c"
+#include "ht_concurrent.c"
 
 #if PY_MAJOR_VERSION >= 3
 static PyModuleDef htc_module = {
@@ -35,7 +38,10 @@ PyMODINIT_FUNC initbounter_htc(void)
 #endif
 {
     PyObject* m;
-    if (PyType_Ready(&HT_BasicType) < 0 || PyType_Ready(&HT_Basic_ITER_TYPE_Type) < 0) {
+    if (PyType_Ready(&HT_BasicType) < 0 || PyType_Ready(&HT_Basic_ITER_TYPE_Type) < 0
+        || PyType_Ready(&HT_SwissType) < 0 || PyType_Ready(&HT_Swiss_ITER_TYPE_Type) < 0
+        || PyType_Ready(&HT_SpaceSavingType) < 0 || PyType_Ready(&HT_SpaceSaving_ITER_TYPE_Type) < 0
+        || PyType_Ready(&HT_ConcurrentType) < 0 || PyType_Ready(&HT_Concurrent_ITER_TYPE_Type) < 0) {
 
     #if PY_MAJOR_VERSION >= 3
         return NULL;
@@ -63,6 +69,24 @@ PyMODINIT_FUNC initbounter_htc(void)
     Py_INCREF(&HT_Basic_ITER_TYPE_Type);
     PyModule_AddObject(m, "HT_Basic_iter", (PyObject *)&HT_Basic_ITER_TYPE_Type);
 
+    Py_INCREF(&HT_SwissType);
+    PyModule_AddObject(m, "HT_Swiss", (PyObject *)&HT_SwissType);
+
+    Py_INCREF(&HT_Swiss_ITER_TYPE_Type);
+    PyModule_AddObject(m, "HT_Swiss_iter", (PyObject *)&HT_Swiss_ITER_TYPE_Type);
+
+    Py_INCREF(&HT_SpaceSavingType);
+    PyModule_AddObject(m, "HT_SpaceSaving", (PyObject *)&HT_SpaceSavingType);
+
+    Py_INCREF(&HT_SpaceSaving_ITER_TYPE_Type);
+    PyModule_AddObject(m, "HT_SpaceSaving_iter", (PyObject *)&HT_SpaceSaving_ITER_TYPE_Type);
+
+    Py_INCREF(&HT_ConcurrentType);
+    PyModule_AddObject(m, "HT_Concurrent", (PyObject *)&HT_ConcurrentType);
+
+    Py_INCREF(&HT_Concurrent_ITER_TYPE_Type);
+    PyModule_AddObject(m, "HT_Concurrent_iter", (PyObject *)&HT_Concurrent_ITER_TYPE_Type);
+
     #if PY_MAJOR_VERSION >= 3
     return m;
     #endif
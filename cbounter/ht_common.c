@@ -16,31 +16,238 @@
 #include "structmember.h"
 #include "murmur3.h"
 #include "hll.h"
+#include "combiner.h"
+#include "pages.h"
+#include "arena.h"
+#include "parallel.h"
 #include <string.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <limits.h>
 
+/* Keys of 1 to HT_INLINE_KEY_SIZE bytes without null bytes are stored zero-padded in place of the key pointer
+ * (of the same size on 64-bit platforms). Other keys point to their length followed by their bytes.
+ */
+#define HT_INLINE_KEY_SIZE 8
+#define HT_KEY_PREFIX sizeof(uint32_t)
+
+/* Formats of the keys in a pickled state. */
+#define HT_KEYS_TERMINATED 0
+#define HT_KEYS_PREFIXED 1
+
+/* Number of buckets an incremental prune visits for every new key, before it stops at the next empty bucket. */
+#define HT_PRUNE_STEP 32
+
+/* A parallel prune splits the table into this many ranges per thread, each of at least 2^HT_PRUNE_MIN_RANGE_BITS buckets. */
+#define HT_PRUNE_RANGES_PER_THREAD 4
+#define HT_PRUNE_MIN_RANGE_BITS 14
+
+/* A growable table starts with this many buckets, and moves this many buckets of the previous table for every new key. */
+#define HT_GROW_MIN_BUCKETS 1024
+#define HT_GROW_STEP 4
+
+/* A concurrent table counts the items given to update() in batches of this many, with the GIL released. */
+#define HT_BATCH_SIZE 1024
+
+/* Key of a bucket claimed by a thread which has yet to store the key. Neither a pointer nor an inline key, whose first
+ * byte is never 0, can take this value.
+ */
+#define HT_CLAIMED ((char *) (uintptr_t) 0x100)
+
+/* Failures of a concurrent table's thread without the GIL, raised as exceptions once it has the GIL back. */
+#define HT_ERROR_MEMORY 1
+#define HT_ERROR_OVERFLOW 2
+
+/* Marks the stored hash of an inline key. Bucket indices never use this bit, a table has at most 2^31 buckets. */
+#define HT_INLINE_FLAG 0x80000000u
+
+#ifndef HT_GROUP_WIDTH
+/* Control bytes of variants defining HT_CONTROL_BYTES: 0 marks an empty bucket, an allocated one holds HT_CTRL_FULL,
+ * HT_CTRL_INLINE for an inline key and a 6-bit tag of its hash. A group of HT_GROUP_WIDTH of them is matched at once.
+ */
+#define HT_CTRL_FULL 0x80
+#define HT_CTRL_INLINE 0x40
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HT_GROUP_WIDTH 16
+#define HT_GROUP_LANE_SHIFT 0
+typedef uint32_t ht_group_mask_t;
+
+/* Returns a mask with a bit set for every control byte of the group equal to the value. */
+static inline ht_group_mask_t ht_group_match(const uint8_t * ctrl, uint8_t value)
+{
+    __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+    return (ht_group_mask_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) value)));
+}
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define HT_GROUP_WIDTH 16
+#define HT_GROUP_LANE_SHIFT 2
+typedef uint64_t ht_group_mask_t;
+
+static inline ht_group_mask_t ht_group_match(const uint8_t * ctrl, uint8_t value)
+{
+    // there is no movemask, so every lane is narrowed to a nibble and only its top bit is kept
+    uint8x16_t equal = vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(value));
+    uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(equal), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x8888888888888888ULL;
+}
+#else
+#define HT_GROUP_WIDTH 8
+#define HT_GROUP_LANE_SHIFT 3
+typedef uint64_t ht_group_mask_t;
+
+static inline ht_group_mask_t ht_group_match(const uint8_t * ctrl, uint8_t value)
+{
+    uint64_t group = 0;
+    int i;
+    for (i = 0; i < HT_GROUP_WIDTH; i++)
+        group |= (uint64_t) ctrl[i] << (8 * i);
+
+    // sets the top bit of exactly those bytes which are zero after the xor
+    uint64_t x = group ^ (0x0101010101010101ULL * value);
+    uint64_t nonzero = ((x & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL) | x;
+    return ~nonzero & 0x8080808080808080ULL;
+}
+#endif
+
+/* Returns the position of the lowest lane set in a non-empty mask. */
+static inline uint32_t ht_group_lane(ht_group_mask_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (sizeof(mask) > 4 ? __builtin_ctzll(mask) : __builtin_ctz(mask)) >> HT_GROUP_LANE_SHIFT;
+#else
+    uint32_t bit = 0;
+    while (!(mask & 1))
+        mask >>= 1, bit++;
+    return bit >> HT_GROUP_LANE_SHIFT;
+#endif
+}
+#endif
+
+#ifndef HT_SS_NONE
+/* Variants defining HT_SPACE_SAVING group their keys by count: the nodes of the distinct counts form a list
+ * sorted by count, each holding a list of the buckets with that count, linked through the cells.
+ */
+#define HT_SS_NONE 0xFFFFFFFFu
+
+typedef struct {
+    long long count;
+    uint32_t first; // first bucket with this count
+    uint32_t prev; // node of the next lower count
+    uint32_t next; // node of the next higher count, or the next free node
+} ht_ss_node_t;
+
 typedef struct {
-    char* key;
     long long count;
+    uint32_t bucket;
+} ht_ss_entry_t;
+
+static int ht_ss_entry_compare(const void * a, const void * b)
+{
+    const ht_ss_entry_t * first = (const ht_ss_entry_t *) a;
+    const ht_ss_entry_t * second = (const ht_ss_entry_t *) b;
+    if (first->count != second->count)
+        return first->count < second->count ? -1 : 1;
+    return (first->bucket > second->bucket) - (first->bucket < second->bucket);
+}
+#endif
+
+typedef struct {
+    union {
+        char* key;
+        char inline_key[HT_INLINE_KEY_SIZE];
+    };
+    long long count;
+#ifdef HT_SPACE_SAVING
+    long long error; // how much of the count may come from the keys this one replaced
+    uint32_t prev; // previous bucket with the same count
+    uint32_t next; // next bucket with the same count
+    uint32_t node; // node of the count
+#endif
 } HT_VARIANT(_cell_t);
 
+/* Arrays of a table with a given number of buckets. */
+typedef struct {
+    HT_VARIANT(_cell_t) * table;
+    uint32_t * hashes;
+#ifdef HT_CONTROL_BYTES
+    uint8_t * ctrl;
+#endif
+    uint32_t buckets;
+} HT_VARIANT(_arrays_t);
+
 typedef struct {
     PyObject_HEAD
     uint32_t buckets;
     uint32_t hash_mask;
-    uint64_t str_allocated;
+    uint64_t str_allocated; // length of all keys stored in the arena, including their length prefixes
     long long total;
     uint32_t size; // number of allocated buckets
     HT_VARIANT(_cell_t) * table;
+    uint32_t * hashes; // hash of the key in each allocated bucket, tagged with HT_INLINE_FLAG, so that probes rarely touch the strings
+#ifdef HT_CONTROL_BYTES
+    uint8_t * ctrl; // control byte of each bucket, followed by copies of the first HT_GROUP_WIDTH ones
+#endif
+#ifdef HT_SPACE_SAVING
+    ht_ss_node_t * nodes; // one more than the keys the table holds, some of them free
+    uint32_t free_nodes;
+    uint32_t min_node;
+    uint32_t max_node;
+#endif
     uint32_t * histo;
     long long max_prune;
+    Arena keys; // storage of the key strings
     HyperLogLog hll;
+    Combiner buffer;
     char use_unicode;
+    char incremental_prune; // prune a few buckets per new key, starting before the table is full
+    uint32_t prune_threads; // number of threads pruning the whole table at once
+    // state of the running incremental prune, which sweeps the buckets following prune_start like _prune_int does
+    char pruning;
+    char prune_seed; // whether the prune seeds the HLL
+    long long prune_boundary;
+    uint32_t prune_start;
+    uint32_t prune_next; // next bucket to visit
+    uint32_t prune_visited; // buckets visited since prune_start, reaching `buckets` when the sweep is back at prune_start
+    Arena pruned_keys; // storage of the keys in buckets not visited yet, released when the prune ends
+    char growable; // start small and double up to max_buckets before pruning
+    uint32_t max_buckets;
+    // while a growable table doubles, the keys of the previous table are moved a few buckets per new key;
+    // keys moved ahead of the rest when they are updated leave a count of -1 behind
+    HT_VARIANT(_arrays_t) old;
+    uint32_t grow_next; // first bucket of the previous table not moved yet
+#ifdef HT_CONCURRENT
+    parallel_lock_t lock; // shared while keys are counted, exclusive while the table changes as a whole
+    parallel_lock_t keys_lock; // exclusive while the arena, str_allocated, histo, total or the HLL change
+#endif
 } HT_TYPE;
 
+#ifdef HT_CONCURRENT
+/* Changes of the statistics made by a thread counting into a concurrent table, applied at once under keys_lock. */
+typedef struct {
+    int32_t histo[256];
+    uint32_t histo_low; // range of the histogram entries changed
+    uint32_t histo_high;
+    long long total;
+    uint64_t hll[HT_BATCH_SIZE]; // HLL values of the new keys
+    uint32_t hll_count;
+    char gil; // whether the thread holds the GIL
+    char full; // no key can be added before the table is pruned
+    int error;
+} HT_VARIANT(_batch_t);
+#endif
+
+/* Methods which a concurrent table runs holding its lock exclusively. */
+#undef HT_LOCKED
+#ifdef HT_CONCURRENT
+#define HT_LOCKED(suffix) HT_VARIANT(suffix##_locked)
+#else
+#define HT_LOCKED(suffix) HT_VARIANT(suffix)
+#endif
+
 #define ITER_RESULT_KEYS 1
 #define ITER_RESULT_VALUES 2
 #define ITER_RESULT_KV_PAIRS 3
@@ -53,28 +260,82 @@ typedef struct {
   char result_type;
 } HT_VARIANT(_ITER_TYPE);
 
+static void HT_VARIANT(_arrays_free)(HT_VARIANT(_arrays_t) * arrays)
+{
+    free(arrays->table);
+    free(arrays->hashes);
+#ifdef HT_CONTROL_BYTES
+    free(arrays->ctrl);
+#endif
+    memset(arrays, 0, sizeof(HT_VARIANT(_arrays_t)));
+}
+
+/* Allocates the arrays of an empty table. Returns 0 when successful, 1 otherwise. */
+static int HT_VARIANT(_arrays_alloc)(HT_VARIANT(_arrays_t) * arrays, uint32_t buckets)
+{
+    arrays->buckets = buckets;
+    arrays->table = (HT_VARIANT(_cell_t) *) calloc(buckets, sizeof(HT_VARIANT(_cell_t)));
+    arrays->hashes = (uint32_t *) malloc((size_t) buckets * sizeof(uint32_t));
+    int allocated = arrays->table && arrays->hashes;
+#ifdef HT_CONTROL_BYTES
+    arrays->ctrl = (uint8_t *) calloc((size_t) buckets + HT_GROUP_WIDTH, 1);
+    allocated = allocated && arrays->ctrl;
+#endif
+    if (!allocated)
+        HT_VARIANT(_arrays_free)(arrays);
+    return !allocated;
+}
+
+/* Exchanges the arrays of the table for the given ones. */
+static void HT_VARIANT(_swap_arrays)(HT_TYPE * self, HT_VARIANT(_arrays_t) * arrays)
+{
+    HT_VARIANT(_arrays_t) current;
+    current.table = self->table;
+    current.hashes = self->hashes;
+#ifdef HT_CONTROL_BYTES
+    current.ctrl = self->ctrl;
+#endif
+    current.buckets = self->buckets;
+
+    self->table = arrays->table;
+    self->hashes = arrays->hashes;
+#ifdef HT_CONTROL_BYTES
+    self->ctrl = arrays->ctrl;
+#endif
+    self->buckets = arrays->buckets;
+    self->hash_mask = arrays->buckets - 1;
+    *arrays = current;
+}
+
+/* Returns the number of buckets the table starts with. */
+static inline uint32_t HT_VARIANT(_initial_buckets)(HT_TYPE * self)
+{
+    return (self->growable && self->max_buckets > HT_GROW_MIN_BUCKETS) ? HT_GROW_MIN_BUCKETS : self->max_buckets;
+}
+
 /* Destructor invoked by python. */
 static void
 HT_VARIANT(_dealloc)(HT_TYPE* self)
 {
-    HT_VARIANT(_cell_t) * table = self->table;
-    // free the strings
-    uint32_t i;
-    if (self->table)
-    {
-        for (i = 0; i < self->buckets; i++)
-        {
-            if (table[i].key)
-            {
-                free(table[i].key);
-            }
-        }
-    }
-
-    // free the hashtable and histogram
-    free(table);
+    // free the strings, hashtable and histogram
+    Arena_dealloc(&self->keys);
+    Arena_dealloc(&self->pruned_keys);
+    free(self->table);
+    free(self->hashes);
+#ifdef HT_CONTROL_BYTES
+    free(self->ctrl);
+#endif
+    HT_VARIANT(_arrays_free)(&self->old);
+#ifdef HT_SPACE_SAVING
+    free(self->nodes);
+#endif
     free(self->histo);
     HyperLogLog_dealloc(&self->hll);
+    Combiner_dealloc(&self->buffer);
+#ifdef HT_CONCURRENT
+    parallel_lock_destroy(&self->lock);
+    parallel_lock_destroy(&self->keys_lock);
+#endif
 
     // finally, destroy itself
     #if PY_MAJOR_VERSION >= 3
@@ -89,25 +350,56 @@ HT_VARIANT(_new)(PyTypeObject *type, PyObject *args, PyObject *kwds)
 {
     HT_TYPE *self;
     self = (HT_TYPE *)type->tp_alloc(type, 0);
+#ifdef HT_CONCURRENT
+    // the locks live as long as the object, the destructor runs even when __init__ has not
+    if (self)
+    {
+        parallel_lock_init(&self->lock);
+        parallel_lock_init(&self->keys_lock);
+    }
+#endif
     return (PyObject *)self;
 }
 
+#ifdef HT_SPACE_SAVING
+static int HT_VARIANT(_ss_init)(HT_TYPE *self);
+#endif
+
 static int
 HT_VARIANT(_init)(HT_TYPE *self, PyObject *args, PyObject *kwds)
 {
-    static char *kwlist[] = {"size_mb", "buckets", "use_unicode", NULL};
+    static char *kwlist[] = {"size_mb", "buckets", "use_unicode", "buffer_size", "hll_precision", "incremental_prune",
+                             "prune_threads", "growable", NULL};
     uint64_t size_mb = 0;
     long long w = 0;
     int use_unicode = 1;
+    uint32_t buffer_size = 0;
+    int hll_precision = HLL_DEFAULT_PRECISION;
+    int incremental_prune = 0;
+    unsigned int prune_threads = 1;
+    int growable = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|LLiIiiIi", kwlist,
+				      &size_mb, &w, &use_unicode, &buffer_size, &hll_precision, &incremental_prune,
+				      &prune_threads, &growable)) {
+        return -1;
+    }
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|LLi", kwlist,
-				      &size_mb, &w, &use_unicode)) {
+    if (hll_precision && (hll_precision < HLL_MIN_PRECISION || hll_precision > HLL_MAX_PRECISION))
+    {
+        char * msg = "HyperLogLog precision must be 0 or in the range 4-18";
+        PyErr_SetString(PyExc_ValueError, msg);
         return -1;
     }
 
     if (!w && size_mb)
     {
+#ifdef HT_SPACE_SAVING
+        // the count nodes come out of the same budget, there is one for every key in the worst case
+        w = (size_mb << 19) / (sizeof(HT_VARIANT(_cell_t)) + sizeof(ht_ss_node_t) * 3 / 4);
+#else
         w = (size_mb << 19) / sizeof(HT_VARIANT(_cell_t));
+#endif
     }
     if (!w)
     {
@@ -134,13 +426,48 @@ HT_VARIANT(_init)(HT_TYPE *self, PyObject *args, PyObject *kwds)
         hash_length++, w >>= 1;
     if (hash_length < 0)
         hash_length = 0;
-    self->buckets = 1 << hash_length;
-    self->hash_mask = self->buckets - 1;
+    self->max_buckets = 1 << hash_length;
 
-    self->use_unicode = use_unicode;
+#ifdef HT_SPACE_SAVING
+    if (incremental_prune)
+    {
+        char * msg = "A Space-Saving table replaces single keys, it does not prune incrementally.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
+    if (growable)
+    {
+        char * msg = "A Space-Saving table links its keys by bucket, it cannot grow.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
+#endif
+#ifdef HT_CONCURRENT
+    if (incremental_prune || growable || buffer_size)
+    {
+        char * msg = "A concurrent table is pruned and counted by several threads at once, it does not support "
+                     "incremental_prune, growable or buffer_size.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
+#endif
 
-    self->table = (HT_VARIANT(_cell_t) *) calloc(self->buckets, sizeof(HT_VARIANT(_cell_t)));
-    if (!self->table)
+    self->use_unicode = use_unicode;
+    self->incremental_prune = incremental_prune ? 1 : 0;
+    self->prune_threads = prune_threads ? prune_threads : parallel_cpu_count();
+    self->pruning = 0;
+    self->growable = growable ? 1 : 0;
+    Arena_init(&self->keys);
+    Arena_init(&self->pruned_keys);
+
+    HT_VARIANT(_arrays_t) arrays;
+    int allocated = !HT_VARIANT(_arrays_alloc)(&arrays, HT_VARIANT(_initial_buckets)(self));
+    if (allocated)
+        HT_VARIANT(_swap_arrays)(self, &arrays);
+#ifdef HT_SPACE_SAVING
+    allocated = allocated && !HT_VARIANT(_ss_init)(self);
+#endif
+    if (!allocated)
     {
         char * msg = "Unable to allocate a table with requested size!";
         PyErr_SetString(PyExc_MemoryError, msg);
@@ -152,7 +479,13 @@ HT_VARIANT(_init)(HT_TYPE *self, PyObject *args, PyObject *kwds)
     self->size = 0;
     self->max_prune = 0;
 
-    HyperLogLog_init(&self->hll, 16);
+    HyperLogLog_init(&self->hll, hll_precision);
+
+    if (buffer_size && Combiner_init(&self->buffer, buffer_size))
+    {
+        PyErr_NoMemory();
+        return -1;
+    }
 
     return 0;
 }
@@ -161,26 +494,201 @@ static PyMemberDef HT_VARIANT(_members[]) = {
     {NULL} /* Sentinel */
 };
 
-static inline uint32_t HT_VARIANT(_bucket)(HT_TYPE * self, char * data, Py_ssize_t dataLength, char store)
+static inline uint32_t HT_VARIANT(_hash)(const char * data, Py_ssize_t dataLength)
 {
-    uint32_t bucket;
-    MurmurHash3_x86_32((void *) data, dataLength, 42, (void *) &bucket);
-    if (store)
-        HyperLogLog_add(&self->hll, bucket);
-    bucket &= self->hash_mask;
-    return bucket;
+    uint32_t hash;
+    MurmurHash3_x86_32((void *) data, dataLength, 42, (void *) &hash);
+    return hash;
+}
+
+/* Returns the 64-bit hash of a key for the HLL, made of its table hash and, only when needed, a second hash. */
+static inline uint64_t HT_VARIANT(_hll_value)(HyperLogLog * hll, uint32_t hash, const char * data, Py_ssize_t dataLength)
+{
+    uint32_t second_hash = 0;
+    if (HyperLogLog_needs_low_bits(hll, hash))
+        MurmurHash3_x86_32((void *) data, dataLength, 43, (void *) &second_hash);
+    return ((uint64_t) hash << 32) | second_hash;
+}
+
+/* Adds a key to the HLL, returns 1 when out of memory and 0 otherwise. */
+static inline int HT_VARIANT(_hll_add)(HyperLogLog * hll, uint32_t hash, const char * data, Py_ssize_t dataLength)
+{
+    if (!hll->k)
+        return 0;
+    return HyperLogLog_add(hll, HT_VARIANT(_hll_value)(hll, hash, data, dataLength));
+}
+
+/* Returns the hash as stored in the table, with the flag telling whether the key is kept inline. */
+static inline uint32_t HT_VARIANT(_tag)(uint32_t hash, const char * data, Py_ssize_t dataLength)
+{
+#ifdef HT_CONCURRENT
+    // a concurrent table publishes a key with a single pointer store, so only keys of a pointer's size are kept inline
+    const Py_ssize_t inline_size = (sizeof(char *) < HT_INLINE_KEY_SIZE) ? sizeof(char *) : HT_INLINE_KEY_SIZE;
+#else
+    const Py_ssize_t inline_size = HT_INLINE_KEY_SIZE;
+#endif
+    return (dataLength && dataLength <= inline_size && !memchr(data, 0, dataLength))
+        ? hash | HT_INLINE_FLAG
+        : hash & ~HT_INLINE_FLAG;
+}
+
+/* Returns the length of a key stored out of line. */
+static inline uint32_t HT_VARIANT(_key_length)(const char * key)
+{
+    uint32_t length;
+    memcpy(&length, key, HT_KEY_PREFIX);
+    return length;
+}
+
+/* Compares a key stored out of line with the given one. */
+static inline int HT_VARIANT(_key_equals)(const char * key, const char * data, Py_ssize_t dataLength)
+{
+    return (Py_ssize_t) HT_VARIANT(_key_length)(key) == dataLength && !memcmp(key + HT_KEY_PREFIX, data, dataLength);
+}
+
+/* Returns the key of an allocated bucket, storing its length. */
+static inline const char * HT_VARIANT(_key)(HT_TYPE * self, uint32_t bucket, Py_ssize_t * dataLength)
+{
+    HT_VARIANT(_cell_t) * cell = &self->table[bucket];
+    if (self->hashes[bucket] & HT_INLINE_FLAG)
+    {
+        const char * end = memchr(cell->inline_key, 0, HT_INLINE_KEY_SIZE);
+        *dataLength = end ? end - cell->inline_key : HT_INLINE_KEY_SIZE;
+        return cell->inline_key;
+    }
+    *dataLength = HT_VARIANT(_key_length)(cell->key);
+    return cell->key + HT_KEY_PREFIX;
+}
+
+/* Returns a new reference to the key of an allocated bucket as a Python object. */
+static PyObject * HT_VARIANT(_key_object)(HT_TYPE * self, uint32_t bucket, int use_unicode)
+{
+    Py_ssize_t length;
+    const char * key = HT_VARIANT(_key)(self, bucket, &length);
+    return (use_unicode)
+        ? PyUnicode_DecodeUTF8(key, length, NULL)
+        #if PY_MAJOR_VERSION >= 3
+        : PyBytes_FromStringAndSize(key, length);
+        #else
+        : PyString_FromStringAndSize(key, length);
+        #endif
+}
+
+/* Returns the control byte of a key with the given stored hash. */
+static inline uint8_t HT_VARIANT(_ctrl_tag)(uint32_t tag)
+{
+    // the low bits pick the bucket, so the control tag is taken from a mix of all of them
+    return HT_CTRL_FULL | ((tag & HT_INLINE_FLAG) ? HT_CTRL_INLINE : 0) | ((tag * 0x9E3779B1u) >> 26);
 }
 
-static inline HT_VARIANT(_cell_t) * HT_VARIANT(_find_cell)(HT_TYPE * self, char * data, Py_ssize_t dataLength, char store)
+/* Updates the control byte of a bucket (and its copies past the end of the table) in variants which have them. */
+static inline void HT_VARIANT(_set_ctrl)(HT_TYPE * self, uint32_t bucket, uint8_t value)
 {
-    uint32_t bucket = HT_VARIANT(_bucket)(self, data, dataLength, store);
-    const HT_VARIANT(_cell_t) * table = self->table;
+#ifdef HT_CONTROL_BYTES
+    uint64_t copy;
+    self->ctrl[bucket] = value;
+    for (copy = (uint64_t) bucket + self->buckets; copy < (uint64_t) self->buckets + HT_GROUP_WIDTH; copy += self->buckets)
+        self->ctrl[copy] = value;
+#endif
+}
 
-    while (table[bucket].key && strcmp(table[bucket].key, data))
+/* Returns the number of keys the table holds before it prunes itself. */
+static inline uint32_t HT_VARIANT(_limit)(HT_TYPE * self)
+{
+#ifdef HT_CONTROL_BYTES
+    // group probing keeps long runs cheap, so the table gets fuller, always leaving a bucket empty
+    uint32_t spare = self->buckets >> 3;
+    return self->buckets - (spare ? spare : 1);
+#else
+    return (self->buckets >> 2) * 3;
+#endif
+}
+
+static inline HT_VARIANT(_cell_t) * HT_VARIANT(_find_cell_hashed)(HT_TYPE * self, uint32_t hash, const char * data, Py_ssize_t dataLength)
+{
+    uint32_t bucket = hash & self->hash_mask;
+    uint32_t tag = HT_VARIANT(_tag)(hash, data, dataLength);
+    HT_VARIANT(_cell_t) * table = self->table;
+
+#ifdef HT_CONTROL_BYTES
+    // probes whole groups, still in the order of linear probing so that the pruning stays the same;
+    // the control bytes tell inline keys apart, so candidates are compared without looking at their hashes
+    char inline_key[HT_INLINE_KEY_SIZE] = {0};
+    if (tag & HT_INLINE_FLAG)
+        memcpy(inline_key, data, dataLength);
+    uint8_t ctrl_tag = HT_VARIANT(_ctrl_tag)(tag);
+#if defined(__GNUC__) || defined(__clang__)
+    // the key is most likely in its home bucket, fetching it along with the control bytes overlaps both cache misses
+    __builtin_prefetch(&table[bucket]);
+#endif
+    for (;;)
     {
-        bucket = (bucket + 1) & self->hash_mask;
+        const uint8_t * group = self->ctrl + bucket;
+        ht_group_mask_t matches = ht_group_match(group, ctrl_tag);
+        while (matches)
+        {
+            uint32_t candidate = (bucket + ht_group_lane(matches)) & self->hash_mask;
+            if ((tag & HT_INLINE_FLAG)
+                    ? !memcmp(table[candidate].inline_key, inline_key, HT_INLINE_KEY_SIZE)
+                    : HT_VARIANT(_key_equals)(table[candidate].key, data, dataLength))
+                return &table[candidate];
+            matches &= matches - 1;
+        }
+        ht_group_mask_t empty = ht_group_match(group, 0);
+        if (empty)
+            return &table[(bucket + ht_group_lane(empty)) & self->hash_mask];
+        bucket = (bucket + HT_GROUP_WIDTH) & self->hash_mask;
+    }
+#else
+    uint32_t * hashes = self->hashes;
+    if (tag & HT_INLINE_FLAG)
+    {
+        // a matching hash means the cell holds an inline key as well, which is compared without leaving the table
+        char inline_key[HT_INLINE_KEY_SIZE] = {0};
+        memcpy(inline_key, data, dataLength);
+        while (table[bucket].key && (hashes[bucket] != tag || memcmp(table[bucket].inline_key, inline_key, HT_INLINE_KEY_SIZE)))
+        {
+            bucket = (bucket + 1) & self->hash_mask;
+        }
+    }
+    else
+    {
+        while (table[bucket].key && (hashes[bucket] != tag || !HT_VARIANT(_key_equals)(table[bucket].key, data, dataLength)))
+        {
+            bucket = (bucket + 1) & self->hash_mask;
+        }
     }
     return &table[bucket];
+#endif
+}
+
+/* Returns the cell of a key still waiting in the previous table of a growing table, or NULL. */
+static HT_VARIANT(_cell_t) * HT_VARIANT(_find_old)(HT_TYPE * self, uint32_t hash, const char * data, Py_ssize_t dataLength)
+{
+    // the previous table is searched by swapping it in, moved keys are still there to keep the probe sequences intact
+    HT_VARIANT(_swap_arrays)(self, &self->old);
+    HT_VARIANT(_cell_t) * cell = HT_VARIANT(_find_cell_hashed)(self, hash, data, dataLength);
+    uint32_t bucket = cell - self->table;
+    HT_VARIANT(_swap_arrays)(self, &self->old);
+    return (cell->key && cell->count >= 0 && bucket >= self->grow_next) ? cell : NULL;
+}
+
+/* Returns the cell of a key in the table, or in the previous table while it grows, or an empty cell. */
+static inline HT_VARIANT(_cell_t) * HT_VARIANT(_lookup_hashed)(HT_TYPE * self, uint32_t hash, const char * data, Py_ssize_t dataLength)
+{
+    HT_VARIANT(_cell_t) * cell = HT_VARIANT(_find_cell_hashed)(self, hash, data, dataLength);
+    if (!cell->key && self->old.table)
+    {
+        HT_VARIANT(_cell_t) * old = HT_VARIANT(_find_old)(self, hash, data, dataLength);
+        if (old)
+            return old;
+    }
+    return cell;
+}
+
+static inline HT_VARIANT(_cell_t) * HT_VARIANT(_find_cell)(HT_TYPE * self, char * data, Py_ssize_t dataLength)
+{
+    return HT_VARIANT(_lookup_hashed)(self, HT_VARIANT(_hash)(data, dataLength), data, dataLength);
 }
 
 static inline uint8_t HT_VARIANT(_histo_addr)(long long value)
@@ -202,7 +710,15 @@ static inline uint8_t HT_VARIANT(_histo_addr)(long long value)
     return (log_result << 3) + (h & 7);
 }
 
-static void HT_VARIANT(_prune_int)(HT_TYPE *self, long long boundary);
+static void HT_VARIANT(_prune_int)(HT_TYPE *self, long long boundary, uint32_t threads);
+static void HT_VARIANT(_prune_begin)(HT_TYPE *self, long long boundary);
+static void HT_VARIANT(_prune_step)(HT_TYPE *self, uint32_t work);
+static void HT_VARIANT(_finish_prune)(HT_TYPE *self);
+static int HT_VARIANT(_prune_some)(HT_TYPE *self);
+#ifdef HT_SPACE_SAVING
+static long long HT_VARIANT(_ss_evict_min)(HT_TYPE *self);
+static void HT_VARIANT(_ss_link)(HT_TYPE *self, uint32_t bucket, uint32_t near);
+#endif
 
 static long long HT_VARIANT(_prune_size)(HT_TYPE * self)
 {
@@ -219,46 +735,589 @@ static long long HT_VARIANT(_prune_size)(HT_TYPE * self)
     return boundary - 1;
 }
 
+/* Returns the number of keys at which an incremental prune starts, leaving it an eighth of the table to finish. */
+static inline uint32_t HT_VARIANT(_prune_threshold)(HT_TYPE * self)
+{
+    uint32_t margin = self->buckets >> 3;
+    return HT_VARIANT(_limit)(self) - (margin ? margin : 1);
+}
 
-static inline HT_VARIANT(_cell_t) * HT_VARIANT(_allocate_cell)(HT_TYPE * self, char * data, Py_ssize_t dataLength)
+/* Tells whether the running incremental prune has yet to visit the bucket. */
+static inline int HT_VARIANT(_prune_ahead)(HT_TYPE * self, uint32_t bucket)
+{
+    return self->pruning && ((bucket - self->prune_start - 1) & self->hash_mask) >= self->prune_visited;
+}
+
+/* Moves a key of the previous table into the given empty bucket, which its probe sequence leads to. */
+static inline void HT_VARIANT(_move_old)(HT_TYPE * self, HT_VARIANT(_cell_t) * old, uint32_t bucket)
+{
+    uint32_t tag = self->old.hashes[old - self->old.table];
+    self->table[bucket] = *old;
+    self->hashes[bucket] = tag;
+    HT_VARIANT(_set_ctrl)(self, bucket, HT_VARIANT(_ctrl_tag)(tag));
+}
+
+/* Moves the keys of the next `work` buckets of the previous table, releasing it once all have been moved. */
+static void HT_VARIANT(_grow_step)(HT_TYPE * self, uint32_t work)
+{
+    HT_VARIANT(_cell_t) * table = self->table;
+    HT_VARIANT(_cell_t) * old = self->old.table;
+    uint32_t end = (self->old.buckets - self->grow_next > work) ? self->grow_next + work : self->old.buckets;
+    uint32_t i;
+    for (i = self->grow_next; i < end; i++)
+    {
+        if (old[i].key && old[i].count >= 0)
+        {
+            // keys are unique, so the key goes to the first empty bucket of its probe sequence
+            uint32_t bucket = self->old.hashes[i] & self->hash_mask;
+            while (table[bucket].key)
+                bucket = (bucket + 1) & self->hash_mask;
+            HT_VARIANT(_move_old)(self, &old[i], bucket);
+        }
+    }
+    self->grow_next = end;
+    if (end == self->old.buckets)
+        HT_VARIANT(_arrays_free)(&self->old);
+}
+
+/* Moves all keys left in the previous table, if any. */
+static void HT_VARIANT(_finish_grow)(HT_TYPE * self)
+{
+    if (self->old.table)
+        HT_VARIANT(_grow_step)(self, self->old.buckets);
+}
+
+/**
+  * Doubles a growable table which has not reached max_buckets yet. Its keys are moved into the new table a few buckets
+  * per new key, so that no single operation rehashes the whole table. Returns 1 if the table has grown, 0 otherwise.
+  */
+static int HT_VARIANT(_grow)(HT_TYPE * self)
+{
+    if (self->buckets >= self->max_buckets)
+        return 0;
+    HT_VARIANT(_finish_grow)(self);
+
+    HT_VARIANT(_arrays_t) arrays;
+    if (HT_VARIANT(_arrays_alloc)(&arrays, self->buckets << 1))
+    {
+        // without memory for a larger table, the table prunes at its current size from now on
+        self->max_buckets = self->buckets;
+        return 0;
+    }
+    HT_VARIANT(_swap_arrays)(self, &arrays);
+    self->old = arrays;
+    self->grow_next = 0;
+    return 1;
+}
+
+/**
+  * Returns the cell of a key, adding the key if it is missing, which may grow or prune the table. A new key is added to
+  * the HLL with `track`, unless a merge has added it already. Returns NULL when out of memory, without an exception,
+  * so that the merge of a concurrent table can add keys without the GIL.
+  */
+static inline HT_VARIANT(_cell_t) * HT_VARIANT(_allocate_cell_hashed)(HT_TYPE * self, uint32_t hash, const char * data,
+                                                                      Py_ssize_t dataLength, int track)
 {
-    HT_VARIANT(_cell_t) * cell = HT_VARIANT(_find_cell)(self, data, dataLength, 1);
+    HT_VARIANT(_cell_t) * cell = HT_VARIANT(_find_cell_hashed)(self, hash, data, dataLength);
+
+    if (!cell->key && self->old.table)
+    {
+        // a key of the previous table is moved ahead of the others, where it has been looked for
+        HT_VARIANT(_cell_t) * old = HT_VARIANT(_find_old)(self, hash, data, dataLength);
+        if (old)
+        {
+            HT_VARIANT(_move_old)(self, old, cell - self->table);
+            old->count = -1;
+            return cell;
+        }
+    }
 
     if (!cell->key)
     {
-        if (self->size >= (self->buckets >> 2) * 3)
+        long long initial = 0;
+        if (self->size >= HT_VARIANT(_limit)(self))
         {
-            HT_VARIANT(_prune_int)(self, HT_VARIANT(_prune_size)(self));
+            if (!HT_VARIANT(_grow)(self))
+            {
+#ifdef HT_SPACE_SAVING
+                // the new key takes over the count of the key it replaces
+                initial = HT_VARIANT(_ss_evict_min)(self);
+#else
+                // an incremental prune which did not keep up is finished first, it may have made enough room
+                HT_VARIANT(_finish_prune)(self);
+                if (self->size >= HT_VARIANT(_limit)(self))
+                    HT_VARIANT(_prune_int)(self, HT_VARIANT(_prune_size)(self), self->prune_threads);
+#endif
+            }
             // After pruning, we have to look for the ideal spot again, since a better slot might have opened
-            cell = HT_VARIANT(_find_cell)(self, data, dataLength, 0);
+            cell = HT_VARIANT(_find_cell_hashed)(self, hash, data, dataLength);
         }
+        else if (self->old.table)
+        {
+            HT_VARIANT(_grow_step)(self, HT_GROW_STEP);
+            cell = HT_VARIANT(_find_cell_hashed)(self, hash, data, dataLength);
+        }
+        else if (self->incremental_prune && self->buckets == self->max_buckets && HT_VARIANT(_prune_some)(self))
+        {
+            cell = HT_VARIANT(_find_cell_hashed)(self, hash, data, dataLength);
+        }
+        // Keys already in the table have been counted, and until the first prune seeds the HLL
+        // with the table's contents, nothing has to be counted at all
+        if (self->max_prune && track && HT_VARIANT(_hll_add)(&self->hll, hash, data, dataLength))
+            return NULL;
 
+        uint32_t tag = HT_VARIANT(_tag)(hash, data, dataLength);
+        if (tag & HT_INLINE_FLAG)
+        {
+            cell->key = NULL;
+            memcpy(cell->inline_key, data, dataLength);
+        }
+        else
+        {
+            // the running prune moves the keys it visits out of pruned_keys, this one included
+            Arena * arena = HT_VARIANT(_prune_ahead)(self, cell - self->table) ? &self->pruned_keys : &self->keys;
+            char * key = Arena_alloc(arena, HT_KEY_PREFIX + dataLength);
+            if (!key)
+                return NULL;
+            uint32_t length = dataLength;
+            self->str_allocated += HT_KEY_PREFIX + dataLength;
+            memcpy(key, &length, HT_KEY_PREFIX);
+            memcpy(key + HT_KEY_PREFIX, data, dataLength);
+            cell->key = key;
+        }
         self->size += 1;
-        self->str_allocated += dataLength + 1;
-        char * key = malloc(dataLength + 1);
-        memcpy(key, data, dataLength + 1);
-        cell->key = key;
-        cell->count = 0;
-        self->histo[0] += 1;
+        cell->count = initial;
+        self->hashes[cell - self->table] = tag;
+        HT_VARIANT(_set_ctrl)(self, cell - self->table, HT_VARIANT(_ctrl_tag)(tag));
+        self->histo[HT_VARIANT(_histo_addr)(initial)] += 1;
+#ifdef HT_SPACE_SAVING
+        cell->error = initial;
+        HT_VARIANT(_ss_link)(self, cell - self->table, self->min_node);
+#endif
     }
     return cell;
 }
 
-static void HT_VARIANT(_prune_int)(HT_TYPE *self, long long boundary)
+static inline HT_VARIANT(_cell_t) * HT_VARIANT(_allocate_cell)(HT_TYPE * self, char * data, Py_ssize_t dataLength)
+{
+    return HT_VARIANT(_allocate_cell_hashed)(self, HT_VARIANT(_hash)(data, dataLength), data, dataLength, 1);
+}
+
+/* Copies the keys stored out of line in buckets from+1 to `to` (modulo the table size) into the arena. */
+static void HT_VARIANT(_compact_range)(HT_TYPE *self, uint64_t from, uint64_t to, Arena * arena)
 {
     HT_VARIANT(_cell_t) * table = self->table;
-    uint32_t * histo = self->histo;
+    uint64_t position;
+    for (position = from + 1; position <= to; position++)
+    {
+        uint32_t i = position & self->hash_mask;
+        char * key = table[i].key;
+        if (key && !(self->hashes[i] & HT_INLINE_FLAG))
+        {
+            size_t length = HT_KEY_PREFIX + HT_VARIANT(_key_length)(key);
+            table[i].key = Arena_alloc(arena, length);
+            memcpy(table[i].key, key, length);
+        }
+    }
+}
+
+/* Empties a bucket whose key is pruned. Returns the number of bytes the key took in the arena. */
+static inline uint32_t HT_VARIANT(_evict)(HT_TYPE *self, uint32_t i)
+{
+    uint32_t freed = (self->hashes[i] & HT_INLINE_FLAG) ? 0 : HT_KEY_PREFIX + HT_VARIANT(_key_length)(self->table[i].key);
+    HT_VARIANT(_set_ctrl)(self, i, 0);
+    self->table[i].key = NULL;
+    self->table[i].count = 0;
+    return freed;
+}
+
+/* Moves the key in bucket i to the first empty bucket between its home bucket and i, given that no bucket after
+ * last_free is empty. Returns 1 if the key has moved, 0 otherwise.
+ */
+static inline int HT_VARIANT(_relocate)(HT_TYPE *self, uint32_t i, uint32_t last_free)
+{
+    HT_VARIANT(_cell_t) * table = self->table;
+    uint32_t mask = self->hash_mask;
+    uint32_t hash = self->hashes[i];
+    uint32_t replace = hash & mask;
+
+    if (((i - last_free) & mask) > ((i - replace) & mask))
+        return 0;
+
+    while (replace != i && table[replace].key)
+        replace = (replace + 1) & mask;
+
+    if (replace == i)
+        return 0;
+
+    table[replace] = table[i];
+    self->hashes[replace] = hash;
+    HT_VARIANT(_set_ctrl)(self, replace, HT_VARIANT(_ctrl_tag)(hash));
+    HT_VARIANT(_set_ctrl)(self, i, 0);
+    table[i].key = NULL;
+    table[i].count = 0;
+    return 1;
+}
+
+/* Adds a key in the table to the HLL. Prunes have no way to fail, so a key which the HLL has no memory for is not counted. */
+static inline void HT_VARIANT(_seed)(HT_TYPE *self, HyperLogLog * hll, uint32_t i)
+{
+    // the stored hash lacks its top bit, which the HLL needs
+    Py_ssize_t data_length;
+    const char * data = HT_VARIANT(_key)(self, i, &data_length);
+    HT_VARIANT(_hll_add)(hll, HT_VARIANT(_hash)(data, data_length), data, data_length);
+}
+
+/* Outcome of pruning the buckets between two empty ones. */
+typedef struct {
+    uint32_t histo[256];
+    uint32_t size; // number of keys kept
+    uint64_t freed; // arena bytes of the evicted keys
+    uint64_t kept; // arena bytes of the kept keys
+    HyperLogLog * seed; // HLL to add all keys to, or NULL
+    HyperLogLog hll; // the range's own HLL, when seeding in parallel
+    Arena keys; // the kept keys, when compacting in parallel
+} HT_VARIANT(_range_t);
+
+/* Prunes buckets from+1 to `to` (modulo the table size), where `from` is an empty bucket. */
+static void HT_VARIANT(_prune_range)(HT_TYPE *self, uint64_t from, uint64_t to, long long boundary,
+                                     HT_VARIANT(_range_t) * range)
+{
+    HT_VARIANT(_cell_t) * table = self->table;
+    uint32_t * histo = range->histo;
+    HyperLogLog * seed = range->seed;
+    uint32_t mask = self->hash_mask;
+    uint32_t i = from & mask;
+    uint32_t last_free = i;
     uint32_t size = 0;
-    uint32_t start = 0;
+    uint64_t freed = 0;
+    uint64_t kept = 0;
+    uint64_t remaining;
+
+    for (remaining = to - from; remaining; remaining--)
+    {
+        i = (i + 1) & mask;
+        char * current_key = table[i].key;
+        if (current_key)
+        {
+            long long current_count = table[i].count;
+
+            if (seed)
+                HT_VARIANT(_seed)(self, seed, i);
+
+            if (current_count > boundary)
+            {
+                if (!(self->hashes[i] & HT_INLINE_FLAG))
+                    kept += HT_KEY_PREFIX + HT_VARIANT(_key_length)(current_key);
+                if (HT_VARIANT(_relocate)(self, i, last_free))
+                    last_free = i;
+
+                histo[HT_VARIANT(_histo_addr)(current_count)] += 1;
+                size++;
+            }
+            else
+            {
+                freed += HT_VARIANT(_evict)(self, i);
+                last_free = i;
+            }
+        }
+        else
+        {
+            last_free = i;
+        }
+    }
+
+    range->size = size;
+    range->freed = freed;
+    range->kept = kept;
+}
+
+typedef struct {
+    HT_TYPE * self;
+    long long boundary;
+    uint64_t * bounds; // range i spans the buckets after bounds[i] up to bounds[i + 1]
+    HT_VARIANT(_range_t) * ranges;
+} HT_VARIANT(_prune_job_t);
+
+static void HT_VARIANT(_prune_task)(void * context, uint32_t index)
+{
+    HT_VARIANT(_prune_job_t) * job = (HT_VARIANT(_prune_job_t) *) context;
+    HT_VARIANT(_prune_range)(job->self, job->bounds[index], job->bounds[index + 1], job->boundary, &job->ranges[index]);
+}
+
+static void HT_VARIANT(_compact_task)(void * context, uint32_t index)
+{
+    HT_VARIANT(_prune_job_t) * job = (HT_VARIANT(_prune_job_t) *) context;
+    HT_VARIANT(_compact_range)(job->self, job->bounds[index], job->bounds[index + 1], &job->ranges[index].keys);
+}
+
+/* Moves the keys still in the table into a fresh arena, releasing the space of removed keys.
+ * The ranges are compacted in parallel, each into its own arena, which are merged afterwards.
+ */
+static void HT_VARIANT(_compact_ranges)(HT_VARIANT(_prune_job_t) * job, uint32_t count, uint32_t threads)
+{
+    HT_TYPE * self = job->self;
+    if (self->keys.used == self->str_allocated)
+        return;
+
+    uint32_t r;
+    int failed = 0;
+    for (r = 0; r < count && !failed; r++)
+        failed = job->ranges[r].kept && Arena_reserve(&job->ranges[r].keys, job->ranges[r].kept);
+    if (!failed)
+    {
+        parallel_for(threads, count, HT_VARIANT(_compact_task), job);
+        Arena_dealloc(&self->keys);
+    }
+
+    // the removed keys stay around until the next prune when there is no memory for the copy
+    for (r = 0; r < count; r++)
+    {
+        if (failed)
+            Arena_dealloc(&job->ranges[r].keys);
+        else
+            Arena_merge(&self->keys, &job->ranges[r].keys);
+    }
+}
+
+#ifdef HT_SPACE_SAVING
+/* Puts all nodes on the free list, for a table whose keys are not linked yet. */
+static void HT_VARIANT(_ss_reset)(HT_TYPE *self)
+{
+    uint32_t count = HT_VARIANT(_limit)(self) + 1;
+    uint32_t n;
+    for (n = 0; n < count; n++)
+        self->nodes[n].next = (n + 1 < count) ? n + 1 : HT_SS_NONE;
+    self->free_nodes = 0;
+    self->min_node = HT_SS_NONE;
+    self->max_node = HT_SS_NONE;
+}
+
+/* Allocates the nodes, enough for each key to have a count of its own. Returns 0 when successful, 1 otherwise. */
+static int HT_VARIANT(_ss_init)(HT_TYPE *self)
+{
+    self->nodes = (ht_ss_node_t *) malloc(((size_t) HT_VARIANT(_limit)(self) + 1) * sizeof(ht_ss_node_t));
+    if (!self->nodes)
+        return 1;
+    HT_VARIANT(_ss_reset)(self);
+    return 0;
+}
+
+/* Adds the bucket to the front of the list of its count, looking for the node of the count from node `near`. */
+static void HT_VARIANT(_ss_link)(HT_TYPE *self, uint32_t bucket, uint32_t near)
+{
+    ht_ss_node_t * nodes = self->nodes;
+    HT_VARIANT(_cell_t) * table = self->table;
+    long long count = table[bucket].count;
+    uint32_t prev; // node of the highest count below this one
+    uint32_t next; // node of the lowest count at or above this one
+
+    if (near == HT_SS_NONE)
+        prev = HT_SS_NONE, next = self->min_node;
+    else if (nodes[near].count < count)
+        prev = near, next = nodes[near].next;
+    else
+        prev = nodes[near].prev, next = near;
+    while (next != HT_SS_NONE && nodes[next].count < count)
+        prev = next, next = nodes[next].next;
+    while (prev != HT_SS_NONE && nodes[prev].count >= count)
+        next = prev, prev = nodes[prev].prev;
+
+    uint32_t node = next;
+    if (node == HT_SS_NONE || nodes[node].count != count)
+    {
+        node = self->free_nodes;
+        self->free_nodes = nodes[node].next;
+        nodes[node].count = count;
+        nodes[node].first = HT_SS_NONE;
+        nodes[node].prev = prev;
+        nodes[node].next = next;
+        if (prev != HT_SS_NONE)
+            nodes[prev].next = node;
+        else
+            self->min_node = node;
+        if (next != HT_SS_NONE)
+            nodes[next].prev = node;
+        else
+            self->max_node = node;
+    }
+
+    table[bucket].node = node;
+    table[bucket].prev = HT_SS_NONE;
+    table[bucket].next = nodes[node].first;
+    if (nodes[node].first != HT_SS_NONE)
+        table[nodes[node].first].prev = bucket;
+    nodes[node].first = bucket;
+}
+
+/* Removes the bucket from the list of its count, releasing the node left without buckets.
+ * Returns a node next to where the count was, to look for the new count from.
+ */
+static uint32_t HT_VARIANT(_ss_unlink)(HT_TYPE *self, uint32_t bucket)
+{
+    ht_ss_node_t * nodes = self->nodes;
+    HT_VARIANT(_cell_t) * table = self->table;
+    HT_VARIANT(_cell_t) * cell = &table[bucket];
+    uint32_t node = cell->node;
+
+    if (cell->prev != HT_SS_NONE)
+        table[cell->prev].next = cell->next;
+    else
+        nodes[node].first = cell->next;
+    if (cell->next != HT_SS_NONE)
+        table[cell->next].prev = cell->prev;
+    if (nodes[node].first != HT_SS_NONE)
+        return node;
+
+    uint32_t prev = nodes[node].prev;
+    uint32_t next = nodes[node].next;
+    if (prev != HT_SS_NONE)
+        nodes[prev].next = next;
+    else
+        self->min_node = next;
+    if (next != HT_SS_NONE)
+        nodes[next].prev = prev;
+    else
+        self->max_node = prev;
+    nodes[node].next = self->free_nodes;
+    self->free_nodes = node;
+    return (prev != HT_SS_NONE) ? prev : next;
+}
+
+/* Points the neighbours of a key which has just been moved into the bucket at its new place. */
+static inline void HT_VARIANT(_ss_moved)(HT_TYPE *self, uint32_t bucket)
+{
+    HT_VARIANT(_cell_t) * table = self->table;
+    HT_VARIANT(_cell_t) * cell = &table[bucket];
+    if (cell->prev != HT_SS_NONE)
+        table[cell->prev].next = bucket;
+    else
+        self->nodes[cell->node].first = bucket;
+    if (cell->next != HT_SS_NONE)
+        table[cell->next].prev = bucket;
+}
+
+/* Links all keys anew, after a prune or a pickle has moved them. */
+static void HT_VARIANT(_ss_rebuild)(HT_TYPE *self)
+{
+    HT_VARIANT(_cell_t) * table = self->table;
+    uint32_t i;
+    uint32_t n = 0;
+
+    HT_VARIANT(_ss_reset)(self);
+    ht_ss_entry_t * entries = (ht_ss_entry_t *) malloc(((size_t) self->size + 1) * sizeof(ht_ss_entry_t));
+    if (!entries)
+    {
+        // linking the keys in bucket order needs no memory, but walks the counts
+        for (i = 0; i < self->buckets; i++)
+        {
+            if (table[i].key)
+                HT_VARIANT(_ss_link)(self, i, self->max_node);
+        }
+        return;
+    }
+
+    for (i = 0; i < self->buckets && n < self->size; i++)
+    {
+        if (table[i].key)
+        {
+            entries[n].count = table[i].count;
+            entries[n].bucket = i;
+            n++;
+        }
+    }
+    qsort(entries, n, sizeof(ht_ss_entry_t), ht_ss_entry_compare);
+    // from the highest count down, every key goes to the lowest node, so no counts are walked
+    while (n--)
+        HT_VARIANT(_ss_link)(self, entries[n].bucket, self->min_node);
+    free(entries);
+}
+
+/* Moves the keys still in the table into a fresh arena, releasing the space of evicted keys. */
+static void HT_VARIANT(_compact_keys)(HT_TYPE *self)
+{
+    HT_VARIANT(_range_t) range;
+    uint64_t bounds[2] = {0, self->buckets};
+    HT_VARIANT(_prune_job_t) job = {self, 0, bounds, &range};
+    range.kept = self->str_allocated;
+    Arena_init(&range.keys);
+    HT_VARIANT(_compact_ranges)(&job, 1, 1);
+}
+
+/**
+  * Removes the key with the lowest count, whose count is returned for the new key to take over as its error.
+  * The keys following it are shifted back as in a deletion from any linear probing table, so that no other
+  * key is touched. The space of evicted keys is reclaimed once it outgrows the space of the keys in the table.
+  */
+static long long HT_VARIANT(_ss_evict_min)(HT_TYPE *self)
+{
+    HT_VARIANT(_cell_t) * table = self->table;
     uint32_t mask = self->hash_mask;
+    uint32_t i = self->nodes[self->min_node].first;
+    long long count = table[i].count;
+
+    // deleted keys go first, they are no longer counted
+    if (count > 0)
+    {
+        // the first eviction seeds the HLL with all keys seen so far, as the first prune does
+        if (!self->max_prune && self->hll.k)
+        {
+            uint32_t j;
+            for (j = 0; j < self->buckets; j++)
+            {
+                if (table[j].key)
+                    HT_VARIANT(_seed)(self, &self->hll, j);
+            }
+        }
+        if (count > self->max_prune)
+            self->max_prune = count;
+    }
+
+    HT_VARIANT(_ss_unlink)(self, i);
+    self->histo[HT_VARIANT(_histo_addr)(count)] -= 1;
+    self->size -= 1;
+    self->str_allocated -= HT_VARIANT(_evict)(self, i);
+
+    uint32_t j = (i + 1) & mask;
+    while (table[j].key)
+    {
+        // the key may fill the gap unless its home bucket lies between the gap and the key
+        if (((j - self->hashes[j]) & mask) >= ((j - i) & mask))
+        {
+            table[i] = table[j];
+            self->hashes[i] = self->hashes[j];
+            HT_VARIANT(_ss_moved)(self, i);
+            table[j].key = NULL;
+            table[j].count = 0;
+            i = j;
+        }
+        j = (j + 1) & mask;
+    }
+
+    if (self->keys.used - self->str_allocated > self->str_allocated + (uint64_t) self->buckets * HT_KEY_PREFIX)
+        HT_VARIANT(_compact_keys)(self);
+    return count;
+}
+#endif
+
+/**
+  * Removes all keys counted `boundary` or less, moving the others closer to their home buckets.
+  * Keys never move past an empty bucket, so the ranges between empty buckets are pruned independently, on up to
+  * `threads` threads, with the same result as a single sweep. The calling thread keeps the GIL (or, in a concurrent
+  * table, the exclusive lock) meanwhile, so that no other thread can use the table while its keys move.
+  */
+static void HT_VARIANT(_prune_int)(HT_TYPE *self, long long boundary, uint32_t threads)
+{
+    HT_VARIANT(_finish_grow)(self);
+    HT_VARIANT(_cell_t) * table = self->table;
+    uint32_t start = 0;
+    uint32_t r;
+    // the first prune seeds the HLL with all keys seen so far, which are still in the table
+    char seed = !self->max_prune && self->hll.k;
 
     if (boundary > self->max_prune)
         self->max_prune = boundary;
 
-    uint32_t i;
-    for (i = 0; i < 256; i++)
-        histo[i] = 0;
-
     // find first empty row and iterate from there
     // if we start from an empty row, hashes from all successive allocated buckets
     // are guaranteed to point "after" this row which ensures the invariant that
@@ -266,57 +1325,564 @@ static void HT_VARIANT(_prune_int)(HT_TYPE *self, long long boundary)
     while (table[start].key)
         start++;
 
-    i = start;
-    uint32_t last_free = start;
-    do
+    // every range gets enough buckets to be worth a thread, and there are a few ranges per thread to balance the load
+    uint32_t count = (threads > 1) ? threads * HT_PRUNE_RANGES_PER_THREAD : 1;
+    if (count > (self->buckets >> HT_PRUNE_MIN_RANGE_BITS))
+        count = (self->buckets >> HT_PRUNE_MIN_RANGE_BITS) ? self->buckets >> HT_PRUNE_MIN_RANGE_BITS : 1;
+
+    HT_VARIANT(_range_t) single;
+    uint64_t single_bounds[2];
+    HT_VARIANT(_prune_job_t) job = {self, boundary, single_bounds, &single};
+    if (count > 1)
     {
-        i = (i + 1) & mask;
-        char * current_key = table[i].key;
-        if (current_key)
+        job.bounds = (uint64_t *) malloc((count + 1) * sizeof(uint64_t));
+        job.ranges = (HT_VARIANT(_range_t) *) malloc(count * sizeof(HT_VARIANT(_range_t)));
+        if (!job.bounds || !job.ranges)
         {
-            Py_ssize_t data_length = strlen(current_key);
-            long long current_count = table[i].count;
+            free(job.bounds);
+            free(job.ranges);
+            job.bounds = single_bounds;
+            job.ranges = &single;
+            count = 1;
+        }
+    }
 
-            if (current_count > boundary)
+    // each range ends with an empty bucket, the last one with `start`
+    uint64_t end = (uint64_t) start + self->buckets;
+    job.bounds[0] = start;
+    for (r = 1; r < count; r++)
+    {
+        uint64_t bound = start + (uint64_t) self->buckets * r / count;
+        if (bound < job.bounds[r - 1])
+            bound = job.bounds[r - 1];
+        while (bound < end && table[bound & self->hash_mask].key)
+            bound++;
+        job.bounds[r] = bound;
+    }
+    job.bounds[count] = end;
+
+    for (r = 0; r < count; r++)
+    {
+        HT_VARIANT(_range_t) * range = &job.ranges[r];
+        memset(range->histo, 0, sizeof(range->histo));
+        range->size = 0;
+        range->freed = 0;
+        range->kept = 0;
+        range->seed = NULL;
+        Arena_init(&range->keys);
+        if (seed)
+        {
+            if (count > 1)
+                HyperLogLog_init(&range->hll, self->hll.k);
+            range->seed = (count > 1) ? &range->hll : &self->hll;
+        }
+    }
+
+    if (count > 1)
+        parallel_for(threads, count, HT_VARIANT(_prune_task), &job);
+    else
+        HT_VARIANT(_prune_task)(&job, 0);
+
+    uint32_t i;
+    self->size = 0;
+    memcpy(self->histo, job.ranges[0].histo, sizeof(job.ranges[0].histo));
+    for (r = 0; r < count; r++)
+    {
+        if (r)
+        {
+            for (i = 0; i < 256; i++)
+                self->histo[i] += job.ranges[r].histo[i];
+        }
+        self->size += job.ranges[r].size;
+        self->str_allocated -= job.ranges[r].freed;
+    }
+
+    if (count == 1)
+    {
+        HT_VARIANT(_compact_ranges)(&job, 1, 1);
+    }
+    else
+    {
+        if (seed)
+        {
+            HyperLogLog ** hlls = (HyperLogLog **) malloc(count * sizeof(HyperLogLog *));
+            for (r = 0; hlls && r < count; r++)
+                hlls[r] = &job.ranges[r].hll;
+            if (!hlls || HyperLogLog_merge_many(&self->hll, hlls, count))
             {
-                uint32_t replace = HT_VARIANT(_bucket)(self, current_key, data_length, 0);
+                for (r = 0; r < count; r++)
+                    HyperLogLog_merge(&self->hll, &job.ranges[r].hll);
+            }
+            free(hlls);
+            for (r = 0; r < count; r++)
+                HyperLogLog_dealloc(&job.ranges[r].hll);
+        }
+
+        HT_VARIANT(_compact_ranges)(&job, count, threads);
+        free(job.bounds);
+        free(job.ranges);
+    }
+#ifdef HT_SPACE_SAVING
+    HT_VARIANT(_ss_rebuild)(self);
+#endif
+}
+
+/**
+  * Starts an incremental prune, which sweeps the table in the same way as _prune_int, a few buckets at a time. It stops
+  * only after an empty bucket, so that all keys stay reachable in between, and keeps the size and histogram exact.
+  * Surviving keys are copied to a fresh arena as they are visited, the old one is released when the sweep is over.
+  */
+static void HT_VARIANT(_prune_begin)(HT_TYPE *self, long long boundary)
+{
+    uint32_t start = 0;
+    while (self->table[start].key)
+        start++;
+
+    self->prune_seed = !self->max_prune && self->hll.k;
+    if (boundary > self->max_prune)
+        self->max_prune = boundary;
+
+    self->prune_boundary = boundary;
+    self->prune_start = start;
+    self->prune_next = (start + 1) & self->hash_mask;
+    self->prune_visited = 0;
+    Arena_dealloc(&self->pruned_keys);
+    self->pruned_keys = self->keys;
+    Arena_init(&self->keys);
+    self->pruning = 1;
+}
+
+static void HT_VARIANT(_prune_end)(HT_TYPE *self)
+{
+    // every key left in the old arena has been copied or evicted, its slabs are released one by one with the next keys
+    self->pruning = 0;
+    self->prune_seed = 0;
+}
 
-                if (((i - last_free) & mask) > ((i - replace) & mask))
-                    replace = i;
+/* Advances the running incremental prune by `work` buckets and up to the next empty bucket. */
+static void HT_VARIANT(_prune_step)(HT_TYPE *self, uint32_t work)
+{
+    HT_VARIANT(_cell_t) * table = self->table;
+    uint32_t mask = self->hash_mask;
+    uint32_t i = self->prune_next;
+    // the previous step stopped after an empty bucket; if a new key has taken it since,
+    // the keys following it are moved by looking for empty buckets from their home bucket
+    uint32_t last_free = (i - 1) & mask;
 
-                while (replace != i && table[replace].key)
-                    replace = (replace + 1) & mask;
+    for (;;)
+    {
+        char * key = table[i].key;
+        if (self->prune_visited == self->buckets)
+        {
+            // new keys have filled the bucket the sweep started from, so it goes on up to the next empty bucket,
+            // keeping all keys and moving them into the buckets freed before
+            if (!key)
+            {
+                HT_VARIANT(_prune_end)(self);
+                return;
+            }
+            if (HT_VARIANT(_relocate)(self, i, last_free))
+                last_free = i;
+        }
+        else
+        {
+            self->prune_visited++;
+            if (!key)
+            {
+                last_free = i;
+                if (self->prune_visited == self->buckets)
+                {
+                    HT_VARIANT(_prune_end)(self);
+                    return;
+                }
+            }
+            else
+            {
+                long long count = table[i].count;
+                if (self->prune_seed)
+                    HT_VARIANT(_seed)(self, &self->hll, i);
 
-                if (replace != i)
+                if (count > self->prune_boundary)
+                {
+                    if (!(self->hashes[i] & HT_INLINE_FLAG))
+                    {
+                        size_t length = HT_KEY_PREFIX + HT_VARIANT(_key_length)(key);
+                        char * copy = Arena_alloc(&self->keys, length);
+                        if (copy)
+                        {
+                            memcpy(copy, key, length);
+                            table[i].key = copy;
+                        }
+                        else
+                        {
+                            // without memory for the copy, the old keys are kept along with the new ones
+                            Arena_merge(&self->keys, &self->pruned_keys);
+                        }
+                    }
+                    if (HT_VARIANT(_relocate)(self, i, last_free))
+                        last_free = i;
+                }
+                else
                 {
-                    table[replace].key = current_key;
-                    table[replace].count = current_count;
-                    table[i].key = NULL;
-                    table[i].count = 0;
+                    self->histo[HT_VARIANT(_histo_addr)(count)] -= 1;
+                    self->size -= 1;
+                    self->str_allocated -= HT_VARIANT(_evict)(self, i);
                     last_free = i;
                 }
+            }
+        }
 
-                histo[HT_VARIANT(_histo_addr)(current_count)] += 1;
-                size++;
+        i = (i + 1) & mask;
+        if (work)
+            work--;
+        if (!work && !key)
+        {
+            self->prune_next = i;
+            return;
+        }
+    }
+}
+
+/* Does the share of the incremental pruning due for a new key. Returns 1 if keys may have moved, 0 otherwise. */
+static int HT_VARIANT(_prune_some)(HT_TYPE *self)
+{
+    if (!self->pruning)
+    {
+        if (Arena_release_slab(&self->pruned_keys) || self->size < HT_VARIANT(_prune_threshold)(self))
+            return 0;
+        HT_VARIANT(_prune_begin)(self, HT_VARIANT(_prune_size)(self));
+    }
+    HT_VARIANT(_prune_step)(self, HT_PRUNE_STEP);
+    return 1;
+}
+
+/* Completes the running incremental prune, if any. */
+static void HT_VARIANT(_finish_prune)(HT_TYPE *self)
+{
+    while (self->pruning)
+        HT_VARIANT(_prune_step)(self, self->buckets);
+}
+
+/* Keeps the structures ordering keys by count up to date after the count of a key has changed. */
+static inline void HT_VARIANT(_count_changed)(HT_TYPE *self, HT_VARIANT(_cell_t) * cell)
+{
+#ifdef HT_SPACE_SAVING
+    if (cell->key && cell->count != self->nodes[cell->node].count)
+    {
+        uint32_t bucket = cell - self->table;
+        HT_VARIANT(_ss_link)(self, bucket, HT_VARIANT(_ss_unlink)(self, bucket));
+    }
+#endif
+}
+
+/* Raises the exception for a failure without the GIL, if any. Returns 0 without a failure, -1 otherwise. */
+static int HT_VARIANT(_raise)(int error)
+{
+    if (error == HT_ERROR_MEMORY)
+    {
+        PyErr_NoMemory();
+        return -1;
+    }
+    if (error == HT_ERROR_OVERFLOW)
+    {
+        char * msg = "Counter overflow!";
+        PyErr_SetString(PyExc_OverflowError, msg);
+        return -1;
+    }
+    return 0;
+}
+
+/* Adds to the count of a cell. Returns 0 when successful, -1 if the count would overflow. */
+static inline int HT_VARIANT(_add_count)(HT_TYPE *self, HT_VARIANT(_cell_t) * cell, long long increment)
+{
+    if (cell->count > LLONG_MAX - increment)
+        return -1;
+
+    self->total += increment;
+    self->histo[HT_VARIANT(_histo_addr)(cell->count)] -= 1;
+    cell->count += increment;
+    self->histo[HT_VARIANT(_histo_addr)(cell->count)] += 1;
+    HT_VARIANT(_count_changed)(self, cell);
+    return 0;
+}
+
+#ifdef HT_CONCURRENT
+/* Takes the table's lock. A thread holding the GIL releases it while it waits, since the holder may need it. */
+static void HT_VARIANT(_lock)(HT_TYPE *self, int exclusive, int gil)
+{
+    if (!gil)
+    {
+        parallel_lock(&self->lock, exclusive);
+    }
+    else if (!parallel_try_lock(&self->lock, exclusive))
+    {
+        Py_BEGIN_ALLOW_THREADS
+        parallel_lock(&self->lock, exclusive);
+        Py_END_ALLOW_THREADS
+    }
+}
+
+static void HT_VARIANT(_batch_init)(HT_VARIANT(_batch_t) * batch, char gil)
+{
+    memset(batch->histo, 0, sizeof(batch->histo));
+    batch->histo_low = 256;
+    batch->histo_high = 0;
+    batch->total = 0;
+    batch->hll_count = 0;
+    batch->gil = gil;
+    batch->full = 0;
+    batch->error = 0;
+}
+
+static inline void HT_VARIANT(_batch_histo)(HT_VARIANT(_batch_t) * batch, long long count, int32_t change)
+{
+    uint8_t index = HT_VARIANT(_histo_addr)(count);
+    batch->histo[index] += change;
+    if (index < batch->histo_low)
+        batch->histo_low = index;
+    if (index >= batch->histo_high)
+        batch->histo_high = index + 1;
+}
+
+/* Applies the changes of the statistics collected by a thread, which it does before it releases the shared lock. */
+static void HT_VARIANT(_batch_flush)(HT_TYPE *self, HT_VARIANT(_batch_t) * batch)
+{
+    uint32_t i;
+    parallel_lock(&self->keys_lock, 1);
+    for (i = batch->histo_low; i < batch->histo_high; i++)
+        self->histo[i] += batch->histo[i];
+    self->total += batch->total;
+    for (i = 0; i < batch->hll_count; i++)
+        HyperLogLog_add(&self->hll, batch->hll[i]);
+    parallel_unlock(&self->keys_lock, 1);
+
+    for (i = batch->histo_low; i < batch->histo_high; i++)
+        batch->histo[i] = 0;
+    batch->histo_low = 256;
+    batch->histo_high = 0;
+    batch->total = 0;
+    batch->hll_count = 0;
+}
+
+/**
+  * Finds the cell of a key while other threads look up and add keys, holding the shared lock. With a batch, a missing
+  * key is added to the first empty bucket of its probe sequence: the thread claims the bucket with a compare-and-swap of
+  * its key and publishes the key once the stored hash is in place, so that other threads wait for it rather than add the
+  * key twice. Returns NULL for a missing key which has not been added, flagging the batch when the table is full or out
+  * of memory.
+  */
+static HT_VARIANT(_cell_t) * HT_VARIANT(_claim_cell)(HT_TYPE * self, uint32_t hash, const char * data, Py_ssize_t dataLength,
+                                                     HT_VARIANT(_batch_t) * batch)
+{
+    HT_VARIANT(_cell_t) * table = self->table;
+    HT_VARIANT(_cell_t) * found = NULL;
+    uint32_t bucket = hash & self->hash_mask;
+    uint32_t tag = HT_VARIANT(_tag)(hash, data, dataLength);
+    union {
+        char * key;
+        char inline_key[HT_INLINE_KEY_SIZE];
+    } wanted;
+    char * copy = NULL;
+
+    memset(&wanted, 0, sizeof(wanted));
+    if (tag & HT_INLINE_FLAG)
+        memcpy(wanted.inline_key, data, dataLength);
+
+    for (;;)
+    {
+        HT_VARIANT(_cell_t) * cell = &table[bucket];
+        char * key = (char *) parallel_load_ptr((void * volatile *) &cell->key);
+        if (key == HT_CLAIMED)
+        {
+            parallel_relax();
+            continue;
+        }
+        if (key)
+        {
+            if (self->hashes[bucket] == tag
+                    && ((tag & HT_INLINE_FLAG) ? key == wanted.key : HT_VARIANT(_key_equals)(key, data, dataLength)))
+            {
+                found = cell;
+                break;
             }
-            else
+            bucket = (bucket + 1) & self->hash_mask;
+            continue;
+        }
+
+        if (!batch)
+            break;
+        if (parallel_add32(&self->size, 1) > HT_VARIANT(_limit)(self))
+        {
+            parallel_add32(&self->size, -1);
+            batch->full = 1;
+            break;
+        }
+        if (!(tag & HT_INLINE_FLAG) && !copy)
+        {
+            parallel_lock(&self->keys_lock, 1);
+            copy = Arena_alloc(&self->keys, HT_KEY_PREFIX + dataLength);
+            if (copy)
+                self->str_allocated += HT_KEY_PREFIX + dataLength;
+            parallel_unlock(&self->keys_lock, 1);
+            if (!copy)
             {
-                self->str_allocated -= data_length + 1;
-                free(current_key);
-                table[i].key = NULL;
-                table[i].count = 0;
-                last_free = i;
+                parallel_add32(&self->size, -1);
+                batch->error = HT_ERROR_MEMORY;
+                return NULL;
             }
+            uint32_t length = dataLength;
+            memcpy(copy, &length, HT_KEY_PREFIX);
+            memcpy(copy + HT_KEY_PREFIX, data, dataLength);
+            wanted.key = copy;
         }
-        else
+        if (parallel_cas_ptr((void * volatile *) &cell->key, NULL, HT_CLAIMED))
+        {
+            // another thread took the bucket first, possibly for the same key
+            parallel_add32(&self->size, -1);
+            continue;
+        }
+        self->hashes[bucket] = tag;
+        cell->count = 0;
+        // where pointers are smaller, the rest of an inline key's bytes are cleared before the key is published
+        if (sizeof(char *) < HT_INLINE_KEY_SIZE)
+            memset(cell->inline_key + sizeof(char *), 0, HT_INLINE_KEY_SIZE - sizeof(char *));
+        parallel_store_ptr((void * volatile *) &cell->key, wanted.key);
+        HT_VARIANT(_batch_histo)(batch, 0, 1);
+        if (self->max_prune && self->hll.k)
+            batch->hll[batch->hll_count++] = HT_VARIANT(_hll_value)(&self->hll, hash, data, dataLength);
+        return cell;
+    }
+
+    if (copy)
+    {
+        // the copy of the key stays in the arena until the table is pruned, unaccounted for like keys pruned since
+        parallel_lock(&self->keys_lock, 1);
+        self->str_allocated -= HT_KEY_PREFIX + dataLength;
+        parallel_unlock(&self->keys_lock, 1);
+    }
+    return found;
+}
+
+/**
+  * Finds or adds the cell of a key holding the shared lock. The thread which finds the table full flushes its batch and
+  * prunes the table once it holds the lock exclusively, unless another thread has pruned it meanwhile.
+  * Returns NULL when out of memory.
+  */
+static HT_VARIANT(_cell_t) * HT_VARIANT(_allocate_shared)(HT_TYPE * self, uint32_t hash, const char * data,
+                                                          Py_ssize_t dataLength, HT_VARIANT(_batch_t) * batch)
+{
+    for (;;)
+    {
+        HT_VARIANT(_cell_t) * cell = HT_VARIANT(_claim_cell)(self, hash, data, dataLength, batch);
+        if (cell || !batch->full)
+            return cell;
+
+        batch->full = 0;
+        HT_VARIANT(_batch_flush)(self, batch);
+        parallel_unlock(&self->lock, 0);
+        HT_VARIANT(_lock)(self, 1, batch->gil);
+        if (self->size >= HT_VARIANT(_limit)(self))
+            HT_VARIANT(_prune_int)(self, HT_VARIANT(_prune_size)(self), self->prune_threads);
+        parallel_unlock(&self->lock, 1);
+        HT_VARIANT(_lock)(self, 0, batch->gil);
+    }
+}
+
+/* Adds a string with a known hash to the counter holding the shared lock. Returns 0 when successful, -1 otherwise. */
+static int HT_VARIANT(_apply_shared)(HT_TYPE *self, uint32_t hash, const char *data, Py_ssize_t dataLength,
+                                     long long increment, HT_VARIANT(_batch_t) * batch)
+{
+    HT_VARIANT(_cell_t) * cell = HT_VARIANT(_allocate_shared)(self, hash, data, dataLength, batch);
+    if (!cell)
+        return -1;
+
+    long long count = parallel_add64(&cell->count, increment);
+    if (count < increment)
+    {
+        // wrapped around past LLONG_MAX
+        parallel_add64(&cell->count, -increment);
+        batch->error = HT_ERROR_OVERFLOW;
+        return -1;
+    }
+
+    batch->total += increment;
+    HT_VARIANT(_batch_histo)(batch, count - increment, -1);
+    HT_VARIANT(_batch_histo)(batch, count, 1);
+    return 0;
+}
+
+/* Sets the count of a string, 0 deleting it. Returns 0 when successful, -1 with an exception set otherwise. */
+static int HT_VARIANT(_set_shared)(HT_TYPE *self, const char *data, Py_ssize_t dataLength, long long value)
+{
+    HT_VARIANT(_batch_t) batch;
+    HT_VARIANT(_batch_init)(&batch, 1);
+    uint32_t hash = HT_VARIANT(_hash)(data, dataLength);
+
+    HT_VARIANT(_lock)(self, 0, 1);
+    // don't bother allocating a new cell when setting 0
+    HT_VARIANT(_cell_t) * cell = value
+            ? HT_VARIANT(_allocate_shared)(self, hash, data, dataLength, &batch)
+            : HT_VARIANT(_claim_cell)(self, hash, data, dataLength, NULL);
+    if (cell)
+    {
+        long long previous = parallel_exchange64(&cell->count, value);
+        HT_VARIANT(_batch_histo)(&batch, previous, -1);
+        HT_VARIANT(_batch_histo)(&batch, value, 1);
+        batch.total += value - previous;
+    }
+    HT_VARIANT(_batch_flush)(self, &batch);
+    parallel_unlock(&self->lock, 0);
+    return HT_VARIANT(_raise)(batch.error);
+}
+#endif
+
+/* Adds a string with a known hash to the counter. Returns 0 when successful, -1 with an exception set otherwise. */
+static int
+HT_VARIANT(_apply)(HT_TYPE *self, uint32_t hash, const char *data, Py_ssize_t dataLength, long long increment)
+{
+    HT_VARIANT(_cell_t) * cell = HT_VARIANT(_allocate_cell_hashed)(self, hash, data, dataLength, 1);
+    if (!cell)
+        return HT_VARIANT(_raise)(HT_ERROR_MEMORY);
+    if (HT_VARIANT(_add_count)(self, cell, increment))
+        return HT_VARIANT(_raise)(HT_ERROR_OVERFLOW);
+    return 0;
+}
+
+/* Applies all increments held by the pre-aggregation buffer. Returns 0 when successful, -1 with an exception set otherwise. */
+static int
+HT_VARIANT(_flush)(HT_TYPE *self)
+{
+    if (!self->buffer.used)
+        return 0;
+
+    combiner_entry_t * entries = self->buffer.entries;
+    uint32_t i;
+    for (i = 0; i < self->buffer.size; i++)
+    {
+        if (entries[i].count)
         {
-            last_free = i;
+            long long count = entries[i].count;
+            entries[i].count = 0;
+            self->buffer.used--;
+            if (HT_VARIANT(_apply)(self, entries[i].hash, entries[i].key, entries[i].length, count))
+                return -1;
         }
     }
-    while (i != start);
-
-    self->size = size;
+    return 0;
+}
 
+/**
+  * Applies the buffered increments of a single key, so that looking it up or setting it does not flush the whole buffer.
+  * Returns 0 when successful, -1 with an exception set otherwise.
+  */
+static inline int
+HT_VARIANT(_flush_key)(HT_TYPE *self, const char *data, Py_ssize_t dataLength)
+{
+    combiner_entry_t taken;
+    if (!self->buffer.used
+        || !Combiner_take(&self->buffer, HT_VARIANT(_hash)(data, dataLength), data, dataLength, &taken))
+        return 0;
+    return HT_VARIANT(_apply)(self, taken.hash, taken.key, taken.length, taken.count);
 }
 
 /* Adds a string to the counter. */
@@ -335,26 +1901,35 @@ HT_VARIANT(_increment_obj)(HT_TYPE *self, char *data, Py_ssize_t dataLength, lon
         return Py_None;
     }
 
-    HT_VARIANT(_cell_t) * cell = HT_VARIANT(_allocate_cell)(self, data, dataLength);
-
-    if (cell)
+    uint32_t hash = HT_VARIANT(_hash)(data, dataLength);
+    int result;
+#ifdef HT_CONCURRENT
+    HT_VARIANT(_batch_t) batch;
+    HT_VARIANT(_batch_init)(&batch, 1);
+    HT_VARIANT(_lock)(self, 0, 1);
+    HT_VARIANT(_apply_shared)(self, hash, data, dataLength, increment, &batch);
+    HT_VARIANT(_batch_flush)(self, &batch);
+    parallel_unlock(&self->lock, 0);
+    result = HT_VARIANT(_raise)(batch.error);
+#else
+    if (self->buffer.entries && dataLength < COMBINER_KEY_SIZE)
     {
-        if (cell->count > LLONG_MAX - increment)
-        {
-            char * msg = "Counter overflow!";
-            PyErr_SetString(PyExc_OverflowError, msg);
-            return NULL;
-        }
-
-        self->total += increment;
-        self->histo[HT_VARIANT(_histo_addr)(cell->count)] -= 1;
-        cell->count += increment;
-        self->histo[HT_VARIANT(_histo_addr)(cell->count)] += 1;
-        Py_INCREF(Py_None);
-        return Py_None;
+        combiner_entry_t evicted;
+        result = Combiner_add(&self->buffer, hash, data, dataLength, increment, &evicted)
+            ? HT_VARIANT(_apply)(self, evicted.hash, evicted.key, evicted.length, evicted.count)
+            : 0;
+    }
+    else
+    {
+        result = HT_VARIANT(_apply)(self, hash, data, dataLength, increment);
     }
+#endif
 
-    return NULL;
+    if (result)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
 
@@ -400,9 +1975,9 @@ HT_VARIANT(_parse_key)(PyObject * key, Py_ssize_t * dataLength, PyObject ** free
         *free_after = NULL;
         return NULL;
     }
-    if (strlen(data) < *dataLength)
+    if ((uint64_t) *dataLength > UINT32_MAX)
     {
-        char * msg = "The key must not contain null bytes!";
+        char * msg = "The key is too long!";
         PyErr_SetString(PyExc_ValueError, msg);
         Py_XDECREF(*free_after);
         *free_after = NULL;
@@ -443,6 +2018,11 @@ HT_VARIANT(_setitem)(HT_TYPE *self, PyObject *pKey, PyObject *pValue)
     char * data = HT_VARIANT(_parse_key)(pKey, &dataLength, &free_after);
     if (!data)
         return -1;
+    if (HT_VARIANT(_flush_key)(self, data, dataLength))
+    {
+        Py_XDECREF(free_after);
+        return -1;
+    }
 
     if (pValue) // set value
     {
@@ -458,11 +2038,21 @@ HT_VARIANT(_setitem)(HT_TYPE *self, PyObject *pKey, PyObject *pValue)
             Py_XDECREF(free_after);
             return -1;
         }
+#ifdef HT_CONCURRENT
+    }
+    else
+    {
+        value = 0;
+    }
+    int result = HT_VARIANT(_set_shared)(self, data, dataLength, value);
+    Py_XDECREF(free_after);
+    return result;
+#else
 
         // don't bother allocating a new cell when setting 0
         HT_VARIANT(_cell_t) * cell = value
                 ? HT_VARIANT(_allocate_cell)(self, data, dataLength)
-                : HT_VARIANT(_find_cell)(self, data, dataLength, 0);
+                : HT_VARIANT(_find_cell)(self, data, dataLength);
 
         if (cell)
         {
@@ -470,26 +2060,34 @@ HT_VARIANT(_setitem)(HT_TYPE *self, PyObject *pKey, PyObject *pValue)
             self->histo[HT_VARIANT(_histo_addr)(value)] += 1;
             self->total += value - cell->count;
             cell->count = value;
+#ifdef HT_SPACE_SAVING
+            // a count set explicitly is taken as exact
+            if (cell->key)
+                cell->error = 0;
+#endif
+            HT_VARIANT(_count_changed)(self, cell);
             Py_XDECREF(free_after);
             return 0;
         }
     }
     else // delete value
     {
-        HT_VARIANT(_cell_t) * cell = HT_VARIANT(_find_cell)(self, data, dataLength, 0);
+        HT_VARIANT(_cell_t) * cell = HT_VARIANT(_find_cell)(self, data, dataLength);
         if (cell)
         {
             self->histo[HT_VARIANT(_histo_addr)(cell->count)] -= 1;
             self->histo[0] += 1;
             self->total -= cell->count;
             cell->count = 0;
+            HT_VARIANT(_count_changed)(self, cell);
         }
         Py_XDECREF(free_after);
         return 0;
     }
 
     Py_XDECREF(free_after);
-    return -1;
+    return HT_VARIANT(_raise)(HT_ERROR_MEMORY);
+#endif
 }
 
 /* Retrieves count for a single string. */
@@ -502,31 +2100,84 @@ HT_VARIANT(_getitem)(HT_TYPE *self, PyObject *key)
     char * data = HT_VARIANT(_parse_key)(key, &dataLength, &free_after);
     if (!data)
         return NULL;
+    if (HT_VARIANT(_flush_key)(self, data, dataLength))
+    {
+        Py_XDECREF(free_after);
+        return NULL;
+    }
 
-    HT_VARIANT(_cell_t) * cell = HT_VARIANT(_find_cell)(self, data, dataLength, 0);
+#ifdef HT_CONCURRENT
+    HT_VARIANT(_lock)(self, 0, 1);
+    HT_VARIANT(_cell_t) * cell = HT_VARIANT(_claim_cell)(self, HT_VARIANT(_hash)(data, dataLength), data, dataLength, NULL);
+    long long value = cell ? parallel_load64(&cell->count) : 0;
+    parallel_unlock(&self->lock, 0);
+    Py_XDECREF(free_after);
+#else
+    HT_VARIANT(_cell_t) * cell = HT_VARIANT(_find_cell)(self, data, dataLength);
     Py_XDECREF(free_after);
 
     long long value = cell ? cell->count : 0;
+#endif
     return Py_BuildValue("L", value);
 }
 
 static PyObject *
 HT_VARIANT(_total)(HT_TYPE *self)
 {
+    if (HT_VARIANT(_flush)(self))
+        return NULL;
     return Py_BuildValue("L", self->total);
 }
 
+/**
+  * Counts the keys of the table and the buffered keys it does not hold yet, without flushing the buffer. Only when the
+  * buffered keys would fill the table, so that applying them prunes it, is the buffer flushed first.
+  */
 static Py_ssize_t
 HT_VARIANT(_size)(HT_TYPE *self)
 {
-    return self->size - self->histo[0];
+    uint32_t pending = 0;
+    uint32_t i;
+    for (i = 0; self->buffer.used && i < self->buffer.size; i++)
+    {
+        combiner_entry_t * entry = &self->buffer.entries[i];
+        if (entry->count)
+        {
+            HT_VARIANT(_cell_t) * cell = HT_VARIANT(_lookup_hashed)(self, entry->hash, entry->key, entry->length);
+            pending += !cell->key || cell->count <= 0;
+        }
+    }
+    if (pending && self->size + pending >= HT_VARIANT(_limit)(self))
+    {
+        if (HT_VARIANT(_flush)(self))
+            return -1;
+        pending = 0;
+    }
+    return self->size - self->histo[0] + pending;
+}
+
+/* Checks whether the cardinality of pruned keys is unknown, setting an exception if so. */
+static inline int HT_VARIANT(_untracked)(HT_TYPE *self)
+{
+    if (self->hll.k)
+        return 0;
+    char * msg = "Cardinality is not tracked after pruning, the table was created with hll_precision=0.";
+    PyErr_SetString(PyExc_ValueError, msg);
+    return 1;
 }
 
 static PyObject *
 HT_VARIANT(_cardinality)(HT_TYPE *self)
 {
+    if (HT_VARIANT(_flush)(self))
+        return NULL;
+    // the first prune has to see all keys before the HLL counts them
+    if (self->prune_seed)
+        HT_VARIANT(_finish_prune)(self);
     if (!self->max_prune)
         return Py_BuildValue("n", HT_VARIANT(_size)(self));
+    if (HT_VARIANT(_untracked)(self))
+        return NULL;
 
     double cardinality = HyperLogLog_cardinality(&self->hll);
     return Py_BuildValue("L", (long long) cardinality);
@@ -535,7 +2186,14 @@ HT_VARIANT(_cardinality)(HT_TYPE *self)
 static PyObject *
 HT_VARIANT(_quality)(HT_TYPE *self)
 {
-    uint32_t limit = (self->buckets >> 2) * 3;
+    if (HT_VARIANT(_flush)(self))
+        return NULL;
+    if (self->prune_seed)
+        HT_VARIANT(_finish_prune)(self);
+    // a growable table is rated against the size it may grow to
+    double limit = (double) HT_VARIANT(_limit)(self) * (self->max_buckets / self->buckets);
+    if (self->max_prune && HT_VARIANT(_untracked)(self))
+        return NULL;
 
     double size = (self->max_prune)
             ? HyperLogLog_cardinality(&self->hll)
@@ -550,8 +2208,14 @@ HT_VARIANT(_quality)(HT_TYPE *self)
 static PyObject *
 HT_VARIANT(_reduce)(HT_TYPE *self)
 {
+    if (HT_VARIANT(_flush)(self))
+        return NULL;
+    HT_VARIANT(_finish_prune)(self);
+    HT_VARIANT(_finish_grow)(self);
+
     uint64_t size_mb = 2 * self->buckets * sizeof(HT_VARIANT(_cell_t));
-    PyObject *args = Py_BuildValue("(KI)", size_mb, self->buckets);
+    PyObject *args = Py_BuildValue("(KIiIiiIi)", size_mb, self->max_buckets, self->use_unicode, self->buffer.size,
+        (int) self->hll.k, (int) self->incremental_prune, self->prune_threads, (int) self->growable);
     HT_VARIANT(_cell_t) * table = self->table;
 
     uint32_t chunk_size = (self->buckets <= MAX_PICKLE_CHUNK_SIZE) ? self->buckets : MAX_PICKLE_CHUNK_SIZE;
@@ -578,42 +2242,83 @@ HT_VARIANT(_reduce)(HT_TYPE *self)
 
     PyObject * histo_row = PyByteArray_FromStringAndSize(self->histo, 256 * sizeof(uint32_t));
 
-    PyByteArrayObject * strings_row = (PyByteArrayObject *) PyByteArray_FromStringAndSize(NULL, self->str_allocated);
+    // every key is written out with its length prefix, inline keys included
+    uint64_t strings_length = 0;
+    Py_ssize_t length;
+    for (i = 0; i < self->buckets; i++)
+    {
+        if (table[i].key)
+        {
+            HT_VARIANT(_key)(self, i, &length);
+            strings_length += HT_KEY_PREFIX + length;
+        }
+    }
+
+    PyByteArrayObject * strings_row = (PyByteArrayObject *) PyByteArray_FromStringAndSize(NULL, strings_length);
 
     char * result_index = strings_row->ob_bytes;
 
     for (i = 0; i < self->buckets; i++)
     {
-        char* key = table[i].key;
-        if (key)
+        if (table[i].key)
         {
-            size_t length = strlen(key) + 1;
-            memcpy(result_index, key, length);
-            result_index += length;
+            const char * key = HT_VARIANT(_key)(self, i, &length);
+            uint32_t prefix = length;
+            memcpy(result_index, &prefix, HT_KEY_PREFIX);
+            memcpy(result_index + HT_KEY_PREFIX, key, length);
+            result_index += HT_KEY_PREFIX + length;
         }
     }
 
-    PyObject * hll_row = PyByteArray_FromStringAndSize(self->hll.registers, self->hll.size);
+    PyObject * hll_row = PyByteArray_FromStringAndSize(NULL, HyperLogLog_serialized_size(&self->hll));
+    if (!hll_row)
+        return NULL;
+    HyperLogLog_serialize(&self->hll, PyByteArray_AS_STRING(hll_row));
 
-    PyObject *state = Py_BuildValue("(LLILOOOO)",
-        self->total, self->str_allocated, self->size, self->max_prune, hashtable_list, strings_row, histo_row, hll_row);
+    PyObject *state = Py_BuildValue("(LLILOOOOiI)",
+        self->total, self->str_allocated, self->size, self->max_prune, hashtable_list, strings_row, histo_row, hll_row,
+        HT_KEYS_PREFIXED, self->buckets);
     return Py_BuildValue("(OOO)", Py_TYPE(self), args, state);
 }
 
+static PyObject * HT_VARIANT(_clear)(HT_TYPE *self);
+
 /* De-serialization function for pickling. */
 static PyObject *
 HT_VARIANT(_set_state)(HT_TYPE * self, PyObject * args)
 {
+    PyObject * state;
     PyObject * hashtable_list;
     PyObject * strings_row_o;
     PyObject * histo_row_o;
     PyObject * hll_row_o;
+    int key_format = HT_KEYS_TERMINATED;
+    uint32_t buckets = self->buckets;
 
-    if (!PyArg_ParseTuple(args, "(LLILOOOO)",
+    if (!PyArg_ParseTuple(args, "O!", &PyTuple_Type, &state))
+        return NULL;
+    // states without the key format hold null-terminated keys, states without the number of buckets have them all
+    Py_ssize_t fields = PyTuple_GET_SIZE(state);
+    if (!PyArg_ParseTuple(state, (fields > 9) ? "LLILOOOOiI" : (fields > 8) ? "LLILOOOOi" : "LLILOOOO",
             &self->total, &self->str_allocated, &self->size, &self->max_prune,
-            &hashtable_list, &strings_row_o, &histo_row_o, &hll_row_o))
+            &hashtable_list, &strings_row_o, &histo_row_o, &hll_row_o, &key_format, &buckets))
         return NULL;
 
+    if (buckets != self->buckets)
+    {
+        // a growable table is restored at the size it had grown to
+        if (!buckets || (buckets & (buckets - 1)) || buckets > self->max_buckets)
+        {
+            PyErr_SetString(PyExc_ValueError, "Invalid number of buckets in the state!");
+            return NULL;
+        }
+        HT_VARIANT(_arrays_t) arrays;
+        if (HT_VARIANT(_arrays_alloc)(&arrays, buckets))
+            return PyErr_NoMemory();
+        HT_VARIANT(_swap_arrays)(self, &arrays);
+        HT_VARIANT(_arrays_free)(&arrays);
+    }
+
     HT_VARIANT(_cell_t) * table = self->table;
 
     uint32_t chunk_size = (self->buckets <= MAX_PICKLE_CHUNK_SIZE) ? self->buckets : MAX_PICKLE_CHUNK_SIZE;
@@ -630,34 +2335,75 @@ HT_VARIANT(_set_state)(HT_TYPE * self, PyObject * args)
 
     char * string_row = PyByteArray_AsString(strings_row_o);
     uint64_t total_length = PyByteArray_Size(strings_row_o);
+    if (Arena_reserve(&self->keys, total_length))
+        return PyErr_NoMemory();
+    self->str_allocated = 0;
     char * current_word = string_row;
+    char * strings_end = string_row + total_length;
     uint32_t i;
     for (i = 0; i < self->buckets; i++)
     {
-        if (table[i].key) // the imported key is garbage, we replace it with a real pointer
+        if (table[i].key) // the imported key is garbage, we replace it with the key itself or a real pointer
         {
-            if (current_word >= string_row + total_length)
+            uint32_t current_length;
+            if (key_format == HT_KEYS_PREFIXED)
+            {
+                if (strings_end - current_word < (Py_ssize_t) HT_KEY_PREFIX)
+                    break;
+                current_length = HT_VARIANT(_key_length)(current_word);
+                current_word += HT_KEY_PREFIX;
+                if ((uint64_t) (strings_end - current_word) < current_length)
+                    break;
+            }
+            else
             {
-                return NULL; // overflow!
+                if (current_word >= strings_end)
+                    break;
+                current_length = strlen(current_word);
             }
 
-            size_t current_length = strlen(current_word) + 1;
-            char * current_target = malloc(current_length);
-            table[i].key = current_target;
-            memcpy(current_target, current_word, current_length);
-            current_word += current_length;
+            uint32_t tag = HT_VARIANT(_tag)(HT_VARIANT(_hash)(current_word, current_length), current_word, current_length);
+            if (tag & HT_INLINE_FLAG)
+            {
+                table[i].key = NULL;
+                memcpy(table[i].inline_key, current_word, current_length);
+            }
+            else
+            {
+                table[i].key = Arena_alloc(&self->keys, HT_KEY_PREFIX + current_length);
+                memcpy(table[i].key, &current_length, HT_KEY_PREFIX);
+                memcpy(table[i].key + HT_KEY_PREFIX, current_word, current_length);
+                self->str_allocated += HT_KEY_PREFIX + current_length;
+            }
+            self->hashes[i] = tag;
+            HT_VARIANT(_set_ctrl)(self, i, HT_VARIANT(_ctrl_tag)(tag));
+            current_word += current_length + (key_format == HT_KEYS_PREFIXED ? 0 : 1);
         }
     }
+    if (i < self->buckets)
+    {
+        // the rest of the table still holds garbage pointers, which must never be followed
+        Py_XDECREF(HT_VARIANT(_clear)(self));
+        PyErr_SetString(PyExc_ValueError, "Invalid key strings in the state!");
+        return NULL;
+    }
 
     uint32_t * histo_row = PyByteArray_AsString(histo_row_o);
     if (!histo_row)
         return NULL;
     memcpy(self->histo, histo_row, 256 * sizeof(uint32_t));
 
-    hll_cell_t * hll_row = PyByteArray_AsString(hll_row_o);
+    char * hll_row = PyByteArray_AsString(hll_row_o);
     if (!hll_row)
         return NULL;
-    memcpy(self->hll.registers, hll_row, self->hll.size);
+    if (HyperLogLog_deserialize(&self->hll, hll_row, PyByteArray_Size(hll_row_o)))
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid HyperLogLog state!");
+        return NULL;
+    }
+#ifdef HT_SPACE_SAVING
+    HT_VARIANT(_ss_rebuild)(self);
+#endif
 
     Py_INCREF(Py_None);
     return Py_None;
@@ -666,6 +2412,9 @@ HT_VARIANT(_set_state)(HT_TYPE * self, PyObject * args)
 static PyObject *
 HT_VARIANT(_print_histo)(HT_TYPE * self)
 {
+    if (HT_VARIANT(_flush)(self))
+        return NULL;
+
     long long i;
     for (i = 0; i < 255; i++)
     {
@@ -681,33 +2430,358 @@ HT_VARIANT(_print_histo)(HT_TYPE * self)
 static PyObject *
 HT_VARIANT(_print_alloc)(HT_TYPE * self)
 {
-    long long mem = sizeof(HT_VARIANT(_cell_t)) * self->buckets;
-    mem += self->str_allocated;
+    long long mem = (sizeof(HT_VARIANT(_cell_t)) + sizeof(uint32_t)) * ((long long) self->buckets + self->old.buckets);
+#ifdef HT_CONTROL_BYTES
+    mem += self->buckets + HT_GROUP_WIDTH;
+    if (self->old.table)
+        mem += self->old.buckets + HT_GROUP_WIDTH;
+#endif
+#ifdef HT_SPACE_SAVING
+    mem += ((long long) HT_VARIANT(_limit)(self) + 1) * sizeof(ht_ss_node_t);
+#endif
+    mem += self->keys.reserved + self->pruned_keys.reserved;
     mem += sizeof(uint32_t) * 256;
 
     return Py_BuildValue("L", mem);
 }
 
 static PyObject *
-HT_VARIANT(_prune)(HT_TYPE * self, PyObject *args)
+HT_VARIANT(_prune)(HT_TYPE * self, PyObject *args, PyObject *kwds)
 {
+    static char *kwlist[] = {"boundary", "threads", NULL};
     long long boundary;
+    unsigned int threads = self->prune_threads;
 
-    if (!PyArg_ParseTuple(args, "L", &boundary))
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "L|I", kwlist, &boundary, &threads))
+        return NULL;
+    if (!threads)
+        threads = parallel_cpu_count();
+    if (HT_VARIANT(_flush)(self))
         return NULL;
 
-    HT_VARIANT(_prune_int)(self, boundary);
+    HT_VARIANT(_finish_prune)(self);
+    HT_VARIANT(_prune_int)(self, boundary, threads);
 
     Py_INCREF(Py_None);
     return Py_None;
 }
 
+#ifdef HT_SPACE_SAVING
+/* Returns by how much the count of a key may exceed the true count, or for a key not in the table,
+ * up to what count it may have been seen.
+ */
+static PyObject *
+HT_VARIANT(_error)(HT_TYPE *self, PyObject *key)
+{
+    PyObject * free_after = NULL;
+    Py_ssize_t dataLength = 0;
+
+    char * data = HT_VARIANT(_parse_key)(key, &dataLength, &free_after);
+    if (!data)
+        return NULL;
+    if (HT_VARIANT(_flush_key)(self, data, dataLength))
+    {
+        Py_XDECREF(free_after);
+        return NULL;
+    }
+
+    HT_VARIANT(_cell_t) * cell = HT_VARIANT(_find_cell)(self, data, dataLength);
+    Py_XDECREF(free_after);
+
+    return Py_BuildValue("L", cell->key ? cell->error : self->max_prune);
+}
+
+/* Returns up to k (key, count, error) tuples of the keys with the highest counts, highest first. */
+static PyObject *
+HT_VARIANT(_top)(HT_TYPE *self, PyObject *args)
+{
+    Py_ssize_t k;
+    if (!PyArg_ParseTuple(args, "n", &k))
+        return NULL;
+    if (k < 0)
+    {
+        char * msg = "The number of keys must not be negative!";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+    if (HT_VARIANT(_flush)(self))
+        return NULL;
+
+    HT_VARIANT(_cell_t) * table = self->table;
+    PyObject * result = PyList_New(0);
+    if (!result)
+        return NULL;
+
+    uint32_t node;
+    uint32_t i;
+    for (node = self->max_node; node != HT_SS_NONE && self->nodes[node].count > 0; node = self->nodes[node].prev)
+    {
+        for (i = self->nodes[node].first; i != HT_SS_NONE && PyList_GET_SIZE(result) < k; i = table[i].next)
+        {
+            PyObject * item = Py_BuildValue("(NLL)", HT_VARIANT(_key_object)(self, i, self->use_unicode),
+                                            table[i].count, table[i].error);
+            if (!item || PyList_Append(result, item))
+            {
+                Py_XDECREF(item);
+                Py_DECREF(result);
+                return NULL;
+            }
+            Py_DECREF(item);
+        }
+        if (PyList_GET_SIZE(result) >= k)
+            break;
+    }
+    return result;
+}
+
+/* Tells whether the keys returned by top(k) are certainly the k most frequent ones: every one of them must have been
+ * counted more often than the next key in the table, and than any key evicted or pruned.
+ */
+static PyObject *
+HT_VARIANT(_top_guaranteed)(HT_TYPE *self, PyObject *args)
+{
+    Py_ssize_t k;
+    if (!PyArg_ParseTuple(args, "n", &k))
+        return NULL;
+    if (HT_VARIANT(_flush)(self))
+        return NULL;
+
+    HT_VARIANT(_cell_t) * table = self->table;
+    long long guaranteed = LLONG_MAX; // lowest count of the top k keys, not counting their errors
+    long long rest = self->max_prune; // highest count any other key may have
+    Py_ssize_t seen = 0;
+    uint32_t node;
+    uint32_t i;
+    for (node = self->max_node; node != HT_SS_NONE && self->nodes[node].count > 0 && seen <= k;
+         node = self->nodes[node].prev)
+    {
+        for (i = self->nodes[node].first; i != HT_SS_NONE && seen <= k; i = table[i].next, seen++)
+        {
+            if (seen < k && table[i].count - table[i].error < guaranteed)
+                guaranteed = table[i].count - table[i].error;
+            else if (seen == k && table[i].count > rest)
+                rest = table[i].count;
+        }
+    }
+    return PyBool_FromLong(guaranteed >= rest);
+}
+#endif
+
 static PyObject *
 HT_VARIANT(_buckets)(HT_TYPE * self)
 {
     return Py_BuildValue("I", self->buckets);
 }
 
+#ifdef HT_CONCURRENT
+/**
+  * Counts the keys of an iterator, or its (key, count) tuples, in batches. Each batch is counted with the GIL released
+  * and the table's lock shared, so that any number of threads can count into the table at once.
+  * Returns 0 when successful, -1 with an exception set otherwise.
+  */
+static int HT_VARIANT(_update_batched)(HT_TYPE * self, PyObject * iterator)
+{
+    PyObject * items[HT_BATCH_SIZE];
+    const char * keys[HT_BATCH_SIZE];
+    Py_ssize_t lengths[HT_BATCH_SIZE];
+    long long increments[HT_BATCH_SIZE];
+    HT_VARIANT(_batch_t) batch;
+    uint32_t count = 0;
+    uint32_t i;
+    int result = 0;
+    int done = 0;
+
+    while (!done)
+    {
+        PyObject * item = PyIter_Next(iterator);
+        if (item)
+        {
+            PyObject * pkey = item;
+            PyObject * free_after = NULL;
+            long long increment = 1;
+            char * data = NULL;
+            Py_ssize_t dataLength;
+
+            if (!PyTuple_Check(item) || PyArg_ParseTuple(item, "O|L", &pkey, &increment))
+                data = HT_VARIANT(_parse_key)(pkey, &dataLength, &free_after);
+            if (data && increment < 0)
+            {
+                char * msg = "Increment must be positive!";
+                PyErr_SetString(PyExc_ValueError, msg);
+                Py_XDECREF(free_after);
+                data = NULL;
+            }
+            if (!data)
+            {
+                Py_DECREF(item);
+                result = -1;
+                done = 1;
+            }
+            else if (!increment)
+            {
+                Py_XDECREF(free_after);
+                Py_DECREF(item);
+            }
+            else
+            {
+                // the key stays valid as long as the object holding its bytes
+                if (free_after)
+                {
+                    Py_DECREF(item);
+                    item = free_after;
+                }
+                items[count] = item;
+                keys[count] = data;
+                lengths[count] = dataLength;
+                increments[count] = increment;
+                count++;
+            }
+        }
+        else
+        {
+            if (PyErr_Occurred())
+                result = -1;
+            done = 1;
+        }
+
+        // the keys collected before a failure are still counted, like update() on the other tables does
+        if (count == HT_BATCH_SIZE || (done && count))
+        {
+            Py_BEGIN_ALLOW_THREADS
+            HT_VARIANT(_batch_init)(&batch, 0);
+            HT_VARIANT(_lock)(self, 0, 0);
+            for (i = 0; i < count && !batch.error; i++)
+                HT_VARIANT(_apply_shared)(self, HT_VARIANT(_hash)(keys[i], lengths[i]), keys[i], lengths[i], increments[i], &batch);
+            HT_VARIANT(_batch_flush)(self, &batch);
+            parallel_unlock(&self->lock, 0);
+            Py_END_ALLOW_THREADS
+
+            for (i = 0; i < count; i++)
+                Py_DECREF(items[i]);
+            count = 0;
+            if (batch.error)
+            {
+                if (!result)
+                    HT_VARIANT(_raise)(batch.error);
+                result = -1;
+                done = 1;
+            }
+        }
+    }
+    return result;
+}
+#endif
+
+/**
+  * Combines the cardinality estimates before another table which has been pruned is merged. This table is seeded with
+  * its own keys first if it has not been pruned, then the HLL of the other table, standing for all keys it has seen,
+  * is merged into its own.
+  * Returns 1 when the HLL of the other table has been merged, 0 when its keys have to be added one by one, or -1 when
+  * out of memory.
+  */
+static int HT_VARIANT(_merge_hll)(HT_TYPE * self, HT_TYPE * other)
+{
+    uint32_t i;
+    int merged = 0;
+    if (self->hll.k && other->max_prune && !self->max_prune)
+    {
+        for (i = 0; i < self->buckets; i++)
+            if (self->table[i].key)
+                HT_VARIANT(_seed)(self, &self->hll, i);
+    }
+    if (self->hll.k && other->max_prune && other->hll.k)
+    {
+        if (HyperLogLog_merge(&self->hll, &other->hll))
+            return -1;
+        merged = 1;
+    }
+    if (other->max_prune > self->max_prune)
+        self->max_prune = other->max_prune;
+    return merged;
+}
+
+/**
+  * Adds the counts of another table of the same type, walking its buckets rather than its items. Keys are placed by the
+  * hashes the other table has stored, which lack the top bit the HLL needs, so keys are hashed again only when this
+  * table counts them in its HLL. The total of the other table is added as a whole, including the counts it has pruned.
+  * A concurrent table merges with both tables locked exclusively and the GIL released, the other variants hold the GIL
+  * throughout, so that no other thread can use either table meanwhile.
+  * Returns 0 when successful, -1 with an exception set otherwise.
+  */
+static int HT_VARIANT(_merge)(HT_TYPE * self, HT_TYPE * other)
+{
+    if (HT_VARIANT(_flush)(self) || HT_VARIANT(_flush)(other))
+        return -1;
+    if (self->hll.k && other->hll.k && other->max_prune && self->hll.size != other->hll.size)
+    {
+        char * msg = "Tables with different HLL precisions cannot be merged.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
+
+#ifdef HT_CONCURRENT
+    // the tables are locked in the order of their addresses, so that two threads merging them into each other cannot deadlock
+    HT_TYPE * first = (other < self) ? other : self;
+    HT_TYPE * second = (other < self) ? self : other;
+    HT_VARIANT(_lock)(first, 1, 1);
+    if (second != first)
+        HT_VARIANT(_lock)(second, 1, 1);
+#endif
+
+    int error = 0;
+#ifdef HT_CONCURRENT
+    PyThreadState * save = PyEval_SaveThread();
+#endif
+    HT_VARIANT(_finish_prune)(self);
+    HT_VARIANT(_finish_prune)(other);
+    HT_VARIANT(_finish_grow)(other);
+    // merging a table into itself adds no keys
+    int hll_merged = (other == self) ? 1 : HT_VARIANT(_merge_hll)(self, other);
+    if (hll_merged < 0)
+        error = HT_ERROR_MEMORY;
+
+    HT_VARIANT(_cell_t) * table = other->table;
+    long long total = other->total;
+    long long merged = 0;
+    uint32_t i;
+    for (i = 0; i < other->buckets && !error; i++)
+    {
+        long long count = table[i].count;
+        if (!table[i].key || count <= 0)
+            continue;
+
+        Py_ssize_t dataLength;
+        const char * data = HT_VARIANT(_key)(other, i, &dataLength);
+        HT_VARIANT(_cell_t) * cell = HT_VARIANT(_allocate_cell_hashed)(self, other->hashes[i], data, dataLength, 0);
+
+        // keys of the table before its first prune are seeded by the prune
+        if (cell && !hll_merged && self->max_prune
+                && HT_VARIANT(_hll_add)(&self->hll, HT_VARIANT(_hash)(data, dataLength), data, dataLength))
+            cell = NULL;
+
+        if (!cell)
+            error = HT_ERROR_MEMORY;
+        else if (HT_VARIANT(_add_count)(self, cell, count))
+            error = HT_ERROR_OVERFLOW;
+        else
+            merged += count;
+#ifdef HT_SPACE_SAVING
+        if (!error)
+            cell->error += table[i].error;
+#endif
+    }
+    if (!error)
+        self->total += total - merged;
+
+#ifdef HT_CONCURRENT
+    PyEval_RestoreThread(save);
+    if (second != first)
+        parallel_unlock(&second->lock, 1);
+    parallel_unlock(&first->lock, 1);
+#endif
+    return HT_VARIANT(_raise)(error);
+}
+
 static PyObject *
 HT_VARIANT(_update)(HT_TYPE * self, PyObject *args)
 {
@@ -717,13 +2791,31 @@ HT_VARIANT(_update)(HT_TYPE * self, PyObject *args)
     if (!PyArg_ParseTuple(args, "O", &arg))
         return NULL;
 
-    if (PyDict_Check(arg) || PyObject_TypeCheck(arg, ((PyObject *) self)->ob_type))
+    if (PyObject_TypeCheck(arg, ((PyObject *) self)->ob_type))
+    {
+        if (HT_VARIANT(_merge)(self, (HT_TYPE *) arg))
+            return NULL;
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    if (PyDict_Check(arg))
     {
         arg = PyMapping_Items(arg);
         should_dealloc = arg;
     }
 
     PyObject * iterator = PyObject_GetIter(arg);
+#ifdef HT_CONCURRENT
+    if (iterator && HT_VARIANT(_update_batched)(self, iterator))
+    {
+        Py_DECREF(iterator);
+        if (should_dealloc)
+            Py_DECREF(should_dealloc);
+        return NULL;
+    }
+    Py_XDECREF(iterator);
+#else
     if (iterator)
     {
         PyObject *item;
@@ -762,6 +2854,7 @@ HT_VARIANT(_update)(HT_TYPE * self, PyObject *args)
         }
         Py_DECREF(iterator);
     }
+#endif
 
     if (should_dealloc)
         Py_DECREF(should_dealloc);
@@ -805,27 +2898,23 @@ PyObject* HT_VARIANT(_ITER_iternext)(HT_VARIANT(_ITER_TYPE) *self)
         }
 
         PyObject * result;
-        char * current_key = table[i].key;
-        PyObject * pkey;
-        pkey = (self->use_unicode)
-            ? PyUnicode_DecodeUTF8(current_key, strlen(current_key), NULL)
-            #if PY_MAJOR_VERSION >= 3
-            : PyBytes_FromStringAndSize(current_key, strlen(current_key));
-            #else
-            : PyString_FromStringAndSize(current_key, strlen(current_key));
-            #endif
+        PyObject * pkey = HT_VARIANT(_key_object)(self->hashtable, i, self->use_unicode);
+        // a binary key which is not valid UTF-8 is skipped after raising the decoding error
+        self->i = i + 1;
+        if (!pkey)
+            return NULL;
 
         if (self->result_type == ITER_RESULT_KEYS)
             result = pkey;
         else if (self->result_type == ITER_RESULT_KV_PAIRS)
-            result = PyTuple_Pack(2, pkey, Py_BuildValue("L", table[i].count));
+            result = Py_BuildValue("(NL)", pkey, table[i].count);
         else
         {
             char * msg = "Invalid iteration type!";
             PyErr_SetString(PyExc_SystemError, msg);
+            Py_DECREF(pkey);
             return NULL;
         }
-        self->i = i + 1;
         return result;
     }
 
@@ -835,6 +2924,17 @@ PyObject* HT_VARIANT(_ITER_iternext)(HT_VARIANT(_ITER_TYPE) *self)
     return NULL;
 }
 
+#ifdef HT_CONCURRENT
+static PyObject * HT_VARIANT(_ITER_iternext_locked)(HT_VARIANT(_ITER_TYPE) *self)
+{
+    HT_TYPE * hashtable = self->hashtable;
+    HT_VARIANT(_lock)(hashtable, 1, 1);
+    PyObject * result = HT_VARIANT(_ITER_iternext)(self);
+    parallel_unlock(&hashtable->lock, 1);
+    return result;
+}
+#endif
+
 /* Destructor invoked by python. */
 static void
 HT_VARIANT(_ITER_dealloc)(HT_VARIANT(_ITER_TYPE) * self)
@@ -887,12 +2987,16 @@ static PyTypeObject HT_VARIANT(_ITER_TYPE_Type) = {
     0,  /* tp_richcompare */
     0,  /* tp_weaklistoffset */
     HT_VARIANT(_ITER_iter),  /* tp_iter: __iter__() method */
-    HT_VARIANT(_ITER_iternext)  /* tp_iternext: next() method */
+    HT_LOCKED(_ITER_iternext)  /* tp_iternext: next() method */
 };
 
 static inline HT_VARIANT(_ITER_TYPE) *
 HT_VARIANT(_make_iterator)(HT_TYPE *self, char result_type)
 {
+    if (HT_VARIANT(_flush)(self))
+        return NULL;
+    HT_VARIANT(_finish_grow)(self);
+
     HT_VARIANT(_ITER_TYPE) * iterator = PyObject_New(HT_VARIANT(_ITER_TYPE), &HT_VARIANT(_ITER_TYPE_Type));
     if (!iterator)
         return NULL;
@@ -928,14 +3032,101 @@ HT_VARIANT(_HT_iter_V)(HT_TYPE *self)
     return HT_VARIANT(_make_iterator)(self, ITER_RESULT_VALUES);
 }
 
+/**
+  * Resets the table to its initial empty state, keeping its size unless it has grown. Table pages are released to the OS
+  * rather than rewritten, so clearing a large table costs no more than the pages touched since.
+  */
+static PyObject *
+HT_VARIANT(_clear)(HT_TYPE *self)
+{
+    Arena_dealloc(&self->keys);
+    Arena_dealloc(&self->pruned_keys);
+    HT_VARIANT(_arrays_free)(&self->old);
+    HT_VARIANT(_arrays_t) arrays;
+    if (self->buckets > HT_VARIANT(_initial_buckets)(self)
+            && !HT_VARIANT(_arrays_alloc)(&arrays, HT_VARIANT(_initial_buckets)(self)))
+    {
+        // a growable table starts over from its initial size
+        HT_VARIANT(_swap_arrays)(self, &arrays);
+        HT_VARIANT(_arrays_free)(&arrays);
+    }
+    else
+    {
+        pages_zero(self->table, (size_t) self->buckets * sizeof(HT_VARIANT(_cell_t)));
+#ifdef HT_CONTROL_BYTES
+        pages_zero(self->ctrl, (size_t) self->buckets + HT_GROUP_WIDTH);
+#endif
+    }
+    memset(self->histo, 0, 256 * sizeof(uint32_t));
+    HyperLogLog_clear(&self->hll);
+    Combiner_clear(&self->buffer);
+
+    self->total = 0;
+    self->size = 0;
+    self->str_allocated = 0;
+    self->max_prune = 0;
+    self->pruning = 0;
+    self->prune_seed = 0;
+#ifdef HT_SPACE_SAVING
+    HT_VARIANT(_ss_reset)(self);
+#endif
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+#ifdef HT_CONCURRENT
+#define HT_DEFINE_LOCKED(suffix) \
+static PyObject * HT_VARIANT(suffix##_locked)(HT_TYPE *self) \
+{ \
+    HT_VARIANT(_lock)(self, 1, 1); \
+    PyObject * result = HT_VARIANT(suffix)(self); \
+    parallel_unlock(&self->lock, 1); \
+    return result; \
+}
+
+HT_DEFINE_LOCKED(_cardinality)
+HT_DEFINE_LOCKED(_total)
+HT_DEFINE_LOCKED(_quality)
+HT_DEFINE_LOCKED(_print_histo)
+HT_DEFINE_LOCKED(_clear)
+HT_DEFINE_LOCKED(_print_alloc)
+HT_DEFINE_LOCKED(_reduce)
+#undef HT_DEFINE_LOCKED
+
+static PyObject * HT_VARIANT(_prune_locked)(HT_TYPE *self, PyObject *args, PyObject *kwds)
+{
+    HT_VARIANT(_lock)(self, 1, 1);
+    PyObject * result = HT_VARIANT(_prune)(self, args, kwds);
+    parallel_unlock(&self->lock, 1);
+    return result;
+}
+
+static PyObject * HT_VARIANT(_set_state_locked)(HT_TYPE *self, PyObject *args)
+{
+    HT_VARIANT(_lock)(self, 1, 1);
+    PyObject * result = HT_VARIANT(_set_state)(self, args);
+    parallel_unlock(&self->lock, 1);
+    return result;
+}
+
+static Py_ssize_t HT_VARIANT(_size_locked)(HT_TYPE *self)
+{
+    HT_VARIANT(_lock)(self, 1, 1);
+    Py_ssize_t result = HT_VARIANT(_size)(self);
+    parallel_unlock(&self->lock, 1);
+    return result;
+}
+#endif
+
 static PyMethodDef HT_VARIANT(_methods)[] = {
     {"increment", (PyCFunction)HT_VARIANT(_increment), METH_VARARGS,
      "Add a string to the counter."
     },
-    {"cardinality", (PyCFunction)HT_VARIANT(_cardinality), METH_NOARGS,
+    {"cardinality", (PyCFunction)HT_LOCKED(_cardinality), METH_NOARGS,
      "Return an estimate for the number of distinct items inserted into the counter. Does not work correctly when values are deleted!"
     },
-    {"total", (PyCFunction)HT_VARIANT(_total), METH_NOARGS,
+    {"total", (PyCFunction)HT_LOCKED(_total), METH_NOARGS,
      "Return a precise total sum of all increments performed on this counter. Does not work correcly with deleting values or setting them directly when pruning kicks in."
     },
     {"items", (PyCFunction)HT_VARIANT(_HT_iter_KV), METH_NOARGS,
@@ -959,32 +3150,46 @@ static PyMethodDef HT_VARIANT(_methods)[] = {
     {"update", (PyCFunction)HT_VARIANT(_update), METH_VARARGS,
      "Add all pairs from another counter, or add all items from an iterable."
     },
-    {"quality", (PyCFunction)HT_VARIANT(_quality), METH_NOARGS,
+    {"quality", (PyCFunction)HT_LOCKED(_quality), METH_NOARGS,
      "Return the current estimated overflow rating of the structure, calculated as (cardinality / available buckets)."
     },
-    {"_histo", (PyCFunction)HT_VARIANT(_print_histo), METH_NOARGS,
+    {"_histo", (PyCFunction)HT_LOCKED(_print_histo), METH_NOARGS,
      "Print histogram of frequencies maintained by the structure."
     },
-    {"prune", (PyCFunction)HT_VARIANT(_prune), METH_VARARGS,
-     "Remove all entries with count X or less."
+    {"clear", (PyCFunction)HT_LOCKED(_clear), METH_NOARGS,
+    "Removes all elements from the table."
+    },
+    {"prune", (PyCFunction)HT_LOCKED(_prune), METH_VARARGS | METH_KEYWORDS,
+     "Remove all entries with count X or less, using the given number of threads (all processors with 0)."
+    },
+#ifdef HT_SPACE_SAVING
+    {"error", (PyCFunction)HT_VARIANT(_error), METH_O,
+     "Return by how much the count of a key may exceed its true count, or for a key not in the table, how often it may have been seen."
+    },
+    {"top", (PyCFunction)HT_VARIANT(_top), METH_VARARGS,
+     "Return a list of (key, count, error) tuples of the k keys with the highest counts."
+    },
+    {"top_guaranteed", (PyCFunction)HT_VARIANT(_top_guaranteed), METH_VARARGS,
+     "Return whether the keys returned by top(k) are guaranteed to be the k most frequent ones."
     },
+#endif
     {"buckets", (PyCFunction)HT_VARIANT(_buckets), METH_NOARGS,
      "Return the total number of buckets in the hashtable."
     },
-    {"_mem", (PyCFunction)HT_VARIANT(_print_alloc), METH_NOARGS,
+    {"_mem", (PyCFunction)HT_LOCKED(_print_alloc), METH_NOARGS,
      "Return allocated memory on the heap in bytes (does not include OS overhead such as padding and bookkeeping)."
     },
-    {"__reduce__", (PyCFunction)HT_VARIANT(_reduce), METH_NOARGS,
+    {"__reduce__", (PyCFunction)HT_LOCKED(_reduce), METH_NOARGS,
      "Serialization function for pickling."
     },
-    {"__setstate__", (PyCFunction)HT_VARIANT(_set_state), METH_VARARGS,
+    {"__setstate__", (PyCFunction)HT_LOCKED(_set_state), METH_VARARGS,
     "De-serialization function for pickling."
     },
     {NULL}  /* Sentinel */
 };
 
 static PyMappingMethods HT_VARIANT(_map_methods) = {
-    (lenfunc) HT_VARIANT(_size),
+    (lenfunc) HT_LOCKED(_size),
     (binaryfunc) HT_VARIANT(_getitem),
     (objobjargproc) HT_VARIANT(_setitem),
 };
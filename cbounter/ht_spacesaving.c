@@ -0,0 +1,14 @@
+//-----------------------------------------------------------------------------
+// Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+// Copyright (C) 2017 Rare Technologies
+//
+// This code is distributed under the terms and conditions
+// from the MIT License (MIT).
+
+#define HT_TYPE HT_SpaceSaving
+#define HT_TYPE_STRING "HT_SpaceSaving"
+#define HT_SPACE_SAVING
+
+#include "ht_common.c"
+
+#undef HT_SPACE_SAVING
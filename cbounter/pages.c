@@ -0,0 +1,39 @@
+//-----------------------------------------------------------------------------
+// Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+// Copyright (C) 2017 Rare Technologies
+//
+// This code is distributed under the terms and conditions
+// from the MIT License (MIT).
+
+#include <stdint.h>
+#include <string.h>
+#include "pages.h"
+
+// MADV_DONTNEED only guarantees zero-filled pages on Linux
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+void pages_zero(void *ptr, size_t size)
+{
+    #ifdef __linux__
+    if (size >= PAGES_RELEASE_THRESHOLD)
+    {
+        uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+        uintptr_t begin = (uintptr_t) ptr;
+        uintptr_t end = begin + size;
+        uintptr_t first_page = (begin + page - 1) & ~(page - 1);
+        uintptr_t last_page = end & ~(page - 1);
+
+        if (last_page > first_page
+            && !madvise((void *) first_page, last_page - first_page, MADV_DONTNEED))
+        {
+            memset(ptr, 0, first_page - begin);
+            memset((void *) last_page, 0, end - last_page);
+            return;
+        }
+    }
+    #endif
+    memset(ptr, 0, size);
+}
@@ -0,0 +1,22 @@
+//-----------------------------------------------------------------------------
+// Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+// Copyright (C) 2017 Rare Technologies
+//
+// This code is distributed under the terms and conditions
+// from the MIT License (MIT).
+
+#ifndef PAGES_H
+#define PAGES_H
+
+#include <stddef.h>
+
+/* Regions at least this large are zeroed by releasing their pages to the OS. */
+#define PAGES_RELEASE_THRESHOLD (1 << 20)
+
+/* Zeroes a heap region. Large regions have their whole pages released back to the OS
+ * (they are lazily replaced with zero pages on next access), only the unaligned
+ * head and tail are written.
+ */
+void pages_zero(void *ptr, size_t size);
+
+#endif
@@ -0,0 +1,154 @@
+//-----------------------------------------------------------------------------
+// Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+// Copyright (C) 2017 Rare Technologies
+//
+// This code is distributed under the terms and conditions
+// from the MIT License (MIT).
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for the writer preference of glibc's read-write locks
+#endif
+#include <stdlib.h>
+#include "parallel.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+uint32_t parallel_cpu_count(void)
+{
+    #ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+    #else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t) count : 1;
+    #endif
+}
+
+#ifndef _WIN32
+
+typedef struct {
+    parallel_task_t task;
+    void * context;
+    uint32_t count;
+    uint32_t next;
+} parallel_job_t;
+
+static void * parallel_worker(void * arg)
+{
+    parallel_job_t * job = (parallel_job_t *) arg;
+    uint32_t i;
+    while ((i = __sync_fetch_and_add(&job->next, 1)) < job->count)
+        job->task(job->context, i);
+    return NULL;
+}
+
+#endif
+
+void parallel_for(uint32_t threads, uint32_t count, parallel_task_t task, void *context)
+{
+    if (threads > count)
+        threads = count;
+
+    #ifndef _WIN32
+    if (threads > 1)
+    {
+        parallel_job_t job = {task, context, count, 0};
+        pthread_t * workers = (pthread_t *) malloc((threads - 1) * sizeof(pthread_t));
+        uint32_t started = 0;
+
+        if (workers)
+        {
+            while (started < threads - 1
+                   && !pthread_create(&workers[started], NULL, parallel_worker, &job))
+                started++;
+        }
+
+        // the calling thread takes part as well and picks up everything if no worker could be started
+        parallel_worker(&job);
+
+        uint32_t i;
+        for (i = 0; i < started; i++)
+            pthread_join(workers[i], NULL);
+        free(workers);
+        return;
+    }
+    #endif
+
+    uint32_t i;
+    for (i = 0; i < count; i++)
+        task(context, i);
+}
+
+#ifdef _WIN32
+
+void parallel_lock_init(parallel_lock_t *lock)
+{
+    InitializeSRWLock(lock);
+}
+
+void parallel_lock_destroy(parallel_lock_t *lock)
+{
+}
+
+void parallel_lock(parallel_lock_t *lock, int exclusive)
+{
+    if (exclusive)
+        AcquireSRWLockExclusive(lock);
+    else
+        AcquireSRWLockShared(lock);
+}
+
+int parallel_try_lock(parallel_lock_t *lock, int exclusive)
+{
+    return exclusive ? TryAcquireSRWLockExclusive(lock) != 0 : TryAcquireSRWLockShared(lock) != 0;
+}
+
+void parallel_unlock(parallel_lock_t *lock, int exclusive)
+{
+    if (exclusive)
+        ReleaseSRWLockExclusive(lock);
+    else
+        ReleaseSRWLockShared(lock);
+}
+
+#else
+
+void parallel_lock_init(parallel_lock_t *lock)
+{
+    pthread_rwlockattr_t attributes;
+    pthread_rwlockattr_init(&attributes);
+    #if defined(__GLIBC__)
+    // a thread waiting for the exclusive lock must not be starved by a steady stream of shared holders
+    pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    #endif
+    pthread_rwlock_init(lock, &attributes);
+    pthread_rwlockattr_destroy(&attributes);
+}
+
+void parallel_lock_destroy(parallel_lock_t *lock)
+{
+    pthread_rwlock_destroy(lock);
+}
+
+void parallel_lock(parallel_lock_t *lock, int exclusive)
+{
+    if (exclusive)
+        pthread_rwlock_wrlock(lock);
+    else
+        pthread_rwlock_rdlock(lock);
+}
+
+int parallel_try_lock(parallel_lock_t *lock, int exclusive)
+{
+    return (exclusive ? pthread_rwlock_trywrlock(lock) : pthread_rwlock_tryrdlock(lock)) == 0;
+}
+
+void parallel_unlock(parallel_lock_t *lock, int exclusive)
+{
+    pthread_rwlock_unlock(lock);
+}
+
+#endif
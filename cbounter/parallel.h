@@ -0,0 +1,139 @@
+//-----------------------------------------------------------------------------
+// Author: Filip Stefanak <f.stefanak@rare-technologies.com>
+// Copyright (C) 2017 Rare Technologies
+//
+// This code is distributed under the terms and conditions
+// from the MIT License (MIT).
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+typedef void (*parallel_task_t)(void *context, uint32_t index);
+
+/* Returns the number of online processors, at least 1. */
+uint32_t parallel_cpu_count(void);
+
+/* Runs task(context, i) for every i in [0, count) using up to `threads` threads, including the calling one.
+ * Tasks are handed out dynamically in increasing order of i. Returns after all tasks have finished.
+ * Runs everything on the calling thread when threads are not available on the platform.
+ */
+void parallel_for(uint32_t threads, uint32_t count, parallel_task_t task, void *context);
+
+/* A lock held either by any number of threads at once or by a single one exclusively. */
+#ifdef _WIN32
+typedef SRWLOCK parallel_lock_t;
+#else
+typedef pthread_rwlock_t parallel_lock_t;
+#endif
+
+void parallel_lock_init(parallel_lock_t *lock);
+void parallel_lock_destroy(parallel_lock_t *lock);
+void parallel_lock(parallel_lock_t *lock, int exclusive);
+/* Takes the lock only if it is available right away. Returns 1 if it has been taken, 0 otherwise. */
+int parallel_try_lock(parallel_lock_t *lock, int exclusive);
+void parallel_unlock(parallel_lock_t *lock, int exclusive);
+
+/* Atomic operations on data shared between threads. */
+#ifdef _MSC_VER
+#include <intrin.h>
+#pragma intrinsic(_ReadWriteBarrier)
+
+static inline uint32_t parallel_add32(volatile uint32_t *target, int32_t value)
+{
+    return (uint32_t) InterlockedExchangeAdd((volatile LONG *) target, value) + value;
+}
+
+static inline long long parallel_add64(volatile long long *target, long long value)
+{
+    return InterlockedExchangeAdd64(target, value) + value;
+}
+
+static inline long long parallel_exchange64(volatile long long *target, long long value)
+{
+    return InterlockedExchange64(target, value);
+}
+
+/* Replaces *target with `desired` if it equals `expected`. Returns the previous value. */
+static inline void * parallel_cas_ptr(void * volatile *target, void *expected, void *desired)
+{
+    return InterlockedCompareExchangePointer(target, desired, expected);
+}
+
+static inline void * parallel_load_ptr(void * volatile *source)
+{
+    void * value = *source;
+    _ReadWriteBarrier();
+    return value;
+}
+
+static inline void parallel_store_ptr(void * volatile *target, void *value)
+{
+    _ReadWriteBarrier();
+    *target = value;
+}
+
+static inline long long parallel_load64(volatile long long *source)
+{
+    return *source;
+}
+
+/* Tells the processor that the thread is waiting for another one. */
+static inline void parallel_relax(void)
+{
+    YieldProcessor();
+}
+#else
+static inline uint32_t parallel_add32(volatile uint32_t *target, int32_t value)
+{
+    return __sync_add_and_fetch(target, (uint32_t) value);
+}
+
+static inline long long parallel_add64(volatile long long *target, long long value)
+{
+    return __sync_add_and_fetch(target, value);
+}
+
+static inline long long parallel_exchange64(volatile long long *target, long long value)
+{
+    return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+/* Replaces *target with `desired` if it equals `expected`. Returns the previous value. */
+static inline void * parallel_cas_ptr(void * volatile *target, void *expected, void *desired)
+{
+    return __sync_val_compare_and_swap(target, expected, desired);
+}
+
+static inline void * parallel_load_ptr(void * volatile *source)
+{
+    return __atomic_load_n(source, __ATOMIC_ACQUIRE);
+}
+
+static inline void parallel_store_ptr(void * volatile *target, void *value)
+{
+    __atomic_store_n(target, value, __ATOMIC_RELEASE);
+}
+
+static inline long long parallel_load64(volatile long long *source)
+{
+    return __atomic_load_n(source, __ATOMIC_RELAXED);
+}
+
+/* Tells the processor that the thread is waiting for another one. */
+static inline void parallel_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+#endif
+
+#endif
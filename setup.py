@@ -29,10 +29,13 @@ setup(
     description='Counter for large datasets',
     long_description=read('README.rst'),
 
-    headers=['cbounter/hll.h', 'cbounter/murmur3.h'],
+    headers=['cbounter/hll.h', 'cbounter/murmur3.h', 'cbounter/pages.h', 'cbounter/combiner.h', 'cbounter/arena.h',
+             'cbounter/parallel.h'],
     ext_modules=[
-        Extension('bounter_cmsc', ['cbounter/cms_cmodule.c', 'cbounter/murmur3.c', 'cbounter/hll.c']),
-        Extension('bounter_htc', ['cbounter/ht_cmodule.c', 'cbounter/murmur3.c', 'cbounter/hll.c'])
+        Extension('bounter_cmsc', ['cbounter/cms_cmodule.c', 'cbounter/murmur3.c', 'cbounter/hll.c', 'cbounter/pages.c',
+                                    'cbounter/combiner.c', 'cbounter/parallel.c']),
+        Extension('bounter_htc', ['cbounter/ht_cmodule.c', 'cbounter/murmur3.c', 'cbounter/hll.c', 'cbounter/pages.c',
+                             'cbounter/combiner.c', 'cbounter/arena.c', 'cbounter/parallel.c'])
     ],
     packages=find_packages(),
 